@@ -129,11 +129,17 @@ abstract class VectorStoreRepository {
   /// Returns true if [initialize] was called successfully
   bool get isInitialized;
 
-  /// Legacy no-op kept for source compatibility.
+  /// Opt into an approximate HNSW index for unfiltered similarity search.
   ///
-  /// Vector search now runs inside the store's engine (qdrant-edge, or
-  /// sqlite-vec/`vec0`), so there is no Dart-side HNSW to toggle. Implementations
-  /// accept the get/set but ignore it. Scheduled for removal in 2.0.
+  /// Vector search runs inside the store's engine (qdrant-edge, or
+  /// sqlite-vec/`vec0`), so this is a hint to that engine rather than a
+  /// Dart-side index. The native SQLite store builds its `vec0` table with
+  /// `index=hnsw` when set before the table is created and its sqlite-vec
+  /// build supports it, and otherwise keeps the exact scan; other
+  /// implementations accept the get/set but ignore it.
+  ///
+  /// Opt-in and meant for small corpora: the graph makes every insert far
+  /// slower (about 80x the exact table's load) for roughly 2x faster queries.
   bool get enableHnsw;
   set enableHnsw(bool value);
 
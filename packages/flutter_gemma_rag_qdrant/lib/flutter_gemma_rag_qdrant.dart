@@ -11,5 +11,6 @@
 /// ```
 library flutter_gemma_rag_qdrant;
 
+export 'src/qdrant_options.dart';
 export 'src/qdrant_vector_store_stub.dart'
     if (dart.library.ffi) 'src/qdrant_vector_store.dart';
@@ -74,6 +74,39 @@ class QdrantEdgeBindings {
         )
       >();
 
+  /// Same as `qe_shard_open`, configured by the JSON object `config_json`:
+  /// `dim` (required), `distance` (default "cosine"), `hnsw` (overrides of
+  /// `m`, `ef_construct`, `full_scan_threshold`, `on_disk`, ...),
+  /// `quantization` (Qdrant's `{"scalar": {"type": "int8", ...}}` or
+  /// `{"binary": {...}}`, with `always_ram`) and `on_disk` (mmapped vectors).
+  /// Unknown keys are an error.
+  ffi.Pointer<ffi.Void> qe_shard_open_with_config(
+    ffi.Pointer<ffi.Char> path,
+    ffi.Pointer<ffi.Char> config_json,
+    ffi.Pointer<ffi.Pointer<ffi.Char>> error_out,
+  ) {
+    return _qe_shard_open_with_config(path, config_json, error_out);
+  }
+
+  late final _qe_shard_open_with_configPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Pointer<ffi.Void> Function(
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Pointer<ffi.Char>>,
+          )
+        >
+      >('qe_shard_open_with_config');
+  late final _qe_shard_open_with_config = _qe_shard_open_with_configPtr
+      .asFunction<
+        ffi.Pointer<ffi.Void> Function(
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<ffi.Pointer<ffi.Char>>,
+        )
+      >();
+
   /// Close shard. Frees all resources. Safe to call with NULL.
   void qe_shard_close(ffi.Pointer<ffi.Void> shard) {
     return _qe_shard_close(shard);
@@ -165,6 +198,70 @@ class QdrantEdgeBindings {
         )
       >();
 
+  /// Bulk upsert from packed buffers, with no JSON round trip for the vectors.
+  ///
+  /// `ids` holds the UTF-8 ids back to back; id `i` is bytes
+  /// `[id_offsets[i], id_offsets[i + 1])`, so `id_offsets` has `count + 1`
+  /// entries. `vectors` is a row-major `count * dim` float matrix. `payloads` +
+  /// `payload_offsets` use the ids' layout, each slice a JSON object or empty
+  /// for no payload; pass NULL for both when no point has one.
+  ///
+  /// Returns 0 on success, -1 on error.
+  int qe_shard_upsert_batch_packed(
+    ffi.Pointer<ffi.Void> shard,
+    int count,
+    ffi.Pointer<ffi.Uint8> ids,
+    ffi.Pointer<ffi.Uint64> id_offsets,
+    ffi.Pointer<ffi.Float> vectors,
+    int dim,
+    ffi.Pointer<ffi.Uint8> payloads,
+    ffi.Pointer<ffi.Uint64> payload_offsets,
+    ffi.Pointer<ffi.Pointer<ffi.Char>> error_out,
+  ) {
+    return _qe_shard_upsert_batch_packed(
+      shard,
+      count,
+      ids,
+      id_offsets,
+      vectors,
+      dim,
+      payloads,
+      payload_offsets,
+      error_out,
+    );
+  }
+
+  late final _qe_shard_upsert_batch_packedPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int32 Function(
+            ffi.Pointer<ffi.Void>,
+            ffi.Size,
+            ffi.Pointer<ffi.Uint8>,
+            ffi.Pointer<ffi.Uint64>,
+            ffi.Pointer<ffi.Float>,
+            ffi.Size,
+            ffi.Pointer<ffi.Uint8>,
+            ffi.Pointer<ffi.Uint64>,
+            ffi.Pointer<ffi.Pointer<ffi.Char>>,
+          )
+        >
+      >('qe_shard_upsert_batch_packed');
+  late final _qe_shard_upsert_batch_packed = _qe_shard_upsert_batch_packedPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Void>,
+          int,
+          ffi.Pointer<ffi.Uint8>,
+          ffi.Pointer<ffi.Uint64>,
+          ffi.Pointer<ffi.Float>,
+          int,
+          ffi.Pointer<ffi.Uint8>,
+          ffi.Pointer<ffi.Uint64>,
+          ffi.Pointer<ffi.Pointer<ffi.Char>>,
+        )
+      >();
+
   /// Top-K nearest-neighbor search.
   ///
   /// On success, writes a JSON array of `{"id", "score", "payload"}` results
@@ -265,6 +362,322 @@ class QdrantEdgeBindings {
         )
       >();
 
+  /// Top-K search with a filter and per-query search parameters.
+  ///
+  /// `params_json` is Qdrant's `SearchParams`, e.g.
+  /// `{"hnsw_ef": 128, "exact": false, "quantization": {"rescore": true}}`.
+  /// Either JSON may be NULL.
+  int qe_shard_search_with_params(
+    ffi.Pointer<ffi.Void> shard,
+    ffi.Pointer<ffi.Float> vector,
+    int vector_len,
+    int top_k,
+    ffi.Pointer<ffi.Char> filter_json,
+    ffi.Pointer<ffi.Char> params_json,
+    ffi.Pointer<ffi.Pointer<ffi.Char>> response_json_out,
+    ffi.Pointer<ffi.Pointer<ffi.Char>> error_out,
+  ) {
+    return _qe_shard_search_with_params(
+      shard,
+      vector,
+      vector_len,
+      top_k,
+      filter_json,
+      params_json,
+      response_json_out,
+      error_out,
+    );
+  }
+
+  late final _qe_shard_search_with_paramsPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int32 Function(
+            ffi.Pointer<ffi.Void>,
+            ffi.Pointer<ffi.Float>,
+            ffi.Size,
+            ffi.Uint32,
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Pointer<ffi.Char>>,
+            ffi.Pointer<ffi.Pointer<ffi.Char>>,
+          )
+        >
+      >('qe_shard_search_with_params');
+  late final _qe_shard_search_with_params = _qe_shard_search_with_paramsPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Void>,
+          ffi.Pointer<ffi.Float>,
+          int,
+          int,
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<ffi.Pointer<ffi.Char>>,
+          ffi.Pointer<ffi.Pointer<ffi.Char>>,
+        )
+      >();
+
+  /// Top-K search returning only ids and scores, written into caller-provided
+  /// arrays; no payload is read or serialized. Fetch the payloads of the hits
+  /// actually used with `qe_shard_retrieve`.
+  ///
+  /// Hit `i` is `id_kinds_out[i]` (0 = u64, 1 = UUID) with 16 id bytes at
+  /// `ids_out + i * 16` (the u64 little-endian in the first 8, or the UUID
+  /// bytes) and `scores_out[i]`, best first. `filter_json` and `params_json`
+  /// (see `qe_shard_search_with_params`) may be NULL.
+  /// `id_kinds_out` and `scores_out` hold `top_k` entries, `ids_out`
+  /// `top_k * 16` bytes.
+  ///
+  /// Returns the number of hits written (<= top_k), or -1 on error.
+  int qe_shard_search_ids(
+    ffi.Pointer<ffi.Void> shard,
+    ffi.Pointer<ffi.Float> vector,
+    int vector_len,
+    int top_k,
+    ffi.Pointer<ffi.Char> filter_json,
+    ffi.Pointer<ffi.Char> params_json,
+    ffi.Pointer<ffi.Uint8> id_kinds_out,
+    ffi.Pointer<ffi.Uint8> ids_out,
+    ffi.Pointer<ffi.Float> scores_out,
+    ffi.Pointer<ffi.Pointer<ffi.Char>> error_out,
+  ) {
+    return _qe_shard_search_ids(
+      shard,
+      vector,
+      vector_len,
+      top_k,
+      filter_json,
+      params_json,
+      id_kinds_out,
+      ids_out,
+      scores_out,
+      error_out,
+    );
+  }
+
+  late final _qe_shard_search_idsPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int32 Function(
+            ffi.Pointer<ffi.Void>,
+            ffi.Pointer<ffi.Float>,
+            ffi.Size,
+            ffi.Uint32,
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Uint8>,
+            ffi.Pointer<ffi.Uint8>,
+            ffi.Pointer<ffi.Float>,
+            ffi.Pointer<ffi.Pointer<ffi.Char>>,
+          )
+        >
+      >('qe_shard_search_ids');
+  late final _qe_shard_search_ids = _qe_shard_search_idsPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Void>,
+          ffi.Pointer<ffi.Float>,
+          int,
+          int,
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<ffi.Uint8>,
+          ffi.Pointer<ffi.Uint8>,
+          ffi.Pointer<ffi.Float>,
+          ffi.Pointer<ffi.Pointer<ffi.Char>>,
+        )
+      >();
+
+  /// `qe_shard_search_ids` for `count` queries in one call. `vectors` is a
+  /// row-major `count * dim` matrix. Query `q` returns up to `top_ks[q]` hits,
+  /// or `top_k` for every query when `top_ks` is NULL; each `top_ks[q]` must be
+  /// <= `top_k`. `filters_json` is NULL, one JSON `Filter` shared by every
+  /// query, or a JSON array of `count` entries, each a `Filter` or null.
+  /// `params_json` applies to every query.
+  ///
+  /// Query `q`'s hits start at slot `q * top_k` of `id_kinds_out` and
+  /// `scores_out` (byte `q * top_k * 16` of `ids_out`), laid out as in
+  /// `qe_shard_search_ids`; `counts_out[q]` is how many were written.
+  ///
+  /// Returns 0 on success, -1 on error.
+  int qe_shard_search_batch(
+    ffi.Pointer<ffi.Void> shard,
+    int count,
+    ffi.Pointer<ffi.Float> vectors,
+    int dim,
+    int top_k,
+    ffi.Pointer<ffi.Uint32> top_ks,
+    ffi.Pointer<ffi.Char> filters_json,
+    ffi.Pointer<ffi.Char> params_json,
+    ffi.Pointer<ffi.Uint32> counts_out,
+    ffi.Pointer<ffi.Uint8> id_kinds_out,
+    ffi.Pointer<ffi.Uint8> ids_out,
+    ffi.Pointer<ffi.Float> scores_out,
+    ffi.Pointer<ffi.Pointer<ffi.Char>> error_out,
+  ) {
+    return _qe_shard_search_batch(
+      shard,
+      count,
+      vectors,
+      dim,
+      top_k,
+      top_ks,
+      filters_json,
+      params_json,
+      counts_out,
+      id_kinds_out,
+      ids_out,
+      scores_out,
+      error_out,
+    );
+  }
+
+  late final _qe_shard_search_batchPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int32 Function(
+            ffi.Pointer<ffi.Void>,
+            ffi.Size,
+            ffi.Pointer<ffi.Float>,
+            ffi.Size,
+            ffi.Uint32,
+            ffi.Pointer<ffi.Uint32>,
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Uint32>,
+            ffi.Pointer<ffi.Uint8>,
+            ffi.Pointer<ffi.Uint8>,
+            ffi.Pointer<ffi.Float>,
+            ffi.Pointer<ffi.Pointer<ffi.Char>>,
+          )
+        >
+      >('qe_shard_search_batch');
+  late final _qe_shard_search_batch = _qe_shard_search_batchPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Void>,
+          int,
+          ffi.Pointer<ffi.Float>,
+          int,
+          int,
+          ffi.Pointer<ffi.Uint32>,
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<ffi.Uint32>,
+          ffi.Pointer<ffi.Uint8>,
+          ffi.Pointer<ffi.Uint8>,
+          ffi.Pointer<ffi.Float>,
+          ffi.Pointer<ffi.Pointer<ffi.Char>>,
+        )
+      >();
+
+  /// Payloads of `count` points given in `qe_shard_search_ids`'s id layout.
+  ///
+  /// Writes a JSON array aligned with the input to `*response_json_out`
+  /// (caller frees via `qe_string_free`): each id's payload object, or null
+  /// for an id the shard does not hold. `keys` + `key_offsets` (`key_count + 1`
+  /// entries, the layout of `qe_shard_upsert_batch_packed`'s ids) keep only
+  /// those top-level payload keys; pass NULL for both to get whole payloads.
+  ///
+  /// Returns 0 on success, -1 on error.
+  int qe_shard_retrieve(
+    ffi.Pointer<ffi.Void> shard,
+    int count,
+    ffi.Pointer<ffi.Uint8> id_kinds,
+    ffi.Pointer<ffi.Uint8> ids,
+    ffi.Pointer<ffi.Uint8> keys,
+    ffi.Pointer<ffi.Uint64> key_offsets,
+    int key_count,
+    ffi.Pointer<ffi.Pointer<ffi.Char>> response_json_out,
+    ffi.Pointer<ffi.Pointer<ffi.Char>> error_out,
+  ) {
+    return _qe_shard_retrieve(
+      shard,
+      count,
+      id_kinds,
+      ids,
+      keys,
+      key_offsets,
+      key_count,
+      response_json_out,
+      error_out,
+    );
+  }
+
+  late final _qe_shard_retrievePtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int32 Function(
+            ffi.Pointer<ffi.Void>,
+            ffi.Size,
+            ffi.Pointer<ffi.Uint8>,
+            ffi.Pointer<ffi.Uint8>,
+            ffi.Pointer<ffi.Uint8>,
+            ffi.Pointer<ffi.Uint64>,
+            ffi.Size,
+            ffi.Pointer<ffi.Pointer<ffi.Char>>,
+            ffi.Pointer<ffi.Pointer<ffi.Char>>,
+          )
+        >
+      >('qe_shard_retrieve');
+  late final _qe_shard_retrieve = _qe_shard_retrievePtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Void>,
+          int,
+          ffi.Pointer<ffi.Uint8>,
+          ffi.Pointer<ffi.Uint8>,
+          ffi.Pointer<ffi.Uint8>,
+          ffi.Pointer<ffi.Uint64>,
+          int,
+          ffi.Pointer<ffi.Pointer<ffi.Char>>,
+          ffi.Pointer<ffi.Pointer<ffi.Char>>,
+        )
+      >();
+
+  /// Build a payload index on the top-level payload key `field_name`, so
+  /// filters on it use indexed lookups instead of checking payloads point by
+  /// point. Points already stored are indexed now, later ones on write.
+  ///
+  /// `field_type` is one of "keyword", "integer", "float", "bool", "datetime".
+  ///
+  /// Returns 0 on success, -1 on error.
+  int qe_shard_create_field_index(
+    ffi.Pointer<ffi.Void> shard,
+    ffi.Pointer<ffi.Char> field_name,
+    ffi.Pointer<ffi.Char> field_type,
+    ffi.Pointer<ffi.Pointer<ffi.Char>> error_out,
+  ) {
+    return _qe_shard_create_field_index(
+      shard,
+      field_name,
+      field_type,
+      error_out,
+    );
+  }
+
+  late final _qe_shard_create_field_indexPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int32 Function(
+            ffi.Pointer<ffi.Void>,
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Char>,
+            ffi.Pointer<ffi.Pointer<ffi.Char>>,
+          )
+        >
+      >('qe_shard_create_field_index');
+  late final _qe_shard_create_field_index = _qe_shard_create_field_indexPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Void>,
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<ffi.Char>,
+          ffi.Pointer<ffi.Pointer<ffi.Char>>,
+        )
+      >();
+
   /// Delete points by IDs. `ids_json` is a JSON array of strings.
   int qe_shard_delete(
     ffi.Pointer<ffi.Void> shard,
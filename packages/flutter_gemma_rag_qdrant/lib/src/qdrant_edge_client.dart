@@ -1,11 +1,13 @@
 import 'dart:convert';
 import 'dart:ffi';
 import 'dart:io';
+import 'dart:math' show max;
 import 'dart:typed_data';
 
 import 'package:ffi/ffi.dart';
 import 'package:flutter/foundation.dart' show visibleForTesting;
 import 'package:flutter_gemma_rag_qdrant/src/qdrant_edge_bindings.dart';
+import 'package:flutter_gemma_rag_qdrant/src/qdrant_options.dart';
 
 /// Distance metric used by a qdrant-edge shard. Set at open time and fixed
 /// for the shard's lifetime.
@@ -27,6 +29,28 @@ enum Distance {
   const Distance(this.wireName);
 }
 
+/// Payload index type for [QdrantEdgeClient.createFieldIndex]. Must match
+/// the JSON type stored under the key, or the index stays empty.
+enum FieldIndexType {
+  /// Exact-match strings.
+  keyword('keyword'),
+
+  /// Integers, for equality and ranges.
+  integer('integer'),
+
+  /// Any number, for ranges.
+  float('float'),
+
+  /// true / false.
+  bool('bool'),
+
+  /// RFC 3339 timestamps stored as strings.
+  datetime('datetime');
+
+  final String wireName;
+  const FieldIndexType(this.wireName);
+}
+
 /// One search hit returned by [QdrantEdgeClient.search].
 class SearchHit {
   /// Point ID as stored — typically a UUIDv5 string for points written via
@@ -83,13 +107,46 @@ class QdrantEdgeClient {
   @visibleForTesting
   static String? debugOverrideDylibPath;
 
+  /// **Test/bench-only**: send [upsertBatch] through the shim's JSON entry
+  /// point even when the packed one is available, to compare the two.
+  @visibleForTesting
+  static bool debugUseJsonUpsert = false;
+
+  /// Whether the loaded library exports `qe_shard_upsert_batch_packed`.
+  /// Prebuilts released before it do not; [upsertBatch] falls back to JSON.
+  static bool _hasPackedUpsert = false;
+
+  /// Whether the loaded library exports `qe_shard_open_with_config` and
+  /// `qe_shard_search_with_params`. Without them only default shard settings
+  /// and search parameters are available.
+  static bool _hasConfig = false;
+
+  /// Whether the loaded library exports `qe_shard_search_ids` and
+  /// `qe_shard_retrieve`; see [supportsSearchIds].
+  static bool _hasSearchIds = false;
+
+  /// Whether the loaded library exports `qe_shard_search_batch`; see
+  /// [supportsSearchBatch].
+  static bool _hasSearchBatch = false;
+
+  /// Whether the loaded library exports `qe_shard_create_field_index`; see
+  /// [supportsFieldIndex].
+  static bool _hasFieldIndex = false;
+
+  /// Bytes per id in the shim's binary id layout.
+  static const _packedIdLength = 16;
+  static const _packedIdNum = 0;
+  static const _packedIdUuid = 1;
+  static final _numericPattern = RegExp(r'^[0-9]+$');
+  static final _uuidPattern = RegExp(r'^[0-9a-fA-F]{32}$');
+
   static QdrantEdgeBindings _ensureBindings() {
     final cached = _bindings;
     if (cached != null) return cached;
 
     final override = debugOverrideDylibPath;
     if (override != null) {
-      return _bindings = QdrantEdgeBindings(DynamicLibrary.open(override));
+      return _bind(DynamicLibrary.open(override));
     }
 
     final String libPath;
@@ -124,6 +181,19 @@ class QdrantEdgeClient {
         'Did `flutter pub get` complete? Underlying error: $e',
       );
     }
+    return _bind(lib);
+  }
+
+  static QdrantEdgeBindings _bind(DynamicLibrary lib) {
+    _hasPackedUpsert = lib.providesSymbol('qe_shard_upsert_batch_packed');
+    _hasSearchIds =
+        lib.providesSymbol('qe_shard_search_ids') &&
+        lib.providesSymbol('qe_shard_retrieve');
+    _hasSearchBatch = lib.providesSymbol('qe_shard_search_batch');
+    _hasFieldIndex = lib.providesSymbol('qe_shard_create_field_index');
+    _hasConfig =
+        lib.providesSymbol('qe_shard_open_with_config') &&
+        lib.providesSymbol('qe_shard_search_with_params');
     return _bindings = QdrantEdgeBindings(lib);
   }
 
@@ -151,22 +221,42 @@ class QdrantEdgeClient {
   /// `dim` is the vector dimension. Once a shard is created with a given
   /// dim, subsequent opens **must** pass the same value (the C shim's
   /// build_edge_config will fail compatibility check otherwise).
+  ///
+  /// `config` tunes the HNSW index, quantization and on-disk storage; it
+  /// needs a library with `qe_shard_open_with_config` unless left default.
   static Future<QdrantEdgeClient> open({
     required String path,
     required int dim,
     Distance distance = Distance.cosine,
+    QdrantShardConfig? config,
   }) async {
     final client = QdrantEdgeClient._();
+    final configJson = config == null || config.isDefault
+        ? null
+        : jsonEncode(config.toJson(dim: dim, distance: distance.wireName));
+    if (configJson != null && !_hasConfig) {
+      throw const QdrantException(
+        'QdrantShardConfig needs a qdrant_edge_ffi library with '
+        'qe_shard_open_with_config',
+      );
+    }
     final pathPtr = path.toNativeUtf8();
-    final distPtr = distance.wireName.toNativeUtf8();
+    // the config JSON carries the distance when there is one
+    final distPtr = (configJson ?? distance.wireName).toNativeUtf8();
     final errorOut = calloc<Pointer<Utf8>>();
     try {
-      final handle = client._b.qe_shard_open(
-        pathPtr.cast(),
-        dim,
-        distPtr.cast(),
-        errorOut.cast(),
-      );
+      final handle = configJson != null
+          ? client._b.qe_shard_open_with_config(
+              pathPtr.cast(),
+              distPtr.cast(),
+              errorOut.cast(),
+            )
+          : client._b.qe_shard_open(
+              pathPtr.cast(),
+              dim,
+              distPtr.cast(),
+              errorOut.cast(),
+            );
       if (handle == nullptr) {
         throw QdrantException(
           _consumeString(client._b, errorOut) ?? 'qe_shard_open returned null',
@@ -182,6 +272,22 @@ class QdrantEdgeClient {
     }
   }
 
+  /// Whether [open]'s `config` and the `params` of [search] / [searchIds]
+  /// are available. Prebuilts released before them only take defaults.
+  bool get supportsConfig => _hasConfig;
+
+  /// Whether [searchIds] and [retrieve] are available. Prebuilts released
+  /// before them are not; use [search] there.
+  bool get supportsSearchIds => _hasSearchIds;
+
+  /// Whether [searchBatch] is available. Prebuilts released before it are
+  /// not; call [searchIds] per query there.
+  bool get supportsSearchBatch => _hasSearchBatch;
+
+  /// Whether [createFieldIndex] is available. Prebuilts released before it
+  /// are not; filters then check payloads point by point.
+  bool get supportsFieldIndex => _hasFieldIndex;
+
   /// Library version string. Reads from the shim's compiled-in constant.
   String version() {
     final ptr = _b.qe_version();
@@ -227,14 +333,94 @@ class QdrantEdgeClient {
     }
   }
 
-  /// Bulk upsert. The shim accepts a JSON array of point objects; this
-  /// method composes that JSON internally so callers stay in Dart-land.
+  /// Bulk upsert. Every point must have the same vector dimension.
+  ///
+  /// The vectors cross to the shim as one packed float matrix, with the ids
+  /// and JSON payloads as packed UTF-8 buffers beside it, so no float is ever
+  /// printed as text and parsed back. Against a library without the packed
+  /// entry point this falls back to one JSON array of points.
   Future<void> upsertBatch(
     List<({String id, List<double> vector, Map<String, dynamic>? payload})>
     points,
   ) async {
     _checkOpen();
     if (points.isEmpty) return;
+    if (!_hasPackedUpsert || debugUseJsonUpsert) {
+      return _upsertBatchJson(points);
+    }
+
+    final count = points.length;
+    final dim = points.first.vector.length;
+    final idOffsets = Uint64List(count + 1);
+    final idBytes = BytesBuilder(copy: false);
+    final hasPayloads = points.any((p) => p.payload != null);
+    final payloadOffsets = hasPayloads ? Uint64List(count + 1) : null;
+    final payloadBytes = BytesBuilder(copy: false);
+    for (var i = 0; i < count; i++) {
+      final p = points[i];
+      if (p.vector.length != dim) {
+        throw QdrantException(
+          'upsertBatch: point ${p.id} has dimension ${p.vector.length}, '
+          'expected $dim',
+        );
+      }
+      idBytes.add(utf8.encode(p.id));
+      idOffsets[i + 1] = idBytes.length;
+      if (payloadOffsets != null) {
+        final payload = p.payload;
+        if (payload != null) {
+          payloadBytes.add(utf8.encode(jsonEncode(payload)));
+        }
+        payloadOffsets[i + 1] = payloadBytes.length;
+      }
+    }
+
+    final vectorsPtr = malloc<Float>(count * dim);
+    final vectors = vectorsPtr.asTypedList(count * dim);
+    for (var i = 0; i < count; i++) {
+      vectors.setAll(i * dim, points[i].vector);
+    }
+    final idsPtr = _allocBytes(idBytes.takeBytes());
+    final idOffsetsPtr = _allocOffsets(idOffsets);
+    final payloadsPtr = payloadOffsets == null
+        ? nullptr
+        : _allocBytes(payloadBytes.takeBytes());
+    final payloadOffsetsPtr = payloadOffsets == null
+        ? nullptr
+        : _allocOffsets(payloadOffsets);
+    final errorOut = calloc<Pointer<Utf8>>();
+    try {
+      final rc = _b.qe_shard_upsert_batch_packed(
+        _shard,
+        count,
+        idsPtr,
+        idOffsetsPtr,
+        vectorsPtr,
+        dim,
+        payloadsPtr,
+        payloadOffsetsPtr,
+        errorOut.cast(),
+      );
+      if (rc != 0) {
+        throw QdrantException(
+          _consumeString(_b, errorOut) ??
+              'qe_shard_upsert_batch_packed rc=$rc',
+        );
+      }
+    } finally {
+      malloc.free(vectorsPtr);
+      malloc.free(idsPtr);
+      malloc.free(idOffsetsPtr);
+      if (payloadsPtr != nullptr) malloc.free(payloadsPtr);
+      if (payloadOffsetsPtr != nullptr) malloc.free(payloadOffsetsPtr);
+      calloc.free(errorOut);
+    }
+  }
+
+  Future<void> _upsertBatchJson(
+    List<({String id, List<double> vector, Map<String, dynamic>? payload})>
+    points,
+  ) async {
     final json = jsonEncode([
       for (final p in points)
         {
@@ -264,20 +450,33 @@ class QdrantEdgeClient {
 
   /// Top-K nearest-neighbour search. Pass [filterJson] (encoded via
   /// [FilterCodec.encode]) to constrain results by payload; pass null to
-  /// run unfiltered.
+  /// run unfiltered. [params] needs [supportsConfig] unless left default.
   Future<List<SearchHit>> search({
     required List<double> queryVector,
     required int topK,
     String? filterJson,
+    QdrantSearchParams? params,
   }) async {
     _checkOpen();
+    final paramsPtr = _allocSearchParams(params);
     final vecPtr = _allocFloatVec(queryVector);
     final filterPtr = filterJson == null ? nullptr : filterJson.toNativeUtf8();
     final responseOut = calloc<Pointer<Utf8>>();
     final errorOut = calloc<Pointer<Utf8>>();
     try {
       final int rc;
-      if (filterPtr == nullptr) {
+      if (paramsPtr != nullptr) {
+        rc = _b.qe_shard_search_with_params(
+          _shard,
+          vecPtr,
+          queryVector.length,
+          topK,
+          filterPtr.cast(),
+          paramsPtr.cast(),
+          responseOut.cast(),
+          errorOut.cast(),
+        );
+      } else if (filterPtr == nullptr) {
         rc = _b.qe_shard_search(
           _shard,
           vecPtr,
@@ -308,11 +507,286 @@ class QdrantEdgeClient {
     } finally {
       malloc.free(vecPtr);
       if (filterPtr != nullptr) malloc.free(filterPtr);
+      if (paramsPtr != nullptr) malloc.free(paramsPtr);
+      calloc.free(responseOut);
+      calloc.free(errorOut);
+    }
+  }
+
+  /// Top-K search returning ids and scores only: hits come back with a null
+  /// [SearchHit.payload], read from arrays the shim fills in place, with no
+  /// payload read or JSON built. Fetch payloads for the hits actually kept
+  /// with [retrieve]. Requires [supportsSearchIds]; [params] as in [search].
+  Future<List<SearchHit>> searchIds({
+    required List<double> queryVector,
+    required int topK,
+    String? filterJson,
+    QdrantSearchParams? params,
+  }) async {
+    _checkOpen();
+    if (topK <= 0) return const [];
+    final paramsPtr = _allocSearchParams(params);
+    final vecPtr = _allocFloatVec(queryVector);
+    final filterPtr = filterJson == null ? nullptr : filterJson.toNativeUtf8();
+    final kindsPtr = malloc<Uint8>(topK);
+    final idsPtr = malloc<Uint8>(topK * _packedIdLength);
+    final scoresPtr = malloc<Float>(topK);
+    final errorOut = calloc<Pointer<Utf8>>();
+    try {
+      final n = _b.qe_shard_search_ids(
+        _shard,
+        vecPtr,
+        queryVector.length,
+        topK,
+        filterPtr.cast(),
+        paramsPtr.cast(),
+        kindsPtr,
+        idsPtr,
+        scoresPtr,
+        errorOut.cast(),
+      );
+      if (n < 0) {
+        throw QdrantException(
+          _consumeString(_b, errorOut) ?? 'qe_shard_search_ids rc=$n',
+        );
+      }
+      final kinds = kindsPtr.asTypedList(n);
+      final ids = idsPtr.asTypedList(n * _packedIdLength);
+      final scores = scoresPtr.asTypedList(n);
+      return [
+        for (var i = 0; i < n; i++)
+          SearchHit(
+            id: _unpackId(kinds[i], ids, i * _packedIdLength),
+            score: scores[i],
+          ),
+      ];
+    } finally {
+      malloc.free(vecPtr);
+      if (filterPtr != nullptr) malloc.free(filterPtr);
+      if (paramsPtr != nullptr) malloc.free(paramsPtr);
+      malloc.free(kindsPtr);
+      malloc.free(idsPtr);
+      malloc.free(scoresPtr);
+      calloc.free(errorOut);
+    }
+  }
+
+  /// [searchIds] for many queries in one call to the shim, which parses the
+  /// filters and [params] once. Returns one hit list per query, in order.
+  ///
+  /// Every query returns up to [topK] hits, or `topKs[q]` when [topKs] is
+  /// given. Pass [filterJson] to filter every query alike, or [filterJsons]
+  /// (one per query, null for none) to filter each its own way. Requires
+  /// [supportsSearchBatch].
+  Future<List<List<SearchHit>>> searchBatch({
+    required List<List<double>> queryVectors,
+    required int topK,
+    List<int>? topKs,
+    String? filterJson,
+    List<String?>? filterJsons,
+    QdrantSearchParams? params,
+  }) async {
+    _checkOpen();
+    final count = queryVectors.length;
+    if (count == 0) return const [];
+    if (topKs != null && topKs.length != count) {
+      throw QdrantException(
+        'searchBatch: ${topKs.length} topKs for $count queries',
+      );
+    }
+    if (topKs != null && topKs.any((k) => k < 0)) {
+      throw const QdrantException('searchBatch: negative topK');
+    }
+    if (filterJson != null && filterJsons != null) {
+      throw const QdrantException(
+        'searchBatch: pass filterJson or filterJsons, not both',
+      );
+    }
+    if (filterJsons != null && filterJsons.length != count) {
+      throw QdrantException(
+        'searchBatch: ${filterJsons.length} filters for $count queries',
+      );
+    }
+    final dim = queryVectors.first.length;
+    for (final v in queryVectors) {
+      if (v.length != dim) {
+        throw QdrantException(
+          'searchBatch: query of dimension ${v.length}, expected $dim',
+        );
+      }
+    }
+    // the per-query limits bound the stride the shim writes at
+    final stride = topKs == null ? topK : topKs.fold(0, max);
+    if (stride <= 0) {
+      return [for (var q = 0; q < count; q++) const <SearchHit>[]];
+    }
+
+    final filters =
+        filterJson ??
+        (filterJsons == null
+            ? null
+            : '[${filterJsons.map((f) => f ?? 'null').join(',')}]');
+    final paramsPtr = _allocSearchParams(params);
+    final vectorsPtr = malloc<Float>(count * dim);
+    final vectors = vectorsPtr.asTypedList(count * dim);
+    for (var q = 0; q < count; q++) {
+      vectors.setAll(q * dim, queryVectors[q]);
+    }
+    Pointer<Uint32> topKsPtr = nullptr;
+    if (topKs != null) {
+      topKsPtr = malloc<Uint32>(count);
+      topKsPtr.asTypedList(count).setAll(0, topKs);
+    }
+    final filtersPtr = filters == null ? nullptr : filters.toNativeUtf8();
+    final countsPtr = malloc<Uint32>(count);
+    final kindsPtr = malloc<Uint8>(count * stride);
+    final idsPtr = malloc<Uint8>(count * stride * _packedIdLength);
+    final scoresPtr = malloc<Float>(count * stride);
+    final errorOut = calloc<Pointer<Utf8>>();
+    try {
+      final rc = _b.qe_shard_search_batch(
+        _shard,
+        count,
+        vectorsPtr,
+        dim,
+        stride,
+        topKsPtr,
+        filtersPtr.cast(),
+        paramsPtr.cast(),
+        countsPtr,
+        kindsPtr,
+        idsPtr,
+        scoresPtr,
+        errorOut.cast(),
+      );
+      if (rc != 0) {
+        throw QdrantException(
+          _consumeString(_b, errorOut) ?? 'qe_shard_search_batch rc=$rc',
+        );
+      }
+      final counts = countsPtr.asTypedList(count);
+      final kinds = kindsPtr.asTypedList(count * stride);
+      final ids = idsPtr.asTypedList(count * stride * _packedIdLength);
+      final scores = scoresPtr.asTypedList(count * stride);
+      return [
+        for (var q = 0; q < count; q++)
+          [
+            for (var slot = q * stride; slot < q * stride + counts[q]; slot++)
+              SearchHit(
+                id: _unpackId(kinds[slot], ids, slot * _packedIdLength),
+                score: scores[slot],
+              ),
+          ],
+      ];
+    } finally {
+      malloc.free(vectorsPtr);
+      if (topKsPtr != nullptr) malloc.free(topKsPtr);
+      if (filtersPtr != nullptr) malloc.free(filtersPtr);
+      if (paramsPtr != nullptr) malloc.free(paramsPtr);
+      malloc.free(countsPtr);
+      malloc.free(kindsPtr);
+      malloc.free(idsPtr);
+      malloc.free(scoresPtr);
+      calloc.free(errorOut);
+    }
+  }
+
+  /// Payloads of [ids], aligned with them: null for an id the shard does not
+  /// hold, `{}` for a point stored without one. Pass [keys] to keep only
+  /// those top-level payload keys; the shim drops the rest before encoding.
+  /// Requires [supportsSearchIds].
+  Future<List<Map<String, dynamic>?>> retrieve(
+    List<String> ids, {
+    List<String>? keys,
+  }) async {
+    _checkOpen();
+    if (ids.isEmpty) return const [];
+    final kinds = Uint8List(ids.length);
+    final idBytes = Uint8List(ids.length * _packedIdLength);
+    for (var i = 0; i < ids.length; i++) {
+      kinds[i] = _packId(ids[i], idBytes, i * _packedIdLength);
+    }
+    final kindsPtr = _allocBytes(kinds);
+    final idsPtr = _allocBytes(idBytes);
+    Pointer<Uint8> keysPtr = nullptr;
+    Pointer<Uint64> keyOffsetsPtr = nullptr;
+    if (keys != null) {
+      final keyBytes = BytesBuilder(copy: false);
+      final keyOffsets = Uint64List(keys.length + 1);
+      for (var i = 0; i < keys.length; i++) {
+        keyBytes.add(utf8.encode(keys[i]));
+        keyOffsets[i + 1] = keyBytes.length;
+      }
+      keysPtr = _allocBytes(keyBytes.takeBytes());
+      keyOffsetsPtr = _allocOffsets(keyOffsets);
+    }
+    final responseOut = calloc<Pointer<Utf8>>();
+    final errorOut = calloc<Pointer<Utf8>>();
+    try {
+      final rc = _b.qe_shard_retrieve(
+        _shard,
+        ids.length,
+        kindsPtr,
+        idsPtr,
+        keysPtr,
+        keyOffsetsPtr,
+        keys?.length ?? 0,
+        responseOut.cast(),
+        errorOut.cast(),
+      );
+      if (rc != 0) {
+        throw QdrantException(
+          _consumeString(_b, errorOut) ?? 'qe_shard_retrieve rc=$rc',
+        );
+      }
+      final json = _consumeString(_b, responseOut);
+      if (json == null) {
+        throw const QdrantException('qe_shard_retrieve wrote no response');
+      }
+      try {
+        return (jsonDecode(json) as List).cast<Map<String, dynamic>?>();
+      } on FormatException catch (e) {
+        throw QdrantException(
+          'Malformed retrieve response from native shim: $e',
+        );
+      }
+    } finally {
+      malloc.free(kindsPtr);
+      malloc.free(idsPtr);
+      if (keysPtr != nullptr) malloc.free(keysPtr);
+      if (keyOffsetsPtr != nullptr) malloc.free(keyOffsetsPtr);
       calloc.free(responseOut);
       calloc.free(errorOut);
     }
   }
 
+  /// Build a payload index on the top-level payload key [name], so filters
+  /// on it are answered from the index. Points already stored are indexed
+  /// now, later ones as they are written. Requires [supportsFieldIndex].
+  Future<void> createFieldIndex(String name, FieldIndexType type) async {
+    _checkOpen();
+    final namePtr = name.toNativeUtf8();
+    final typePtr = type.wireName.toNativeUtf8();
+    final errorOut = calloc<Pointer<Utf8>>();
+    try {
+      final rc = _b.qe_shard_create_field_index(
+        _shard,
+        namePtr.cast(),
+        typePtr.cast(),
+        errorOut.cast(),
+      );
+      if (rc != 0) {
+        throw QdrantException(
+          _consumeString(_b, errorOut) ?? 'qe_shard_create_field_index rc=$rc',
+        );
+      }
+    } finally {
+      malloc.free(namePtr);
+      malloc.free(typePtr);
+      calloc.free(errorOut);
+    }
+  }
+
   /// Delete points by IDs. No-op for IDs that don't exist.
   Future<void> delete(List<String> ids) async {
     _checkOpen();
@@ -368,6 +842,19 @@ class QdrantEdgeClient {
     }
   }
 
+  /// [params] as a native JSON string, or nullptr for the defaults. Throws
+  /// before anything is allocated when the library cannot take them.
+  static Pointer<Utf8> _allocSearchParams(QdrantSearchParams? params) {
+    if (params == null || params.isDefault) return nullptr;
+    if (!_hasConfig) {
+      throw const QdrantException(
+        'QdrantSearchParams needs a qdrant_edge_ffi library with '
+        'qe_shard_search_with_params',
+      );
+    }
+    return jsonEncode(params.toJson()).toNativeUtf8();
+  }
+
   static Pointer<Float> _allocFloatVec(List<double> v) {
     final ptr = malloc<Float>(v.length);
     final f32 = Float32List.fromList(v);
@@ -375,6 +862,57 @@ class QdrantEdgeClient {
     return ptr;
   }
 
+  /// Never zero-sized: malloc may return null for 0 bytes, and the shim
+  /// reads null as "absent".
+  static Pointer<Uint8> _allocBytes(Uint8List bytes) {
+    final ptr = malloc<Uint8>(bytes.isEmpty ? 1 : bytes.length);
+    ptr.asTypedList(bytes.length).setAll(0, bytes);
+    return ptr;
+  }
+
+  static Pointer<Uint64> _allocOffsets(Uint64List offsets) {
+    final ptr = malloc<Uint64>(offsets.length);
+    ptr.asTypedList(offsets.length).setAll(0, offsets);
+    return ptr;
+  }
+
+  /// Writes [id] into `bytes[offset..offset + 16]` in the shim's binary id
+  /// layout and returns its kind: an unsigned integer (as in
+  /// `qe_shard_upsert`) or a UUID with or without hyphens.
+  static int _packId(String id, Uint8List bytes, int offset) {
+    final n = _numericPattern.hasMatch(id) ? BigInt.parse(id) : null;
+    if (n != null && n.bitLength <= 64) {
+      ByteData.sublistView(
+        bytes,
+        offset,
+      ).setUint64(0, n.toSigned(64).toInt(), Endian.little);
+      return _packedIdNum;
+    }
+    final hex = id.replaceAll('-', '');
+    if (!_uuidPattern.hasMatch(hex)) {
+      throw QdrantException('invalid point id: $id');
+    }
+    for (var i = 0; i < _packedIdLength; i++) {
+      bytes[offset + i] = int.parse(hex.substring(i * 2, i * 2 + 2), radix: 16);
+    }
+    return _packedIdUuid;
+  }
+
+  /// Inverse of [_packId], formatted as the shim's JSON results format ids:
+  /// decimal for integers, lowercase hyphenated for UUIDs.
+  static String _unpackId(int kind, Uint8List bytes, int offset) {
+    if (kind == _packedIdNum) {
+      final n = ByteData.sublistView(bytes, offset).getUint64(0, Endian.little);
+      return n >= 0 ? '$n' : BigInt.from(n).toUnsigned(64).toString();
+    }
+    final hex = StringBuffer();
+    for (var i = 0; i < _packedIdLength; i++) {
+      if (i == 4 || i == 6 || i == 8 || i == 10) hex.write('-');
+      hex.write(bytes[offset + i].toRadixString(16).padLeft(2, '0'));
+    }
+    return hex.toString();
+  }
+
   /// Reads a C string from a slot (used for both error_out and response_json_out),
   /// frees it via `qe_string_free`, and returns the Dart copy. Returns null when
   /// the native side didn't write anything into the slot.
@@ -0,0 +1,129 @@
+/// Index and storage settings for a qdrant-edge shard, applied when the shard
+/// is opened. Every field left null keeps qdrant-edge's default, so
+/// `const QdrantShardConfig()` opens the same shard as no config at all.
+///
+/// These trade memory against recall and latency. On a low-RAM phone the
+/// usual levers are [quantization] (int8 scalar cuts resident vectors ~4×,
+/// binary ~32×, with [QdrantSearchParams.rescore] recovering most of the
+/// recall) and [onDiskVectors], which leaves the full-precision vectors in
+/// mmapped files for the OS to page in.
+class QdrantShardConfig {
+  const QdrantShardConfig({
+    this.hnswM,
+    this.hnswEfConstruct,
+    this.fullScanThreshold,
+    this.hnswOnDisk,
+    this.quantization,
+    this.onDiskVectors,
+  });
+
+  /// Edges per node in the HNSW graph. Lower saves memory, costs recall.
+  final int? hnswM;
+
+  /// Candidate list size while building the graph. Higher builds a better
+  /// graph, more slowly.
+  final int? hnswEfConstruct;
+
+  /// Segment size (in KB of vectors) below which qdrant scans instead of
+  /// building or using the HNSW index.
+  final int? fullScanThreshold;
+
+  /// Keep the HNSW graph in mmapped files instead of RAM.
+  final bool? hnswOnDisk;
+
+  /// Compressed copy of the vectors searched first; null for none.
+  final QdrantQuantization? quantization;
+
+  /// Keep the original vectors in mmapped files instead of RAM.
+  final bool? onDiskVectors;
+
+  /// Whether every field is left at its default.
+  bool get isDefault =>
+      hnswM == null &&
+      hnswEfConstruct == null &&
+      fullScanThreshold == null &&
+      hnswOnDisk == null &&
+      quantization == null &&
+      onDiskVectors == null;
+
+  /// The `config_json` of the shim's `qe_shard_open_with_config`.
+  Map<String, dynamic> toJson({required int dim, required String distance}) {
+    final hnsw = <String, dynamic>{
+      if (hnswM != null) 'm': hnswM,
+      if (hnswEfConstruct != null) 'ef_construct': hnswEfConstruct,
+      if (fullScanThreshold != null) 'full_scan_threshold': fullScanThreshold,
+      if (hnswOnDisk != null) 'on_disk': hnswOnDisk,
+    };
+    return {
+      'dim': dim,
+      'distance': distance,
+      if (hnsw.isNotEmpty) 'hnsw': hnsw,
+      if (quantization != null) 'quantization': quantization!.toJson(),
+      if (onDiskVectors != null) 'on_disk': onDiskVectors,
+    };
+  }
+}
+
+/// Vector quantization for a [QdrantShardConfig].
+sealed class QdrantQuantization {
+  const QdrantQuantization({this.alwaysRam});
+
+  /// Pin the quantized vectors in RAM even when the originals are on disk.
+  final bool? alwaysRam;
+
+  Map<String, dynamic> toJson();
+}
+
+/// int8 scalar quantization: one byte per dimension.
+class QdrantScalarQuantization extends QdrantQuantization {
+  const QdrantScalarQuantization({this.quantile, super.alwaysRam});
+
+  /// Fraction of values used to pick the int8 range, clipping outliers
+  /// (qdrant default 0.99 when null).
+  final double? quantile;
+
+  @override
+  Map<String, dynamic> toJson() => {
+    'scalar': {
+      'type': 'int8',
+      if (quantile != null) 'quantile': quantile,
+      if (alwaysRam != null) 'always_ram': alwaysRam,
+    },
+  };
+}
+
+/// Binary quantization: one bit per dimension. Works best on high-dimension
+/// embeddings, and wants [QdrantSearchParams.rescore].
+class QdrantBinaryQuantization extends QdrantQuantization {
+  const QdrantBinaryQuantization({super.alwaysRam});
+
+  @override
+  Map<String, dynamic> toJson() => {
+    'binary': {if (alwaysRam != null) 'always_ram': alwaysRam},
+  };
+}
+
+/// Per-query search parameters. Null fields keep qdrant-edge's defaults.
+class QdrantSearchParams {
+  const QdrantSearchParams({this.hnswEf, this.exact, this.rescore});
+
+  /// Candidate list size while searching the HNSW graph. Higher is more
+  /// accurate and slower.
+  final int? hnswEf;
+
+  /// Skip the index and compare against every vector.
+  final bool? exact;
+
+  /// With quantization, re-score the candidates against the original
+  /// vectors.
+  final bool? rescore;
+
+  bool get isDefault => hnswEf == null && exact == null && rescore == null;
+
+  /// Qdrant's `SearchParams` JSON, as the shim's `params_json` takes it.
+  Map<String, dynamic> toJson() => {
+    if (hnswEf != null) 'hnsw_ef': hnswEf,
+    if (exact != null) 'exact': exact,
+    if (rescore != null) 'quantization': {'rescore': rescore},
+  };
+}
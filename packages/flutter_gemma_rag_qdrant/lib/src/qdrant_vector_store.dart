@@ -6,6 +6,7 @@ import 'package:flutter_gemma/flutter_gemma.dart';
 import 'package:flutter_gemma_rag_qdrant/src/filter_codec.dart';
 import 'package:flutter_gemma_rag_qdrant/src/point_id_hasher.dart';
 import 'package:flutter_gemma_rag_qdrant/src/qdrant_edge_client.dart';
+import 'package:flutter_gemma_rag_qdrant/src/qdrant_options.dart';
 
 /// Native-only RAG vector store backed by qdrant-edge (FFI). Implements
 /// flutter_gemma's [VectorStoreRepository]. Its HNSW index makes it the fastest
@@ -30,7 +31,23 @@ import 'package:flutter_gemma_rag_qdrant/src/qdrant_edge_client.dart';
 ///   our Dart HNSW for typical RAG corpora.
 ///
 /// Distance defaults to cosine, matching the historical behaviour.
+///
+/// [shardConfig] tunes the HNSW index, quantization and on-disk storage of
+/// the shard (memory against recall), and [searchParams] the per-query
+/// `hnsw_ef` / exact / rescore. Both default to qdrant-edge's own settings
+/// and need a native library that exports `qe_shard_open_with_config`.
 class QdrantVectorStore implements VectorStoreRepository {
+  QdrantVectorStore({
+    this.shardConfig = const QdrantShardConfig(),
+    this.searchParams = const QdrantSearchParams(),
+  });
+
+  /// Applied whenever the shard is opened.
+  final QdrantShardConfig shardConfig;
+
+  /// Applied to every [searchSimilar].
+  final QdrantSearchParams searchParams;
+
   QdrantEdgeClient? _client;
 
   /// Dimension is captured on the first `addDocument` call (matches the
@@ -55,6 +72,11 @@ class QdrantVectorStore implements VectorStoreRepository {
   /// [FilterCodec] — which already targets top-level keys — can match on them.
   FilterSchema _filterSchema = const FilterSchema();
 
+  /// Set by [configure]: the open shard has not indexed the declared fields
+  /// yet. The next store call that reaches the shard builds the indexes and
+  /// awaits them, so the work never outlives a close, clear or re-initialize.
+  bool _fieldIndexesPending = false;
+
   /// Payload key under which we stash the original String id sent by the
   /// caller. qdrant point ids are UUID-hashed for storage; this lets
   /// [searchSimilar] reconstruct the original on the way out.
@@ -89,6 +111,43 @@ class QdrantVectorStore implements VectorStoreRepository {
       FilterCodec.validateFieldName(field.name);
     }
     _filterSchema = schema;
+    // configure() is synchronous, so it only marks the work; see
+    // _indexPendingFields. A shard opened later indexes every field anyway.
+    _fieldIndexesPending = true;
+  }
+
+  /// Builds the payload indexes [configure] left pending on the open shard.
+  Future<void> _indexPendingFields(QdrantEdgeClient c) async {
+    if (!_fieldIndexesPending) return;
+    _fieldIndexesPending = false;
+    await _indexFilterFields(c);
+  }
+
+  /// Builds a qdrant payload index on every declared [FilterField], which
+  /// [addDocument] promotes to a top-level key, so filters on them are
+  /// answered from the index instead of by checking each point's payload.
+  /// Best-effort: a library without `qe_shard_create_field_index` or a
+  /// failed build is logged, and filtering still works, just unindexed.
+  Future<void> _indexFilterFields(QdrantEdgeClient c) async {
+    if (!c.supportsFieldIndex) return;
+    for (final field in _filterSchema.fields) {
+      // a close, clear or re-initialize between two builds retired [c]
+      if (!identical(_client, c)) return;
+      final type = switch (field.type) {
+        FilterFieldType.string => FieldIndexType.keyword,
+        // JSON numbers here may be ints or doubles; a float index takes both
+        FilterFieldType.number => FieldIndexType.float,
+        FilterFieldType.bool => FieldIndexType.bool,
+      };
+      try {
+        await c.createFieldIndex(field.name, type);
+      } on QdrantException catch (e) {
+        gemmaLog(
+          '[QdrantVectorStore] payload index on ${field.name} failed — '
+          'filters on it stay unindexed: $e',
+        );
+      }
+    }
   }
 
   @override
@@ -125,6 +184,7 @@ class QdrantVectorStore implements VectorStoreRepository {
           'got vector of length $dim',
         );
       }
+      await _indexPendingFields(existing);
       return existing;
     }
     // First open. Ensure the parent directory exists; qdrant-edge creates
@@ -144,9 +204,12 @@ class QdrantVectorStore implements VectorStoreRepository {
         path: shardPath,
         dim: dim,
         distance: _distance,
+        config: shardConfig,
       );
       _client = c;
       _dim = dim;
+      _fieldIndexesPending = false;
+      await _indexFilterFields(c);
       return c;
     } on QdrantException catch (e) {
       throw VectorStoreException('Failed to open qdrant shard', e);
@@ -252,11 +315,22 @@ class QdrantVectorStore implements VectorStoreRepository {
         'match stored dimension $_dim',
       );
     }
+    await _indexPendingFields(c);
     final filterJson = FilterCodec.encode(filter, _filterSchema);
+    if (c.supportsSearchIds) {
+      final hits = await c.searchIds(
+        queryVector: queryEmbedding,
+        topK: topK,
+        filterJson: filterJson,
+        params: searchParams,
+      );
+      return (await _withPayloads(c, [hits], threshold)).single;
+    }
     final hits = await c.search(
       queryVector: queryEmbedding,
       topK: topK,
       filterJson: filterJson,
+      params: searchParams,
     );
     return [
       for (final hit in hits)
@@ -270,6 +344,117 @@ class QdrantVectorStore implements VectorStoreRepository {
     ];
   }
 
+  /// [searchSimilar] for several query embeddings at once — query expansion,
+  /// multi-vector reranking — returning one result list per query, in order.
+  ///
+  /// [filter] applies to every query; [filters] (one per query, null for
+  /// none) filters each its own way. With a native library that has
+  /// `qe_shard_search_batch`, all queries cross to the shim in one call and
+  /// the payloads of every kept hit in one more; otherwise this runs
+  /// [searchSimilar] per query.
+  ///
+  /// qdrant-edge has no batch search, so the shim still runs one search per
+  /// query, spread over the device's cores. A batch costs about its longest
+  /// run of queries, not the sum of all of them; on a single core it is
+  /// [searchSimilar] per query minus the per-call overhead.
+  Future<List<List<RetrievalResult>>> searchSimilarBatch({
+    required List<List<double>> queryEmbeddings,
+    required int topK,
+    double threshold = 0.0,
+    Filter? filter,
+    List<Filter?>? filters,
+  }) async {
+    if (filter != null && filters != null) {
+      throw ArgumentError('Pass filter or filters, not both');
+    }
+    if (filters != null && filters.length != queryEmbeddings.length) {
+      throw ArgumentError(
+        '${filters.length} filters for ${queryEmbeddings.length} queries',
+      );
+    }
+    final c = _client;
+    if (c == null || _dim == null) {
+      return [for (final _ in queryEmbeddings) const <RetrievalResult>[]];
+    }
+    await _indexPendingFields(c);
+    if (!c.supportsSearchBatch || !c.supportsSearchIds) {
+      return [
+        for (var q = 0; q < queryEmbeddings.length; q++)
+          await searchSimilar(
+            queryEmbedding: queryEmbeddings[q],
+            topK: topK,
+            threshold: threshold,
+            filter: filters == null ? filter : filters[q],
+          ),
+      ];
+    }
+    for (final e in queryEmbeddings) {
+      if (e.length != _dim) {
+        throw ArgumentError(
+          'Query embedding dimension ${e.length} does not match stored '
+          'dimension $_dim',
+        );
+      }
+    }
+    final hits = await c.searchBatch(
+      queryVectors: queryEmbeddings,
+      topK: topK,
+      filterJson: FilterCodec.encode(filter, _filterSchema),
+      filterJsons: filters == null
+          ? null
+          : [for (final f in filters) FilterCodec.encode(f, _filterSchema)],
+      params: searchParams,
+    );
+    return _withPayloads(c, hits, threshold);
+  }
+
+  /// Turns id/score hits into results: drops those under [threshold], then
+  /// fetches the payloads of the rest — each id once, however many queries
+  /// returned it — in one [QdrantEdgeClient.retrieve], cut to the three keys
+  /// a result needs so promoted filter fields never leave the shim.
+  ///
+  /// A point deleted between the search and the retrieve has no payload left
+  /// and is dropped, so a list may come back shorter than topK. Its shim id
+  /// is the UUIDv5 of the caller's id and must not stand in for it.
+  Future<List<List<RetrievalResult>>> _withPayloads(
+    QdrantEdgeClient c,
+    List<List<SearchHit>> hitsPerQuery,
+    double threshold,
+  ) async {
+    final kept = [
+      for (final hits in hitsPerQuery)
+        [
+          for (final hit in hits)
+            if (hit.score >= threshold) hit,
+        ],
+    ];
+    final ids = {
+      for (final hits in kept)
+        for (final hit in hits) hit.id,
+    }.toList();
+    if (ids.isEmpty) {
+      return [for (final _ in kept) const <RetrievalResult>[]];
+    }
+    final payloads = await c.retrieve(
+      ids,
+      keys: const [_userIdKey, _contentKey, _metadataKey],
+    );
+    final byId = {for (var i = 0; i < ids.length; i++) ids[i]: payloads[i]};
+    return [
+      for (final hits in kept)
+        [
+          for (final hit in hits)
+            if (byId[hit.id] case final payload?)
+              RetrievalResult(
+                id: payload[_userIdKey] as String? ?? hit.id,
+                content: payload[_contentKey] as String? ?? '',
+                similarity: hit.score,
+                metadata: payload[_metadataKey] as String?,
+              ),
+        ],
+    ];
+  }
+
   @override
   Future<VectorStoreStats> getStats() async {
     final c = _client;
@@ -1,9 +1,20 @@
 import 'package:flutter_gemma/flutter_gemma.dart';
+import 'package:flutter_gemma_rag_qdrant/src/qdrant_options.dart';
 
 /// Non-web stub for [QdrantVectorStore]. qdrant-edge can't compile to WASM,
 /// so on web every method throws; web RAG uses flutter_gemma_rag_sqlite's
 /// WebSqliteVectorStore instead.
 class QdrantVectorStore implements VectorStoreRepository {
+  // Same constructor as the native store, so configured call sites compile
+  // for web too.
+  QdrantVectorStore({
+    this.shardConfig = const QdrantShardConfig(),
+    this.searchParams = const QdrantSearchParams(),
+  });
+
+  final QdrantShardConfig shardConfig;
+  final QdrantSearchParams searchParams;
+
   @override
   bool get isInitialized => false;
 
@@ -51,6 +62,16 @@ class QdrantVectorStore implements VectorStoreRepository {
     'QdrantVectorStore is native-only; qdrant-edge cannot run on web',
   );
 
+  Future<List<List<RetrievalResult>>> searchSimilarBatch({
+    required List<List<double>> queryEmbeddings,
+    required int topK,
+    double threshold = 0.0,
+    Filter? filter,
+    List<Filter?>? filters,
+  }) async => throw UnimplementedError(
+    'QdrantVectorStore is native-only; qdrant-edge cannot run on web',
+  );
+
   @override
   Future<VectorStoreStats> getStats() async => throw UnimplementedError(
     'QdrantVectorStore is native-only; qdrant-edge cannot run on web',
@@ -3,7 +3,7 @@
 # (the other 3 — linux x86_64/arm64, windows x86_64 — are built on CI by
 # .github/workflows/build-qdrant-edge-native.yml).
 #
-# Inputs : QDRANT_EDGE_VERSION env (default: "0.6.1-flutter1")
+# Inputs : QDRANT_EDGE_VERSION env (default: "0.7.2")
 # Outputs: dist/qdrant-edge-{macos,ios,ios_sim,android}_arm64.tar.gz
 #          dist/checksums_qdrant_edge_local.txt
 #
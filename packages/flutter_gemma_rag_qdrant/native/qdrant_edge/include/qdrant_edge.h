@@ -50,6 +50,16 @@ void *qe_shard_open(const char *path,
                     const char *distance,
                     char **error_out);
 
+/// Same as `qe_shard_open`, configured by the JSON object `config_json`:
+/// `dim` (required), `distance` (default "cosine"), `hnsw` (overrides of
+/// `m`, `ef_construct`, `full_scan_threshold`, `on_disk`, ...),
+/// `quantization` (Qdrant's `{"scalar": {"type": "int8", ...}}` or
+/// `{"binary": {...}}`, with `always_ram`) and `on_disk` (mmapped vectors).
+/// Unknown keys are an error.
+void *qe_shard_open_with_config(const char *path,
+                                const char *config_json,
+                                char **error_out);
+
 /// Close shard. Frees all resources. Safe to call with NULL.
 void qe_shard_close(void *shard);
 
@@ -77,6 +87,25 @@ int32_t qe_shard_upsert_batch(void *shard,
                               const char *points_json,
                               char **error_out);
 
+/// Bulk upsert from packed buffers, with no JSON round trip for the vectors.
+///
+/// `ids` holds the UTF-8 ids back to back; id `i` is bytes
+/// `[id_offsets[i], id_offsets[i + 1])`, so `id_offsets` has `count + 1`
+/// entries. `vectors` is a row-major `count * dim` float matrix. `payloads` +
+/// `payload_offsets` use the ids' layout, each slice a JSON object or empty
+/// for no payload; pass NULL for both when no point has one.
+///
+/// Returns 0 on success, -1 on error.
+int32_t qe_shard_upsert_batch_packed(void *shard,
+                                     size_t count,
+                                     const uint8_t *ids,
+                                     const uint64_t *id_offsets,
+                                     const float *vectors,
+                                     size_t dim,
+                                     const uint8_t *payloads,
+                                     const uint64_t *payload_offsets,
+                                     char **error_out);
+
 // ---------------------------------------------------------------------------
 // Search
 // ---------------------------------------------------------------------------
@@ -106,6 +135,104 @@ int32_t qe_shard_search_with_filter(void *shard,
                                     char **response_json_out,
                                     char **error_out);
 
+/// Top-K search with a filter and per-query search parameters.
+///
+/// `params_json` is Qdrant's `SearchParams`, e.g.
+/// `{"hnsw_ef": 128, "exact": false, "quantization": {"rescore": true}}`.
+/// Either JSON may be NULL.
+int32_t qe_shard_search_with_params(void *shard,
+                                    const float *vector,
+                                    size_t vector_len,
+                                    uint32_t top_k,
+                                    const char *filter_json,
+                                    const char *params_json,
+                                    char **response_json_out,
+                                    char **error_out);
+
+/// Top-K search returning only ids and scores, written into caller-provided
+/// arrays; no payload is read or serialized. Fetch the payloads of the hits
+/// actually used with `qe_shard_retrieve`.
+///
+/// Hit `i` is `id_kinds_out[i]` (0 = u64, 1 = UUID) with 16 id bytes at
+/// `ids_out + i * 16` (the u64 little-endian in the first 8, or the UUID
+/// bytes) and `scores_out[i]`, best first. `filter_json` and `params_json`
+/// (see `qe_shard_search_with_params`) may be NULL.
+/// `id_kinds_out` and `scores_out` hold `top_k` entries, `ids_out`
+/// `top_k * 16` bytes.
+///
+/// Returns the number of hits written (<= top_k), or -1 on error.
+int32_t qe_shard_search_ids(void *shard,
+                            const float *vector,
+                            size_t vector_len,
+                            uint32_t top_k,
+                            const char *filter_json,
+                            const char *params_json,
+                            uint8_t *id_kinds_out,
+                            uint8_t *ids_out,
+                            float *scores_out,
+                            char **error_out);
+
+/// `qe_shard_search_ids` for `count` queries in one call. `vectors` is a
+/// row-major `count * dim` matrix. Query `q` returns up to `top_ks[q]` hits,
+/// or `top_k` for every query when `top_ks` is NULL; each `top_ks[q]` must be
+/// <= `top_k`. `filters_json` is NULL, one JSON `Filter` shared by every
+/// query, or a JSON array of `count` entries, each a `Filter` or null.
+/// `params_json` applies to every query.
+///
+/// Query `q`'s hits start at slot `q * top_k` of `id_kinds_out` and
+/// `scores_out` (byte `q * top_k * 16` of `ids_out`), laid out as in
+/// `qe_shard_search_ids`; `counts_out[q]` is how many were written.
+///
+/// Returns 0 on success, -1 on error.
+int32_t qe_shard_search_batch(void *shard,
+                              size_t count,
+                              const float *vectors,
+                              size_t dim,
+                              uint32_t top_k,
+                              const uint32_t *top_ks,
+                              const char *filters_json,
+                              const char *params_json,
+                              uint32_t *counts_out,
+                              uint8_t *id_kinds_out,
+                              uint8_t *ids_out,
+                              float *scores_out,
+                              char **error_out);
+
+/// Payloads of `count` points given in `qe_shard_search_ids`'s id layout.
+///
+/// Writes a JSON array aligned with the input to `*response_json_out`
+/// (caller frees via `qe_string_free`): each id's payload object, or null
+/// for an id the shard does not hold. `keys` + `key_offsets` (`key_count + 1`
+/// entries, the layout of `qe_shard_upsert_batch_packed`'s ids) keep only
+/// those top-level payload keys; pass NULL for both to get whole payloads.
+///
+/// Returns 0 on success, -1 on error.
+int32_t qe_shard_retrieve(void *shard,
+                          size_t count,
+                          const uint8_t *id_kinds,
+                          const uint8_t *ids,
+                          const uint8_t *keys,
+                          const uint64_t *key_offsets,
+                          size_t key_count,
+                          char **response_json_out,
+                          char **error_out);
+
+// ---------------------------------------------------------------------------
+// Payload indexes
+// ---------------------------------------------------------------------------
+
+/// Build a payload index on the top-level payload key `field_name`, so
+/// filters on it use indexed lookups instead of checking payloads point by
+/// point. Points already stored are indexed now, later ones on write.
+///
+/// `field_type` is one of "keyword", "integer", "float", "bool", "datetime".
+///
+/// Returns 0 on success, -1 on error.
+int32_t qe_shard_create_field_index(void *shard,
+                                    const char *field_name,
+                                    const char *field_type,
+                                    char **error_out);
+
 // ---------------------------------------------------------------------------
 // Delete + count
 // ---------------------------------------------------------------------------
@@ -1,8 +1,10 @@
-//! Production C-FFI shim over qdrant-edge 0.6.1.
+//! Production C-FFI shim over qdrant-edge 0.7.2.
 //!
 //! API surface:
-//!   open / upsert / upsert_batch / search / search_with_filter /
-//!   delete / clear / count / optimize / close / version
+//!   open / open_with_config / upsert / upsert_batch / upsert_batch_packed /
+//!   search / search_with_filter / search_with_params / search_ids /
+//!   search_batch / retrieve / create_field_index / delete / clear / count /
+//!   optimize / close / version
 //!
 //! Memory model:
 //!   - Strings out (version, errors, JSON results) are heap-allocated
@@ -10,12 +12,18 @@
 //!   - Shard handle is opaque `*mut c_void` over `Box<EdgeShard>`;
 //!     caller MUST close via `qe_shard_close`.
 //!   - Vector inputs are `*const f32 + length`, no ownership transfer.
+//!   - Packed batch inputs (`*const u8` bytes + `*const u64` offsets) are
+//!     borrowed for the duration of the call, same as vectors.
+//!   - `search_ids` / `search_batch` write into caller-allocated arrays sized
+//!     for `top_k` (per query, for the batch).
 //!
 //! ID handling:
 //!   - PointId comes in as a C string. qdrant-edge `ExtendedPointId::FromStr`
 //!     parses it: pure-numeric → NumId(u64), UUID → Uuid, otherwise error.
 //!   - Dart side wraps user String IDs into UUIDv5 (deterministic hash) before
 //!     passing — see `lib/core/infrastructure/qdrant_vector_store_repository.dart`.
+//!   - `search_ids` / `retrieve` carry ids in binary instead: a kind byte
+//!     (`PACKED_ID_NUM` / `PACKED_ID_UUID`) plus `PACKED_ID_LEN` bytes each.
 
 use std::collections::HashMap;
 use std::ffi::{CStr, CString, c_char, c_void};
@@ -28,9 +36,10 @@ use std::num::NonZero;
 
 use qdrant_edge::external::serde_json;
 use qdrant_edge::{
-    CountRequest, DEFAULT_VECTOR_NAME, Distance, EdgeConfig, EdgeShard, EdgeVectorParams, Filter,
-    NamedQuery, PointId, PointInsertOperations, PointOperations, PointStruct, QueryEnum,
-    SearchRequest, UpdateOperation, WalOptions, WithPayloadInterface, WithVector,
+    CountRequest, CreateIndex, DEFAULT_VECTOR_NAME, Distance, EdgeConfig, EdgeShard,
+    EdgeVectorParams, FieldIndexOperations, Filter, NamedQuery, PointId, PointInsertOperations,
+    PointOperations, PointStruct, QueryEnum, SearchRequest, UpdateOperation, WalOptions,
+    WithPayloadInterface, WithVector,
 };
 
 /// WAL segment capacity for embedded/mobile deployments.
@@ -95,6 +104,49 @@ fn point_id_to_json(id: &PointId) -> serde_json::Value {
     }
 }
 
+/// Bytes per id in the binary id layout of `qe_shard_search_ids` and
+/// `qe_shard_retrieve`: a u64 little-endian in the first 8 (rest zero), or the
+/// 16 UUID bytes. The kind byte beside it says which.
+const PACKED_ID_LEN: usize = 16;
+const PACKED_ID_NUM: u8 = 0;
+const PACKED_ID_UUID: u8 = 1;
+
+fn pack_point_id(id: &PointId, bytes: &mut [u8]) -> u8 {
+    match id {
+        PointId::NumId(n) => {
+            bytes[..8].copy_from_slice(&n.to_le_bytes());
+            bytes[8..].fill(0);
+            PACKED_ID_NUM
+        }
+        PointId::Uuid(u) => {
+            bytes.copy_from_slice(u.as_bytes());
+            PACKED_ID_UUID
+        }
+    }
+}
+
+fn unpack_point_id(kind: u8, bytes: &[u8]) -> Result<PointId, String> {
+    match kind {
+        PACKED_ID_NUM => {
+            let mut n = [0u8; 8];
+            n.copy_from_slice(&bytes[..8]);
+            Ok(PointId::NumId(u64::from_le_bytes(n)))
+        }
+        PACKED_ID_UUID => {
+            let h: String = bytes.iter().map(|b| format!("{b:02x}")).collect();
+            parse_point_id(&format!(
+                "{}-{}-{}-{}-{}",
+                &h[0..8],
+                &h[8..12],
+                &h[12..16],
+                &h[16..20],
+                &h[20..32]
+            ))
+        }
+        other => Err(format!("unknown id kind {other}")),
+    }
+}
+
 fn distance_from_str(s: &str) -> Result<Distance, String> {
     match s.to_ascii_lowercase().as_str() {
         "cosine" => Ok(Distance::Cosine),
@@ -128,6 +180,82 @@ fn build_edge_config(dim: u32, distance: Distance) -> EdgeConfig {
     }
 }
 
+const HNSW_CONFIG_KEYS: &[&str] = &[
+    "m",
+    "ef_construct",
+    "full_scan_threshold",
+    "max_indexing_threads",
+    "on_disk",
+    "payload_m",
+];
+
+/// `build_edge_config` driven by the JSON object of `qe_shard_open_with_config`:
+///
+/// ```json
+/// {"dim": 768, "distance": "cosine", "on_disk": true,
+///  "hnsw": {"m": 8, "ef_construct": 64, "full_scan_threshold": 5000},
+///  "quantization": {"scalar": {"type": "int8", "always_ram": true}}}
+/// ```
+///
+/// Only `dim` is required. `hnsw` overrides fields of the default collection
+/// HNSW config (`m`, `ef_construct`, `full_scan_threshold`, `on_disk`, ...);
+/// `quantization` is Qdrant's `QuantizationConfig` (`scalar` or `binary`)
+/// and `on_disk` keeps the vectors in mmapped files rather than RAM, both for
+/// the one vector this shim stores. Unknown keys are errors, not ignored.
+fn build_edge_config_from_json(config_json: &str) -> Result<EdgeConfig, String> {
+    let mut cfg = match serde_json::from_str(config_json) {
+        Ok(serde_json::Value::Object(m)) => m,
+        Ok(_) => return Err("config must be a JSON object".to_string()),
+        Err(e) => return Err(format!("config JSON: {e}")),
+    };
+    let dim = cfg
+        .remove("dim")
+        .and_then(|v| v.as_u64())
+        .and_then(|d| u32::try_from(d).ok())
+        .filter(|d| *d > 0)
+        .ok_or("config: `dim` must be a positive integer")?;
+    let distance = match cfg.remove("distance") {
+        None => Distance::Cosine,
+        Some(v) => distance_from_str(v.as_str().ok_or("config: `distance` must be a string")?)?,
+    };
+    let mut config = build_edge_config(dim, distance);
+
+    if let Some(v) = cfg.remove("hnsw") {
+        let serde_json::Value::Object(overrides) = v else {
+            return Err("config: `hnsw` must be an object".to_string());
+        };
+        // Overlay onto the serialized default so every field not named keeps
+        // its default. The optional fields are skipped when unset, hence the
+        // explicit list rather than checking against the default's keys.
+        let mut hnsw = serde_json::to_value(&config.hnsw_config)
+            .map_err(|e| format!("config `hnsw`: {e}"))?;
+        let fields = hnsw.as_object_mut().ok_or("config `hnsw`: unexpected default")?;
+        for (k, v) in overrides {
+            if !HNSW_CONFIG_KEYS.contains(&k.as_str()) {
+                return Err(format!("config `hnsw`: unknown key `{k}`"));
+            }
+            fields.insert(k, v);
+        }
+        config.hnsw_config =
+            serde_json::from_value(hnsw).map_err(|e| format!("config `hnsw`: {e}"))?;
+    }
+    let params = config
+        .vectors
+        .get_mut(DEFAULT_VECTOR_NAME)
+        .expect("build_edge_config adds the default vector");
+    if let Some(v) = cfg.remove("quantization") {
+        params.quantization_config =
+            Some(serde_json::from_value(v).map_err(|e| format!("config `quantization`: {e}"))?);
+    }
+    if let Some(v) = cfg.remove("on_disk") {
+        params.on_disk = Some(v.as_bool().ok_or("config: `on_disk` must be a bool")?);
+    }
+    if let Some(k) = cfg.keys().next() {
+        return Err(format!("config: unknown key `{k}`"));
+    }
+    Ok(config)
+}
+
 // ====================================================================
 // Version
 // ====================================================================
@@ -135,7 +263,7 @@ fn build_edge_config(dim: u32, distance: Distance) -> EdgeConfig {
 /// Returns shim version string. Caller must free with `qe_string_free`.
 #[unsafe(no_mangle)]
 pub extern "C" fn qe_version() -> *mut c_char {
-    cstring_into_raw(format!("qdrant-edge-ffi 0.0.1 (qdrant-edge=0.7.1)"))
+    cstring_into_raw(format!("qdrant-edge-ffi 0.0.1 (qdrant-edge=0.7.2)"))
 }
 
 // ====================================================================
@@ -180,14 +308,49 @@ pub unsafe extern "C" fn qe_shard_open(
         }
     };
 
+    unsafe { open_shard(path_s, build_edge_config(dim, distance), error_out) }
+}
+
+/// Same as `qe_shard_open`, with dimension, distance and index/storage
+/// tuning taken from the JSON object `config_json`; see
+/// `build_edge_config_from_json` for the keys.
+///
+/// # Safety
+/// - `path` and `config_json` must be valid null-terminated UTF-8 C strings.
+/// - `error_out` may be null (errors then silently discarded).
+#[unsafe(no_mangle)]
+pub unsafe extern "C" fn qe_shard_open_with_config(
+    path: *const c_char,
+    config_json: *const c_char,
+    error_out: *mut *mut c_char,
+) -> *mut c_void {
+    let path_s = match unsafe { cstr_to_str(path) } {
+        Ok(s) => s,
+        Err(e) => {
+            unsafe { write_error(error_out, e) };
+            return ptr::null_mut();
+        }
+    };
+    let config = match unsafe { cstr_to_str(config_json) }
+        .map_err(str::to_string)
+        .and_then(build_edge_config_from_json)
+    {
+        Ok(c) => c,
+        Err(e) => {
+            unsafe { write_error(error_out, e) };
+            return ptr::null_mut();
+        }
+    };
+    unsafe { open_shard(path_s, config, error_out) }
+}
+
+unsafe fn open_shard(path_s: &str, config: EdgeConfig, error_out: *mut *mut c_char) -> *mut c_void {
     let path = Path::new(path_s);
     if let Err(e) = std::fs::create_dir_all(path) {
         unsafe { write_error(error_out, format!("create_dir_all failed: {e}")) };
         return ptr::null_mut();
     }
 
-    let config = build_edge_config(dim, distance);
-
     match EdgeShard::load(path, Some(config)) {
         Ok(shard) => Box::into_raw(Box::new(shard)) as *mut c_void,
         Err(e) => {
@@ -377,6 +540,147 @@ pub unsafe extern "C" fn qe_shard_upsert_batch(
     }
 }
 
+/// Upsert `count` points from packed buffers: one f32 matrix for the vectors
+/// and one UTF-8 byte buffer each for the ids and the payloads. No vector
+/// element ever goes through text — `qe_shard_upsert_batch` spells every float
+/// out in JSON and parses it back, which dominates bulk ingest.
+///
+/// - `ids` + `id_offsets`: the ids back to back; id `i` is the bytes
+///   `ids[id_offsets[i]..id_offsets[i + 1]]` (`count + 1` offsets).
+/// - `vectors`: `count * dim` f32, row-major.
+/// - `payloads` + `payload_offsets`: same layout as the ids; each slice is a
+///   JSON object, or empty for no payload. Both null: no payloads at all.
+///
+/// Returns 0 on success, -1 on error.
+///
+/// # Safety
+/// - `shard` must be valid.
+/// - `id_offsets` must hold `count + 1` non-decreasing offsets, and `ids`
+///   at least `id_offsets[count]` bytes; likewise for the payload pair.
+/// - `vectors` must point to `count * dim` f32 values.
+#[allow(clippy::too_many_arguments)]
+#[unsafe(no_mangle)]
+pub unsafe extern "C" fn qe_shard_upsert_batch_packed(
+    shard: *mut c_void,
+    count: usize,
+    ids: *const u8,
+    id_offsets: *const u64,
+    vectors: *const f32,
+    dim: usize,
+    payloads: *const u8,
+    payload_offsets: *const u64,
+    error_out: *mut *mut c_char,
+) -> i32 {
+    let Some(shard_ref) = (unsafe { shard_ref(shard) }) else {
+        unsafe { write_error(error_out, "null shard handle") };
+        return -1;
+    };
+    if count == 0 {
+        return 0;
+    }
+    let Some(total) = count.checked_mul(dim) else {
+        unsafe { write_error(error_out, "count * dim overflows") };
+        return -1;
+    };
+    if vectors.is_null() || dim == 0 {
+        unsafe { write_error(error_out, "empty vector") };
+        return -1;
+    }
+    if payloads.is_null() != payload_offsets.is_null() {
+        unsafe { write_error(error_out, "payloads and payload_offsets must both be set or both null") };
+        return -1;
+    }
+    let id_slices = match unsafe { packed_slices(ids, id_offsets, count) } {
+        Ok(v) => v,
+        Err(e) => {
+            unsafe { write_error(error_out, format!("ids: {e}")) };
+            return -1;
+        }
+    };
+    let payload_slices = if payloads.is_null() {
+        None
+    } else {
+        match unsafe { packed_slices(payloads, payload_offsets, count) } {
+            Ok(v) => Some(v),
+            Err(e) => {
+                unsafe { write_error(error_out, format!("payloads: {e}")) };
+                return -1;
+            }
+        }
+    };
+    let matrix = unsafe { slice::from_raw_parts(vectors, total) };
+
+    let mut points = Vec::with_capacity(count);
+    for (i, (id_bytes, vector)) in id_slices.iter().zip(matrix.chunks_exact(dim)).enumerate() {
+        let id = match std::str::from_utf8(id_bytes)
+            .map_err(|_| "invalid utf-8".to_string())
+            .and_then(parse_point_id)
+        {
+            Ok(p) => p,
+            Err(e) => {
+                unsafe { write_error(error_out, format!("entry {i}: {e}")) };
+                return -1;
+            }
+        };
+        let payload = match payload_slices.as_ref().map(|p| p[i]) {
+            None | Some([]) => serde_json::json!({}),
+            Some(bytes) => match serde_json::from_slice::<serde_json::Value>(bytes) {
+                Ok(v) if v.is_object() => v,
+                Ok(_) => {
+                    unsafe { write_error(error_out, format!("entry {i}: payload must be a JSON object")) };
+                    return -1;
+                }
+                Err(e) => {
+                    unsafe { write_error(error_out, format!("entry {i}: payload JSON: {e}")) };
+                    return -1;
+                }
+            },
+        };
+        points.push(PointStruct::new(id, vector.to_vec(), payload).into());
+    }
+
+    let op = UpdateOperation::PointOperation(PointOperations::UpsertPoints(
+        PointInsertOperations::PointsList(points),
+    ));
+    match shard_ref.update(op) {
+        Ok(_) => 0,
+        Err(e) => {
+            unsafe { write_error(error_out, format!("upsert_batch_packed failed: {e}")) };
+            -1
+        }
+    }
+}
+
+/// Splits `bytes` into `count` slices at `offsets` (`count + 1` entries).
+/// `bytes` may be null only when every slice is empty.
+unsafe fn packed_slices<'a>(
+    bytes: *const u8,
+    offsets: *const u64,
+    count: usize,
+) -> Result<Vec<&'a [u8]>, String> {
+    if offsets.is_null() {
+        return Err("null offsets".to_string());
+    }
+    let offsets = unsafe { slice::from_raw_parts(offsets, count + 1) };
+    let end = offsets[count];
+    let len = usize::try_from(end).map_err(|_| format!("length {end} too large"))?;
+    let buf: &[u8] = if len == 0 {
+        &[]
+    } else if bytes.is_null() {
+        return Err("null bytes".to_string());
+    } else {
+        unsafe { slice::from_raw_parts(bytes, len) }
+    };
+    let mut out = Vec::with_capacity(count);
+    for (i, w) in offsets.windows(2).enumerate() {
+        if w[0] > w[1] || w[1] > end {
+            return Err(format!("offsets[{i}..{}] = {}..{} out of order", i + 1, w[0], w[1]));
+        }
+        out.push(&buf[w[0] as usize..w[1] as usize]);
+    }
+    Ok(out)
+}
+
 unsafe fn parse_payload(payload_json: *const c_char) -> Result<serde_json::Value, String> {
     if payload_json.is_null() {
         return Ok(serde_json::json!({}));
@@ -412,7 +716,9 @@ pub unsafe extern "C" fn qe_shard_search(
     response_json_out: *mut *mut c_char,
     error_out: *mut *mut c_char,
 ) -> i32 {
-    unsafe { do_search(shard, vector_ptr, vector_len, top_k, ptr::null(), response_json_out, error_out) }
+    unsafe {
+        do_search(shard, vector_ptr, vector_len, top_k, ptr::null(), ptr::null(), response_json_out, error_out)
+    }
 }
 
 /// Same as `qe_shard_search` but with a Qdrant filter.
@@ -431,7 +737,33 @@ pub unsafe extern "C" fn qe_shard_search_with_filter(
     response_json_out: *mut *mut c_char,
     error_out: *mut *mut c_char,
 ) -> i32 {
-    unsafe { do_search(shard, vector_ptr, vector_len, top_k, filter_json, response_json_out, error_out) }
+    unsafe {
+        do_search(shard, vector_ptr, vector_len, top_k, filter_json, ptr::null(), response_json_out, error_out)
+    }
+}
+
+/// Same as `qe_shard_search_with_filter`, plus per-query search parameters.
+/// `params_json` is Qdrant's `SearchParams`, e.g.
+/// `{"hnsw_ef": 128, "exact": false, "quantization": {"rescore": true}}`.
+/// Either JSON may be null.
+///
+/// # Safety
+/// Same as `qe_shard_search`. `filter_json` and `params_json` may be null.
+#[allow(clippy::too_many_arguments)]
+#[unsafe(no_mangle)]
+pub unsafe extern "C" fn qe_shard_search_with_params(
+    shard: *mut c_void,
+    vector_ptr: *const f32,
+    vector_len: usize,
+    top_k: u32,
+    filter_json: *const c_char,
+    params_json: *const c_char,
+    response_json_out: *mut *mut c_char,
+    error_out: *mut *mut c_char,
+) -> i32 {
+    unsafe {
+        do_search(shard, vector_ptr, vector_len, top_k, filter_json, params_json, response_json_out, error_out)
+    }
 }
 
 #[allow(clippy::too_many_arguments)]
@@ -441,6 +773,7 @@ unsafe fn do_search(
     vector_len: usize,
     top_k: u32,
     filter_json: *const c_char,
+    params_json: *const c_char,
     response_json_out: *mut *mut c_char,
     error_out: *mut *mut c_char,
 ) -> i32 {
@@ -457,27 +790,79 @@ unsafe fn do_search(
         return -1;
     }
     let vector: Vec<f32> = unsafe { slice::from_raw_parts(vector_ptr, vector_len) }.to_vec();
+    let filter = match unsafe { parse_filter(filter_json) } {
+        Ok(f) => f,
+        Err(e) => {
+            unsafe { write_error(error_out, e) };
+            return -1;
+        }
+    };
 
-    let filter = if filter_json.is_null() {
-        None
-    } else {
-        let s = match unsafe { cstr_to_str(filter_json) } {
-            Ok(s) => s,
-            Err(e) => {
-                unsafe { write_error(error_out, e) };
-                return -1;
-            }
-        };
-        match serde_json::from_str::<Filter>(s) {
-            Ok(f) => Some(f),
-            Err(e) => {
-                unsafe { write_error(error_out, format!("filter JSON: {e}")) };
-                return -1;
-            }
+    let mut req = nearest_request(vector, filter, top_k, true);
+    if let Err(e) = unsafe { apply_search_params(&mut req, params_json) } {
+        unsafe { write_error(error_out, e) };
+        return -1;
+    }
+    let points = match shard_ref.search(req) {
+        Ok(p) => p,
+        Err(e) => {
+            unsafe { write_error(error_out, format!("search failed: {e}")) };
+            return -1;
+        }
+    };
+
+    let mut out = Vec::with_capacity(points.len());
+    for p in points {
+        let id_v = point_id_to_json(&p.id);
+        let payload_v = p
+            .payload
+            .map(|pl| serde_json::to_value(pl).unwrap_or(serde_json::Value::Null))
+            .unwrap_or(serde_json::Value::Null);
+        out.push(serde_json::json!({
+            "id": id_v,
+            "score": p.score,
+            "payload": payload_v,
+        }));
+    }
+    let json = match serde_json::to_string(&out) {
+        Ok(s) => s,
+        Err(e) => {
+            unsafe { write_error(error_out, format!("serialize results: {e}")) };
+            return -1;
         }
     };
+    unsafe { *response_json_out = cstring_into_raw(json) };
+    0
+}
 
-    let req = SearchRequest {
+unsafe fn parse_filter(filter_json: *const c_char) -> Result<Option<Filter>, String> {
+    if filter_json.is_null() {
+        return Ok(None);
+    }
+    let s = unsafe { cstr_to_str(filter_json) }.map_err(str::to_string)?;
+    serde_json::from_str::<Filter>(s)
+        .map(Some)
+        .map_err(|e| format!("filter JSON: {e}"))
+}
+
+/// Sets `req.params` from a JSON `SearchParams` (`hnsw_ef`, `exact`,
+/// `quantization.rescore`, ...); null leaves the shard's defaults.
+unsafe fn apply_search_params(req: &mut SearchRequest, params_json: *const c_char) -> Result<(), String> {
+    if params_json.is_null() {
+        return Ok(());
+    }
+    let s = unsafe { cstr_to_str(params_json) }.map_err(str::to_string)?;
+    req.params = Some(serde_json::from_str(s).map_err(|e| format!("search params JSON: {e}"))?);
+    Ok(())
+}
+
+fn nearest_request(
+    vector: Vec<f32>,
+    filter: Option<Filter>,
+    top_k: u32,
+    with_payload: bool,
+) -> SearchRequest {
+    SearchRequest {
         query: QueryEnum::Nearest(NamedQuery {
             query: vector.into(),
             using: None,
@@ -486,10 +871,68 @@ unsafe fn do_search(
         params: None,
         limit: top_k as usize,
         offset: 0,
-        with_payload: Some(WithPayloadInterface::Bool(true)),
+        with_payload: Some(WithPayloadInterface::Bool(with_payload)),
         with_vector: Some(WithVector::Bool(false)),
         score_threshold: None,
+    }
+}
+
+/// Top-K search that returns only ids and scores, written straight into
+/// caller-provided arrays: no payload is read and nothing is serialized.
+/// Fetch the payloads of the hits actually used with `qe_shard_retrieve`.
+///
+/// Hit `i` is `id_kinds_out[i]` + bytes `ids_out[i * PACKED_ID_LEN..]` (see
+/// `PACKED_ID_LEN`) and `scores_out[i]`, best first. `filter_json` and
+/// `params_json` may be null, as in `qe_shard_search_with_params`.
+///
+/// Returns the number of hits written (`<= top_k`), or -1 on error.
+///
+/// # Safety
+/// - `shard` must be valid; `vector_ptr`/`vector_len` a valid f32 slice.
+/// - `id_kinds_out` must hold `top_k` bytes, `ids_out` `top_k * 16` bytes and
+///   `scores_out` `top_k` f32.
+#[allow(clippy::too_many_arguments)]
+#[unsafe(no_mangle)]
+pub unsafe extern "C" fn qe_shard_search_ids(
+    shard: *mut c_void,
+    vector_ptr: *const f32,
+    vector_len: usize,
+    top_k: u32,
+    filter_json: *const c_char,
+    params_json: *const c_char,
+    id_kinds_out: *mut u8,
+    ids_out: *mut u8,
+    scores_out: *mut f32,
+    error_out: *mut *mut c_char,
+) -> i32 {
+    let Some(shard_ref) = (unsafe { shard_ref(shard) }) else {
+        unsafe { write_error(error_out, "null shard handle") };
+        return -1;
+    };
+    if vector_ptr.is_null() || vector_len == 0 {
+        unsafe { write_error(error_out, "empty vector") };
+        return -1;
+    }
+    if top_k == 0 {
+        return 0;
+    }
+    if id_kinds_out.is_null() || ids_out.is_null() || scores_out.is_null() {
+        unsafe { write_error(error_out, "null output array") };
+        return -1;
+    }
+    let vector: Vec<f32> = unsafe { slice::from_raw_parts(vector_ptr, vector_len) }.to_vec();
+    let filter = match unsafe { parse_filter(filter_json) } {
+        Ok(f) => f,
+        Err(e) => {
+            unsafe { write_error(error_out, e) };
+            return -1;
+        }
     };
+    let mut req = nearest_request(vector, filter, top_k, false);
+    if let Err(e) = unsafe { apply_search_params(&mut req, params_json) } {
+        unsafe { write_error(error_out, e) };
+        return -1;
+    }
     let points = match shard_ref.search(req) {
         Ok(p) => p,
         Err(e) => {
@@ -498,23 +941,339 @@ unsafe fn do_search(
         }
     };
 
-    let mut out = Vec::with_capacity(points.len());
-    for p in points {
-        let id_v = point_id_to_json(&p.id);
-        let payload_v = p
+    let k = top_k as usize;
+    let kinds = unsafe { slice::from_raw_parts_mut(id_kinds_out, k) };
+    let ids = unsafe { slice::from_raw_parts_mut(ids_out, k * PACKED_ID_LEN) };
+    let scores = unsafe { slice::from_raw_parts_mut(scores_out, k) };
+    let n = points.len().min(k);
+    for (i, p) in points.iter().take(n).enumerate() {
+        kinds[i] = pack_point_id(&p.id, &mut ids[i * PACKED_ID_LEN..(i + 1) * PACKED_ID_LEN]);
+        scores[i] = p.score;
+    }
+    n as i32
+}
+
+/// `qe_shard_search_ids` for `count` queries in one call. `vectors` is a
+/// row-major `count * dim` matrix. Query `q` returns up to `top_ks[q]` hits,
+/// or `top_k` for every query when `top_ks` is null; each `top_ks[q]` must be
+/// `<= top_k`. `filters_json` is null, one JSON `Filter` shared by every
+/// query, or a JSON array of `count` entries, each a `Filter` or null.
+/// `params_json` applies to every query, as in `qe_shard_search_with_params`.
+///
+/// Query `q`'s hits start at slot `q * top_k` of `id_kinds_out` /
+/// `scores_out` (`q * top_k * PACKED_ID_LEN` bytes into `ids_out`), laid out
+/// as in `qe_shard_search_ids`, and `counts_out[q]` says how many were
+/// written.
+///
+/// The queries run concurrently, one run of them per available core; each
+/// is still its own `EdgeShard::search`.
+///
+/// Returns 0 on success, -1 on error (no query result is then meaningful).
+///
+/// # Safety
+/// - `shard` must be valid; `vectors` must hold `count * dim` f32.
+/// - `top_ks`, if non-null, and `counts_out` must hold `count` u32.
+/// - `id_kinds_out` and `scores_out` must hold `count * top_k` entries,
+///   `ids_out` `count * top_k * 16` bytes.
+#[allow(clippy::too_many_arguments)]
+#[unsafe(no_mangle)]
+pub unsafe extern "C" fn qe_shard_search_batch(
+    shard: *mut c_void,
+    count: usize,
+    vectors: *const f32,
+    dim: usize,
+    top_k: u32,
+    top_ks: *const u32,
+    filters_json: *const c_char,
+    params_json: *const c_char,
+    counts_out: *mut u32,
+    id_kinds_out: *mut u8,
+    ids_out: *mut u8,
+    scores_out: *mut f32,
+    error_out: *mut *mut c_char,
+) -> i32 {
+    let Some(shard_ref) = (unsafe { shard_ref(shard) }) else {
+        unsafe { write_error(error_out, "null shard handle") };
+        return -1;
+    };
+    if count == 0 {
+        return 0;
+    }
+    if vectors.is_null() || dim == 0 {
+        unsafe { write_error(error_out, "empty vectors") };
+        return -1;
+    }
+    let Some(total) = count.checked_mul(dim) else {
+        unsafe { write_error(error_out, "count * dim overflows") };
+        return -1;
+    };
+    let stride = top_k as usize;
+    let Some(slots) = count.checked_mul(stride).filter(|s| s.checked_mul(PACKED_ID_LEN).is_some()) else {
+        unsafe { write_error(error_out, "count * top_k overflows") };
+        return -1;
+    };
+    if counts_out.is_null() {
+        unsafe { write_error(error_out, "null counts_out") };
+        return -1;
+    }
+    let counts = unsafe { slice::from_raw_parts_mut(counts_out, count) };
+    if top_k == 0 {
+        counts.fill(0);
+        return 0;
+    }
+    if id_kinds_out.is_null() || ids_out.is_null() || scores_out.is_null() {
+        unsafe { write_error(error_out, "null output array") };
+        return -1;
+    }
+    let limits: Vec<u32> = if top_ks.is_null() {
+        vec![top_k; count]
+    } else {
+        unsafe { slice::from_raw_parts(top_ks, count) }.to_vec()
+    };
+    if let Some(q) = limits.iter().position(|l| *l > top_k) {
+        unsafe { write_error(error_out, format!("query {q}: top_k {} exceeds the stride {top_k}", limits[q])) };
+        return -1;
+    }
+    let filters = match unsafe { parse_batch_filters(filters_json, count) } {
+        Ok(f) => f,
+        Err(e) => {
+            unsafe { write_error(error_out, e) };
+            return -1;
+        }
+    };
+    // Parsed once; every request gets a copy.
+    let mut template = nearest_request(Vec::new(), None, top_k, false);
+    if let Err(e) = unsafe { apply_search_params(&mut template, params_json) } {
+        unsafe { write_error(error_out, e) };
+        return -1;
+    }
+
+    let vectors = unsafe { slice::from_raw_parts(vectors, total) };
+    let kinds = unsafe { slice::from_raw_parts_mut(id_kinds_out, slots) };
+    let ids = unsafe { slice::from_raw_parts_mut(ids_out, slots * PACKED_ID_LEN) };
+    let scores = unsafe { slice::from_raw_parts_mut(scores_out, slots) };
+    let queries: Vec<_> = filters.into_iter().zip(limits).collect();
+
+    // EdgeShard has no batch search: `search` takes one request. The queries
+    // are independent reads, so they are split into contiguous runs, one per
+    // core, each searching on its own scoped thread and writing only its own
+    // rows of the output arrays.
+    let threads = std::thread::available_parallelism().map_or(1, NonZero::get).min(count);
+    let run = count.div_ceil(threads);
+    let result = if threads == 1 {
+        search_batch_run(shard_ref, 0, &queries, vectors, dim, &template, stride, counts, kinds, ids, scores)
+    } else {
+        std::thread::scope(|scope| {
+            let workers: Vec<_> = queries
+                .chunks(run)
+                .zip(counts.chunks_mut(run))
+                .zip(kinds.chunks_mut(run * stride))
+                .zip(ids.chunks_mut(run * stride * PACKED_ID_LEN))
+                .zip(scores.chunks_mut(run * stride))
+                .enumerate()
+                .map(|(r, ((((queries, counts), kinds), ids), scores))| {
+                    let vectors = &vectors[r * run * dim..];
+                    let template = &template;
+                    scope.spawn(move || {
+                        search_batch_run(shard_ref, r * run, queries, vectors, dim, template, stride, counts, kinds, ids, scores)
+                    })
+                })
+                .collect();
+            // Joined in order, so the error reported is the lowest query's.
+            workers
+                .into_iter()
+                .try_for_each(|w| w.join().unwrap_or_else(|_| Err("search thread panicked".to_string())))
+        })
+    };
+    if let Err(e) = result {
+        unsafe { write_error(error_out, e) };
+        return -1;
+    }
+    0
+}
+
+/// One contiguous run of `qe_shard_search_batch`'s queries, the first being
+/// query `first`. `vectors` starts at that query's row, the output slices at
+/// its first slot; `template` carries the parsed search params.
+#[allow(clippy::too_many_arguments)]
+fn search_batch_run(
+    shard: &EdgeShard,
+    first: usize,
+    queries: &[(Option<Filter>, u32)],
+    vectors: &[f32],
+    dim: usize,
+    template: &SearchRequest,
+    stride: usize,
+    counts: &mut [u32],
+    kinds: &mut [u8],
+    ids: &mut [u8],
+    scores: &mut [f32],
+) -> Result<(), String> {
+    for (q, (filter, limit)) in queries.iter().enumerate() {
+        counts[q] = 0;
+        if *limit == 0 {
+            continue;
+        }
+        let vector = vectors[q * dim..(q + 1) * dim].to_vec();
+        let mut req = nearest_request(vector, filter.clone(), *limit, false);
+        req.params = template.params.clone();
+        let points = shard
+            .search(req)
+            .map_err(|e| format!("query {}: search failed: {e}", first + q))?;
+        let n = points.len().min(*limit as usize);
+        for (i, p) in points.iter().take(n).enumerate() {
+            let slot = q * stride + i;
+            kinds[slot] = pack_point_id(&p.id, &mut ids[slot * PACKED_ID_LEN..(slot + 1) * PACKED_ID_LEN]);
+            scores[slot] = p.score;
+        }
+        counts[q] = n as u32;
+    }
+    Ok(())
+}
+
+/// `filters_json` of `qe_shard_search_batch`: null, one shared `Filter`, or
+/// an array of `count` filters or nulls.
+unsafe fn parse_batch_filters(filters_json: *const c_char, count: usize) -> Result<Vec<Option<Filter>>, String> {
+    if filters_json.is_null() {
+        return Ok((0..count).map(|_| None).collect());
+    }
+    let s = unsafe { cstr_to_str(filters_json) }.map_err(str::to_string)?;
+    match serde_json::from_str(s).map_err(|e| format!("filter JSON: {e}"))? {
+        serde_json::Value::Array(items) => {
+            if items.len() != count {
+                return Err(format!("filter JSON: {} filters for {count} queries", items.len()));
+            }
+            items
+                .into_iter()
+                .enumerate()
+                .map(|(q, f)| match f {
+                    serde_json::Value::Null => Ok(None),
+                    f => serde_json::from_value::<Filter>(f)
+                        .map(Some)
+                        .map_err(|e| format!("filter JSON for query {q}: {e}")),
+                })
+                .collect()
+        }
+        shared => {
+            let f = serde_json::from_value::<Filter>(shared).map_err(|e| format!("filter JSON: {e}"))?;
+            Ok((0..count).map(|_| Some(f.clone())).collect())
+        }
+    }
+}
+
+/// Payloads of `count` points, given in the binary id layout of
+/// `qe_shard_search_ids`. Writes a JSON array to `*response_json_out`
+/// aligned with the input: the payload object of each id, or `null` for an
+/// id the shard does not hold. Caller must `qe_string_free` it.
+///
+/// `keys` + `key_offsets` (`key_count + 1` offsets, same layout as
+/// `qe_shard_upsert_batch_packed`'s ids) project every payload to those
+/// top-level keys; pass null for both to return whole payloads.
+///
+/// Returns 0 on success, -1 on error.
+///
+/// # Safety
+/// - `shard` must be valid.
+/// - `id_kinds` must hold `count` bytes and `ids` `count * 16` bytes.
+/// - `key_offsets` must hold `key_count + 1` non-decreasing offsets into
+///   `keys`, or both must be null.
+/// - `response_json_out` must be a non-null writable pointer.
+#[allow(clippy::too_many_arguments)]
+#[unsafe(no_mangle)]
+pub unsafe extern "C" fn qe_shard_retrieve(
+    shard: *mut c_void,
+    count: usize,
+    id_kinds: *const u8,
+    ids: *const u8,
+    keys: *const u8,
+    key_offsets: *const u64,
+    key_count: usize,
+    response_json_out: *mut *mut c_char,
+    error_out: *mut *mut c_char,
+) -> i32 {
+    let Some(shard_ref) = (unsafe { shard_ref(shard) }) else {
+        unsafe { write_error(error_out, "null shard handle") };
+        return -1;
+    };
+    if response_json_out.is_null() {
+        unsafe { write_error(error_out, "null response_json_out") };
+        return -1;
+    }
+    if count > 0 && (id_kinds.is_null() || ids.is_null()) {
+        unsafe { write_error(error_out, "null ids") };
+        return -1;
+    }
+    let mut point_ids = Vec::with_capacity(count);
+    if count > 0 {
+        let kinds = unsafe { slice::from_raw_parts(id_kinds, count) };
+        let bytes = unsafe { slice::from_raw_parts(ids, count * PACKED_ID_LEN) };
+        for (i, (kind, id)) in kinds.iter().zip(bytes.chunks_exact(PACKED_ID_LEN)).enumerate() {
+            match unpack_point_id(*kind, id) {
+                Ok(p) => point_ids.push(p),
+                Err(e) => {
+                    unsafe { write_error(error_out, format!("entry {i}: {e}")) };
+                    return -1;
+                }
+            }
+        }
+    }
+    let projection: Option<Vec<&str>> = if keys.is_null() && key_offsets.is_null() {
+        None
+    } else {
+        let slices = match unsafe { packed_slices(keys, key_offsets, key_count) } {
+            Ok(v) => v,
+            Err(e) => {
+                unsafe { write_error(error_out, format!("keys: {e}")) };
+                return -1;
+            }
+        };
+        match slices.into_iter().map(std::str::from_utf8).collect() {
+            Ok(v) => Some(v),
+            Err(_) => {
+                unsafe { write_error(error_out, "keys: invalid utf-8") };
+                return -1;
+            }
+        }
+    };
+
+    // Payloads stay in memory (`on_disk_payload: false`), so reading them
+    // whole and projecting here costs no I/O; what the projection saves is
+    // the serialization and the Dart-side decode of keys nobody asked for.
+    let records = match shard_ref.retrieve(
+        &point_ids,
+        Some(WithPayloadInterface::Bool(true)),
+        Some(WithVector::Bool(false)),
+    ) {
+        Ok(r) => r,
+        Err(e) => {
+            unsafe { write_error(error_out, format!("retrieve failed: {e}")) };
+            return -1;
+        }
+    };
+
+    let mut out = vec![serde_json::Value::Null; point_ids.len()];
+    for r in records {
+        let payload = r
             .payload
             .map(|pl| serde_json::to_value(pl).unwrap_or(serde_json::Value::Null))
-            .unwrap_or(serde_json::Value::Null);
-        out.push(serde_json::json!({
-            "id": id_v,
-            "score": p.score,
-            "payload": payload_v,
-        }));
+            .unwrap_or_else(|| serde_json::json!({}));
+        let payload = match (&projection, payload) {
+            (Some(keys), serde_json::Value::Object(mut map)) => serde_json::Value::Object(
+                keys.iter().filter_map(|k| map.remove_entry(*k)).collect(),
+            ),
+            (_, v) => v,
+        };
+        // k is small (the hits a caller keeps), so a scan beats a map
+        for (slot, id) in out.iter_mut().zip(&point_ids) {
+            if *id == r.id {
+                *slot = payload.clone();
+            }
+        }
     }
     let json = match serde_json::to_string(&out) {
         Ok(s) => s,
         Err(e) => {
-            unsafe { write_error(error_out, format!("serialize results: {e}")) };
+            unsafe { write_error(error_out, format!("serialize payloads: {e}")) };
             return -1;
         }
     };
@@ -522,6 +1281,79 @@ unsafe fn do_search(
     0
 }
 
+// ====================================================================
+// Payload indexes
+// ====================================================================
+
+/// Payload index types `qe_shard_create_field_index` accepts; each is the
+/// serde name of a Qdrant `PayloadSchemaType`.
+const FIELD_INDEX_TYPES: &[&str] = &["keyword", "integer", "float", "bool", "datetime"];
+
+/// Build a payload index on the top-level payload key `field_name`, so
+/// filters on it use indexed lookups and cardinality estimates instead of
+/// checking payloads point by point. Points already stored are indexed now,
+/// later ones on write. Repeating it for an indexed field is accepted.
+///
+/// `field_type` is one of "keyword", "integer", "float", "bool", "datetime".
+///
+/// Returns 0 on success, -1 on error.
+///
+/// # Safety
+/// - `shard` must be valid.
+/// - `field_name` and `field_type` must be valid null-terminated UTF-8
+///   C strings.
+#[unsafe(no_mangle)]
+pub unsafe extern "C" fn qe_shard_create_field_index(
+    shard: *mut c_void,
+    field_name: *const c_char,
+    field_type: *const c_char,
+    error_out: *mut *mut c_char,
+) -> i32 {
+    let Some(shard_ref) = (unsafe { shard_ref(shard) }) else {
+        unsafe { write_error(error_out, "null shard handle") };
+        return -1;
+    };
+    let (name, ty) = match unsafe { (cstr_to_str(field_name), cstr_to_str(field_type)) } {
+        (Ok(n), Ok(t)) => (n, t.to_ascii_lowercase()),
+        (Err(e), _) | (_, Err(e)) => {
+            unsafe { write_error(error_out, e) };
+            return -1;
+        }
+    };
+    if !FIELD_INDEX_TYPES.contains(&ty.as_str()) {
+        unsafe { write_error(error_out, format!("unknown field index type: {ty}")) };
+        return -1;
+    }
+    // Both go through serde so the shim names neither `JsonPath` nor
+    // `PayloadFieldSchema`: a key string and a bare schema type string are
+    // their JSON forms.
+    let field_name = match serde_json::from_value(serde_json::Value::String(name.to_string())) {
+        Ok(p) => p,
+        Err(e) => {
+            unsafe { write_error(error_out, format!("field name {name:?}: {e}")) };
+            return -1;
+        }
+    };
+    let field_schema = match serde_json::from_value(serde_json::Value::String(ty)) {
+        Ok(s) => Some(s),
+        Err(e) => {
+            unsafe { write_error(error_out, format!("field index type: {e}")) };
+            return -1;
+        }
+    };
+    let op = UpdateOperation::FieldIndexOperation(FieldIndexOperations::CreateIndex(CreateIndex {
+        field_name,
+        field_schema,
+    }));
+    match shard_ref.update(op) {
+        Ok(_) => 0,
+        Err(e) => {
+            unsafe { write_error(error_out, format!("create_field_index failed: {e}")) };
+            -1
+        }
+    }
+}
+
 // ====================================================================
 // Delete / clear / count
 // ====================================================================
@@ -0,0 +1,340 @@
+// Unit tests for QdrantEdgeClient's binary entry points: upsertBatch's packed
+// ABI and its JSON fallback must store the same points, searchIds + retrieve
+// and searchBatch must answer what search does, and neither shard/search
+// tuning nor field indexes may change the answers on a tiny corpus. Plain
+// Dart VM, the cargo-built shim loaded by absolute path (see
+// shim_locator.dart), same as qdrant_vector_store_test.dart.
+
+import 'dart:io';
+
+import 'package:flutter_gemma_rag_qdrant/src/qdrant_edge_client.dart';
+import 'package:flutter_gemma_rag_qdrant/src/qdrant_options.dart';
+import 'package:flutter_test/flutter_test.dart';
+
+import 'shim_locator.dart';
+
+void main() {
+  final shim = shimPath;
+  if (shim == null) {
+    registerShimMissing();
+    return;
+  }
+  QdrantEdgeClient.debugOverrideDylibPath = shim;
+
+  late String shardDir;
+
+  setUp(() {
+    shardDir =
+        '${Directory.systemTemp.path}/qdrant_client_${DateTime.now().microsecondsSinceEpoch}';
+  });
+
+  tearDown(() {
+    QdrantEdgeClient.debugUseJsonUpsert = false;
+    final dir = Directory(shardDir);
+    if (dir.existsSync()) dir.deleteSync(recursive: true);
+  });
+
+  final points = [
+    (id: '1', vector: [1.0, 0.0, 0.0, 0.0], payload: {'lang': 'en'}),
+    (id: '2', vector: [0.0, 1.0, 0.0, 0.0], payload: null),
+    (
+      id: '6ba7b810-9dad-11d1-80b4-00c04fd430c8',
+      vector: [0.0, 0.0, 1.0, 0.0],
+      payload: {'lang': 'fr', 'tags': ['a', 'b']},
+    ),
+  ];
+
+  for (final json in [false, true]) {
+    test('upsertBatch stores ids, vectors and payloads '
+        '(${json ? 'JSON' : 'packed'})', () async {
+      QdrantEdgeClient.debugUseJsonUpsert = json;
+      final client = await QdrantEdgeClient.open(path: shardDir, dim: 4);
+      addTearDown(client.close);
+      await client.upsertBatch(points);
+      expect(await client.count(), 3);
+
+      for (final p in points) {
+        final hits = await client.search(queryVector: p.vector, topK: 1);
+        final hit = hits.single;
+        expect(hit.id, p.id);
+        expect(hit.score, closeTo(1.0, 1e-6));
+        expect(hit.payload ?? const {}, p.payload ?? const {});
+      }
+
+      // upsert, not insert: the same id again replaces the point
+      await client.upsertBatch([
+        (id: '2', vector: [0.0, 0.0, 0.0, 1.0], payload: {'lang': 'de'}),
+      ]);
+      expect(await client.count(), 3);
+      final hit = (await client.search(
+        queryVector: [0.0, 0.0, 0.0, 1.0],
+        topK: 1,
+      )).single;
+      expect(hit.id, '2');
+      expect(hit.payload, {'lang': 'de'});
+    });
+  }
+
+  test('packed upsertBatch rejects mixed dimensions before the call', () async {
+    final client = await QdrantEdgeClient.open(path: shardDir, dim: 4);
+    addTearDown(client.close);
+    await expectLater(
+      client.upsertBatch([
+        (id: '1', vector: [1.0, 0.0, 0.0, 0.0], payload: null),
+        (id: '2', vector: [1.0, 0.0], payload: null),
+      ]),
+      throwsA(isA<QdrantException>()),
+    );
+    expect(await client.count(), 0);
+  });
+
+  test('packed upsertBatch surfaces an invalid id', () async {
+    final client = await QdrantEdgeClient.open(path: shardDir, dim: 4);
+    addTearDown(client.close);
+    await expectLater(
+      client.upsertBatch([
+        (id: 'not-a-uuid', vector: [1.0, 0.0, 0.0, 0.0], payload: null),
+      ]),
+      throwsA(
+        isA<QdrantException>().having(
+          (e) => e.message,
+          'message',
+          contains('entry 0'),
+        ),
+      ),
+    );
+  });
+
+  test('searchIds + retrieve match search', () async {
+    final client = await QdrantEdgeClient.open(path: shardDir, dim: 4);
+    addTearDown(client.close);
+    if (!hasEntryPoint(client.supportsSearchIds, 'qe_shard_search_ids')) {
+      return;
+    }
+    await client.upsertBatch([
+      ...points,
+      (
+        id: '18446744073709551615',
+        vector: [0.5, 0.5, 0.0, 0.0],
+        payload: {'lang': 'es'},
+      ),
+    ]);
+    const filter = '{"must":[{"key":"lang","match":{"any":["en","es"]}}]}';
+    for (final filterJson in [null, filter]) {
+      final query = [0.9, 0.1, 0.3, 0.0];
+      final full = await client.search(
+        queryVector: query,
+        topK: 10,
+        filterJson: filterJson,
+      );
+      final hits = await client.searchIds(
+        queryVector: query,
+        topK: 10,
+        filterJson: filterJson,
+      );
+      expect([for (final h in hits) h.id], [for (final h in full) h.id]);
+      for (var i = 0; i < hits.length; i++) {
+        expect(hits[i].score, closeTo(full[i].score, 1e-6));
+        expect(hits[i].payload, isNull);
+      }
+      final payloads = await client.retrieve([for (final h in hits) h.id]);
+      expect(payloads, [for (final h in full) h.payload ?? const {}]);
+    }
+  });
+
+  test('configured shard answers like a default one', () async {
+    final plain = await QdrantEdgeClient.open(path: shardDir, dim: 4);
+    addTearDown(plain.close);
+    if (!hasEntryPoint(plain.supportsConfig, 'qe_shard_open_with_config')) {
+      return;
+    }
+    final tuned = await QdrantEdgeClient.open(
+      path: '${shardDir}_tuned',
+      dim: 4,
+      config: const QdrantShardConfig(
+        hnswM: 8,
+        hnswEfConstruct: 32,
+        quantization: QdrantScalarQuantization(alwaysRam: true),
+        onDiskVectors: true,
+      ),
+    );
+    addTearDown(() async {
+      await tuned.close();
+      Directory('${shardDir}_tuned').deleteSync(recursive: true);
+    });
+    await plain.upsertBatch(points);
+    await tuned.upsertBatch(points);
+
+    const params = QdrantSearchParams(hnswEf: 64, exact: true, rescore: true);
+    for (final p in points) {
+      final want = await plain.search(queryVector: p.vector, topK: 3);
+      final got = await tuned.search(
+        queryVector: p.vector,
+        topK: 3,
+        params: params,
+      );
+      expect([for (final h in got) h.id], [for (final h in want) h.id]);
+      final ids = await tuned.searchIds(
+        queryVector: p.vector,
+        topK: 3,
+        params: params,
+      );
+      expect([for (final h in ids) h.id], [for (final h in want) h.id]);
+    }
+  });
+
+  test('other shard settings open; ill-typed ones throw', () async {
+    final plain = await QdrantEdgeClient.open(path: shardDir, dim: 4);
+    addTearDown(plain.close);
+    if (!hasEntryPoint(plain.supportsConfig, 'qe_shard_open_with_config')) {
+      return;
+    }
+    final binary = await QdrantEdgeClient.open(
+      path: '${shardDir}_binary',
+      dim: 4,
+      config: const QdrantShardConfig(
+        fullScanThreshold: 5000,
+        hnswOnDisk: true,
+        quantization: QdrantBinaryQuantization(alwaysRam: false),
+      ),
+    );
+    addTearDown(() async {
+      await binary.close();
+      Directory('${shardDir}_binary').deleteSync(recursive: true);
+    });
+    await plain.upsertBatch(points);
+    await binary.upsertBatch(points);
+    for (final p in points) {
+      final want = await plain.search(queryVector: p.vector, topK: 3);
+      final got = await binary.search(
+        queryVector: p.vector,
+        topK: 3,
+        params: const QdrantSearchParams(exact: true, rescore: true),
+      );
+      expect([for (final h in got) h.id], [for (final h in want) h.id]);
+    }
+
+    // The shim parses both into qdrant-edge's own types: a value they cannot
+    // hold is an error, not a silently kept default.
+    await expectLater(
+      QdrantEdgeClient.open(
+        path: '${shardDir}_bad',
+        dim: 4,
+        config: const QdrantShardConfig(hnswM: -1),
+      ),
+      throwsA(isA<QdrantException>()),
+    );
+    expect(Directory('${shardDir}_bad').existsSync(), isFalse);
+    await expectLater(
+      plain.search(
+        queryVector: points.first.vector,
+        topK: 1,
+        params: const QdrantSearchParams(hnswEf: -1),
+      ),
+      throwsA(isA<QdrantException>()),
+    );
+  });
+
+  test('searchBatch groups what searchIds answers per query', () async {
+    final client = await QdrantEdgeClient.open(path: shardDir, dim: 4);
+    addTearDown(client.close);
+    if (!hasEntryPoint(client.supportsSearchBatch, 'qe_shard_search_batch')) {
+      return;
+    }
+    await client.upsertBatch(points);
+    const en = '{"must":[{"key":"lang","match":{"value":"en"}}]}';
+    final queries = [for (final p in points) p.vector];
+    final topKs = [3, 1, 0];
+    final filters = [null, en, null];
+
+    final batch = await client.searchBatch(
+      queryVectors: queries,
+      topK: 3,
+      topKs: topKs,
+      filterJsons: filters,
+    );
+    expect(batch, hasLength(3));
+    for (var q = 0; q < queries.length; q++) {
+      final single = topKs[q] == 0
+          ? const <SearchHit>[]
+          : await client.searchIds(
+              queryVector: queries[q],
+              topK: topKs[q],
+              filterJson: filters[q],
+            );
+      expect([for (final h in batch[q]) h.id], [for (final h in single) h.id]);
+      for (var i = 0; i < single.length; i++) {
+        expect(batch[q][i].score, closeTo(single[i].score, 1e-6));
+      }
+    }
+    expect(batch[1].single.id, '1');
+
+    final shared = await client.searchBatch(
+      queryVectors: queries,
+      topK: 2,
+      filterJson: en,
+    );
+    for (final hits in shared) {
+      expect([for (final h in hits) h.id], ['1']);
+    }
+    await expectLater(
+      client.searchBatch(queryVectors: queries, topK: 1, filterJsons: [en]),
+      throwsA(isA<QdrantException>()),
+    );
+  });
+
+  test('field indexes leave filtered answers unchanged', () async {
+    final client = await QdrantEdgeClient.open(path: shardDir, dim: 4);
+    addTearDown(client.close);
+    if (!hasEntryPoint(
+      client.supportsFieldIndex,
+      'qe_shard_create_field_index',
+    )) {
+      return;
+    }
+    await client.upsertBatch(points);
+    const fr = '{"must":[{"key":"lang","match":{"value":"fr"}}]}';
+    Future<List<String>> ids() async => [
+      for (final hit in await client.search(
+        queryVector: const [1.0, 0.0, 0.0, 0.0],
+        topK: 3,
+        filterJson: fr,
+      ))
+        hit.id,
+    ];
+    final before = await ids();
+    expect(before, ['6ba7b810-9dad-11d1-80b4-00c04fd430c8']);
+
+    // built over the points already stored, kept up to date by later writes
+    await client.createFieldIndex('lang', FieldIndexType.keyword);
+    await client.createFieldIndex('lang', FieldIndexType.keyword);
+    expect(await ids(), before);
+    await client.upsertBatch([
+      (id: '7', vector: [0.9, 0.1, 0.0, 0.0], payload: {'lang': 'fr'}),
+    ]);
+    expect(await ids(), ['7', ...before]);
+  });
+
+  test('retrieve projects keys and answers null for unknown ids', () async {
+    final client = await QdrantEdgeClient.open(path: shardDir, dim: 4);
+    addTearDown(client.close);
+    if (!hasEntryPoint(client.supportsSearchIds, 'qe_shard_search_ids')) {
+      return;
+    }
+    await client.upsertBatch(points);
+    final payloads = await client.retrieve(
+      ['6ba7b810-9dad-11d1-80b4-00c04fd430c8', '99', '1', '2'],
+      keys: ['tags', 'missing'],
+    );
+    expect(payloads, [
+      {'tags': ['a', 'b']},
+      null,
+      <String, dynamic>{},
+      <String, dynamic>{},
+    ]);
+    await expectLater(
+      client.retrieve(['not-a-uuid']),
+      throwsA(isA<QdrantException>()),
+    );
+  });
+}
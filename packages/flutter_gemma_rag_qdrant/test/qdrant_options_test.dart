@@ -0,0 +1,72 @@
+import 'package:flutter_test/flutter_test.dart';
+import 'package:flutter_gemma_rag_qdrant/src/qdrant_options.dart';
+
+void main() {
+  group('QdrantShardConfig.toJson', () {
+    test('defaults carry only dim and distance', () {
+      const config = QdrantShardConfig();
+      expect(config.isDefault, isTrue);
+      expect(config.toJson(dim: 384, distance: 'cosine'), {
+        'dim': 384,
+        'distance': 'cosine',
+      });
+    });
+
+    test('maps every field to the shim key', () {
+      const config = QdrantShardConfig(
+        hnswM: 8,
+        hnswEfConstruct: 64,
+        fullScanThreshold: 5000,
+        hnswOnDisk: true,
+        quantization: QdrantScalarQuantization(quantile: 0.95, alwaysRam: true),
+        onDiskVectors: true,
+      );
+      expect(config.isDefault, isFalse);
+      expect(config.toJson(dim: 768, distance: 'dot'), {
+        'dim': 768,
+        'distance': 'dot',
+        'hnsw': {
+          'm': 8,
+          'ef_construct': 64,
+          'full_scan_threshold': 5000,
+          'on_disk': true,
+        },
+        'quantization': {
+          'scalar': {'type': 'int8', 'quantile': 0.95, 'always_ram': true},
+        },
+        'on_disk': true,
+      });
+    });
+
+    test('binary quantization', () {
+      expect(const QdrantBinaryQuantization().toJson(), {
+        'binary': <String, dynamic>{},
+      });
+      expect(const QdrantBinaryQuantization(alwaysRam: false).toJson(), {
+        'binary': {'always_ram': false},
+      });
+    });
+  });
+
+  group('QdrantSearchParams.toJson', () {
+    test('defaults are empty', () {
+      const params = QdrantSearchParams();
+      expect(params.isDefault, isTrue);
+      expect(params.toJson(), isEmpty);
+    });
+
+    test('rescore nests under quantization', () {
+      const params = QdrantSearchParams(
+        hnswEf: 128,
+        exact: false,
+        rescore: true,
+      );
+      expect(params.isDefault, isFalse);
+      expect(params.toJson(), {
+        'hnsw_ef': 128,
+        'exact': false,
+        'quantization': {'rescore': true},
+      });
+    });
+  });
+}
@@ -1,10 +1,10 @@
 // Unit tests for QdrantVectorStore. These run in the plain Dart
 // VM (`flutter test`), not in an integration_test runner, so we load the
-// release dylib by absolute path via QdrantEdgeClient.debugOverrideDylibPath.
+// cargo-built shim by absolute path via
+// QdrantEdgeClient.debugOverrideDylibPath.
 //
-// Prerequisite: `native/qdrant_edge/qdrant_edge_ffi/target/release/
-// libqdrant_edge_ffi.dylib` exists. The dylib is regenerated via
-// `native/qdrant_edge/build_local.sh macos` if missing.
+// Prerequisite: `cargo build --release` in native/qdrant_edge/qdrant_edge_ffi
+// (see shim_locator.dart for where it is looked up).
 
 import 'dart:io';
 
@@ -13,21 +13,17 @@ import 'package:flutter_gemma_rag_qdrant/flutter_gemma_rag_qdrant.dart';
 import 'package:flutter_gemma_rag_qdrant/src/qdrant_edge_client.dart';
 import 'package:flutter_test/flutter_test.dart';
 
-const _dylibRelative =
-    'native/qdrant_edge/qdrant_edge_ffi/target/release/libqdrant_edge_ffi.dylib';
+import 'shim_locator.dart';
 
 void main() {
-  final dylib = File(_dylibRelative);
-  if (!dylib.existsSync()) {
-    // Skip the whole suite when the dylib hasn't been built. CI builds it
-    // via the GitHub Actions workflow; local devs run build_local.sh.
-    test('libqdrant_edge_ffi.dylib not built — skipping suite', () {
-      // ignore: avoid_print
-      print('Skipping: build via native/qdrant_edge/build_local.sh macos');
-    });
+  final shim = shimPath;
+  if (shim == null) {
+    // Skip the whole suite when the shim hasn't been built; CI builds it
+    // first and sets QDRANT_SHIM_REQUIRED, which turns this into a failure.
+    registerShimMissing();
     return;
   }
-  QdrantEdgeClient.debugOverrideDylibPath = dylib.absolute.path;
+  QdrantEdgeClient.debugOverrideDylibPath = shim;
 
   late QdrantVectorStore repo;
   late String shardDir;
@@ -394,6 +390,124 @@ void main() {
       expect(stats.documentCount, equals(0));
     });
 
+    test('searchSimilarBatch answers each query like searchSimilar', () async {
+      repo.configure(
+        FilterSchema(
+          fields: [FilterField(name: 'lang', type: FilterFieldType.string)],
+        ),
+      );
+      for (var i = 0; i < 6; i++) {
+        await repo.addDocument(
+          id: 'doc_$i',
+          content: 'content $i',
+          embedding: [1.0, i / 10, (i % 3) / 10, 0.0],
+          metadata: '{"lang":"${i.isEven ? 'en' : 'fr'}"}',
+        );
+      }
+      final queries = [
+        const [1.0, 0.0, 0.0, 0.0],
+        const [0.5, 0.5, 0.0, 0.0],
+        const [0.0, 0.0, 1.0, 0.5],
+      ];
+      const fr = Filter(must: [FieldEquals(key: 'lang', value: 'fr')]);
+      final filters = [null, fr, null];
+
+      final batch = await repo.searchSimilarBatch(
+        queryEmbeddings: queries,
+        topK: 3,
+        threshold: 0.5,
+        filters: filters,
+      );
+      expect(batch, hasLength(queries.length));
+      for (var q = 0; q < queries.length; q++) {
+        final single = await repo.searchSimilar(
+          queryEmbedding: queries[q],
+          topK: 3,
+          threshold: 0.5,
+          filter: filters[q],
+        );
+        expect([
+          for (final r in batch[q]) r.id,
+        ], [for (final r in single) r.id]);
+        for (var i = 0; i < single.length; i++) {
+          expect(batch[q][i].content, single[i].content);
+          expect(batch[q][i].metadata, single[i].metadata);
+          expect(batch[q][i].similarity, closeTo(single[i].similarity, 1e-6));
+        }
+      }
+      expect(batch[1].map((r) => r.metadata), everyElement(contains('fr')));
+    });
+
+    test(
+      'configure on an open shard indexes the declared fields',
+      () async {
+        for (var i = 0; i < 4; i++) {
+          await repo.addDocument(
+            id: 'doc_$i',
+            content: 'content $i',
+            embedding: [1.0, i / 10, 0.0, 0.0],
+            metadata: '{"lang":"${i.isEven ? 'en' : 'fr'}","rank":$i}',
+          );
+        }
+        // declared after the shard is open: the next store call indexes them
+        repo.configure(
+          FilterSchema(
+            fields: [
+              FilterField(name: 'lang', type: FilterFieldType.string),
+              FilterField(name: 'rank', type: FilterFieldType.number),
+            ],
+          ),
+        );
+        await repo.addDocument(
+          id: 'doc_4',
+          content: 'content 4',
+          embedding: const [1.0, 0.4, 0.0, 0.0],
+          metadata: '{"lang":"fr","rank":4}',
+        );
+        final hits = await repo.searchSimilar(
+          queryEmbedding: const [1.0, 0.0, 0.0, 0.0],
+          topK: 5,
+          filter: const Filter(must: [FieldEquals(key: 'lang', value: 'fr')]),
+        );
+        // only doc_4 was written after configure, so only it is promoted
+        expect([for (final r in hits) r.id], ['doc_4']);
+      },
+    );
+
+    test('configure leaves no indexing behind a close or clear', () async {
+      const schema = FilterSchema(
+        fields: [FilterField(name: 'lang', type: FilterFieldType.string)],
+      );
+      await repo.addDocument(
+        id: 'doc_0',
+        content: 'content 0',
+        embedding: const [1.0, 0.0, 0.0, 0.0],
+        metadata: '{"lang":"en"}',
+      );
+      // configure only marks the indexes; nothing runs against the shard
+      // that clear() is about to delete
+      repo.configure(schema);
+      await repo.clear();
+      await repo.addDocument(
+        id: 'doc_1',
+        content: 'content 1',
+        embedding: const [1.0, 0.1, 0.0, 0.0],
+        metadata: '{"lang":"en"}',
+      );
+      final hits = await repo.searchSimilar(
+        queryEmbedding: const [1.0, 0.0, 0.0, 0.0],
+        topK: 5,
+        filter: const Filter(must: [FieldEquals(key: 'lang', value: 'en')]),
+      );
+      expect([for (final r in hits) r.id], ['doc_1']);
+
+      repo.configure(schema);
+      await repo.close();
+      // let anything scheduled by configure run against the closed client
+      await Future<void>.delayed(Duration.zero);
+      expect(repo.isInitialized, isFalse);
+    });
+
     test('enableHnsw is accepted but a no-op (toggle does not throw)', () {
       expect(repo.enableHnsw, isTrue);
       repo.enableHnsw = false;
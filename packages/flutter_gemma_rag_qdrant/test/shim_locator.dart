@@ -0,0 +1,63 @@
+// Locates a qdrant_edge_ffi library built from this package's own shim
+// source, for the suites that drive it directly.
+//
+// Deliberately NOT the shared host_native_library search: that one prefers the
+// hook's download cache, and the downloaded prebuilt is cut from an older shim
+// that lacks the entry points these suites exist to test. Only the cargo
+// output of native/qdrant_edge/qdrant_edge_ffi, or an explicit override, is
+// the code under test.
+//
+// Both suites used to hardcode the macOS `.dylib`, so on Linux and Windows --
+// including CI -- they skipped without ever loading anything.
+library;
+
+import 'dart:io';
+
+import 'package:flutter_gemma/core/utils/host_native_library.dart';
+import 'package:flutter_test/flutter_test.dart';
+
+/// The shim's cargo output, relative to the package directory.
+String get _cargoOutput =>
+    'native/qdrant_edge/qdrant_edge_ffi/target/release/'
+    '${hostNativeLibraryFileName('qdrant_edge_ffi')}';
+
+/// Every path tried, in order: `$QDRANT_SHIM_DYLIB`, then the cargo output.
+List<String> get shimCandidates {
+  final override = Platform.environment['QDRANT_SHIM_DYLIB'];
+  return [
+    if (override != null && override.isNotEmpty) override,
+    _cargoOutput,
+  ];
+}
+
+/// Absolute path of the first candidate that exists, or null.
+String? get shimPath => firstExistingPath(shimCandidates);
+
+/// Set by CI, which builds the shim first: a missing library is then a
+/// failure rather than a skip.
+bool get shimRequired => Platform.environment['QDRANT_SHIM_REQUIRED'] == '1';
+
+/// Registers the placeholder a suite runs instead of its tests when the shim
+/// is not built. Fails under [shimRequired].
+void registerShimMissing() {
+  final message =
+      'qdrant_edge_ffi not built. Looked in: ${shimCandidates.join(", ")} '
+      '(cwd: ${Directory.current.path}). Build with `cargo build --release` '
+      'in native/qdrant_edge/qdrant_edge_ffi, or set \$QDRANT_SHIM_DYLIB.';
+  test('qdrant_edge_ffi not built', () {
+    if (shimRequired) fail(message);
+    // ignore: avoid_print
+    print('Skipping: $message');
+  });
+}
+
+/// Whether the loaded shim exports [symbol], as reported by the client's
+/// `supports*` flag [supported]. When it does not, the calling test is marked
+/// skipped -- or failed under [shimRequired], where a stale build would
+/// otherwise pass as green.
+bool hasEntryPoint(bool supported, String symbol) {
+  if (supported) return true;
+  if (shimRequired) fail('the shim predates $symbol; rebuild it');
+  markTestSkipped('library predates $symbol');
+  return false;
+}
@@ -0,0 +1,218 @@
+// Benchmark: QdrantEdgeClient.upsertBatch through the shim's packed ABI
+// (`qe_shard_upsert_batch_packed`) vs its JSON entry point
+// (`qe_shard_upsert_batch`).
+//
+// Pure-Dart host-VM harness. ONE deterministic corpus (fixed seed, fixed dim)
+// is ingested into a fresh shard per arm and repeat, in batches of --batch
+// points with a small payload each, and the wall time of the whole ingest is
+// recorded. Both arms must end with every point stored and must answer the
+// same queries with the same ids; a mismatch exits 1. The JSON arm's column
+// also reports how many bytes of JSON the batches came to, which is what the
+// packed arm never builds or parses. Prints a parseable markdown table, like
+// flutter_gemma_rag_sqlite's tool/bench_vector_stores.dart.
+//
+// Prereqs: $QDRANT_DYLIB → a qdrant_edge_ffi library built from
+// native/qdrant_edge/qdrant_edge_ffi (`cargo build --release`). A library
+// without the packed entry point is reported and the run stops (exit 70).
+//
+// Run from the package dir:
+//   QDRANT_DYLIB=/path/to/libqdrant_edge_ffi.so \
+//   dart run tool/bench_upsert_batch.dart
+//
+// Flags:
+//   --points=10000       points ingested per arm. Default 10k.
+//   --dim=768            embedding dimension. Default 768.
+//   --batch=1000         points per upsertBatch call. Default 1000.
+//   --repeats=3          ingests per arm; median reported. Default 3.
+//   --queries=20         parity-check queries. Default 20.
+//   --seed=1234567       PRNG seed for the deterministic corpus.
+
+import 'dart:convert';
+import 'dart:ffi';
+import 'dart:io';
+import 'dart:math';
+
+import 'package:flutter_gemma_rag_qdrant/src/qdrant_edge_client.dart';
+
+typedef _Point = ({
+  String id,
+  List<double> vector,
+  Map<String, dynamic>? payload,
+});
+
+class UpsertBenchConfig {
+  UpsertBenchConfig({
+    required this.points,
+    required this.dim,
+    required this.batch,
+    required this.repeats,
+    required this.queries,
+    required this.seed,
+  });
+
+  final int points;
+  final int dim;
+  final int batch;
+  final int repeats;
+  final int queries;
+  final int seed;
+
+  static UpsertBenchConfig parse(List<String> args) {
+    var points = 10000;
+    var dim = 768;
+    var batch = 1000;
+    var repeats = 3;
+    var queries = 20;
+    var seed = 1234567;
+
+    for (final arg in args) {
+      if (arg.startsWith('--points=')) {
+        points = int.parse(arg.substring('--points='.length));
+      } else if (arg.startsWith('--dim=')) {
+        dim = int.parse(arg.substring('--dim='.length));
+      } else if (arg.startsWith('--batch=')) {
+        batch = int.parse(arg.substring('--batch='.length));
+      } else if (arg.startsWith('--repeats=')) {
+        repeats = int.parse(arg.substring('--repeats='.length));
+      } else if (arg.startsWith('--queries=')) {
+        queries = int.parse(arg.substring('--queries='.length));
+      } else if (arg.startsWith('--seed=')) {
+        seed = int.parse(arg.substring('--seed='.length));
+      } else {
+        throw FormatException('Unknown flag: $arg');
+      }
+    }
+
+    return UpsertBenchConfig(
+      points: points,
+      dim: dim,
+      batch: batch,
+      repeats: repeats,
+      queries: queries,
+      seed: seed,
+    );
+  }
+}
+
+Future<void> main(List<String> args) async {
+  final UpsertBenchConfig cfg;
+  try {
+    cfg = UpsertBenchConfig.parse(args);
+  } on FormatException catch (e) {
+    stderr.writeln(e.message);
+    exit(64); // EX_USAGE
+  }
+
+  final dylib = Platform.environment['QDRANT_DYLIB'];
+  if (dylib == null || dylib.isEmpty || !File(dylib).existsSync()) {
+    stderr.writeln(
+      '[bench] \$QDRANT_DYLIB not set or file missing '
+      '(${dylib ?? '<unset>'}). Build native/qdrant_edge/qdrant_edge_ffi and '
+      'point \$QDRANT_DYLIB at it.',
+    );
+    exit(70); // EX_SOFTWARE
+  }
+  if (!DynamicLibrary.open(dylib).providesSymbol(
+    'qe_shard_upsert_batch_packed',
+  )) {
+    stderr.writeln(
+      '[bench] $dylib predates qe_shard_upsert_batch_packed; rebuild it.',
+    );
+    exit(70);
+  }
+  QdrantEdgeClient.debugOverrideDylibPath = dylib;
+
+  final rng = Random(cfg.seed);
+  List<double> vector() => [
+    for (var d = 0; d < cfg.dim; d++) rng.nextDouble() * 2 - 1,
+  ];
+  final points = <_Point>[
+    for (var i = 0; i < cfg.points; i++)
+      (
+        id: '${i + 1}',
+        vector: vector(),
+        payload: {'lang': i.isEven ? 'en' : 'fr', 'year': 1990 + i % 40},
+      ),
+  ];
+  final batches = [
+    for (var i = 0; i < points.length; i += cfg.batch)
+      points.sublist(i, min(i + cfg.batch, points.length)),
+  ];
+  final queries = [for (var q = 0; q < cfg.queries; q++) vector()];
+  // what QdrantEdgeClient's JSON path encodes, batch by batch
+  var jsonBytes = 0;
+  for (final batch in batches) {
+    final json = jsonEncode([
+      for (final p in batch)
+        {'id': p.id, 'vector': p.vector, 'payload': p.payload},
+    ]);
+    jsonBytes += utf8.encode(json).length;
+  }
+
+  final medians = <String, double>{};
+  final answers = <String, List<List<String>>>{};
+  var failed = false;
+  for (final arm in ['json', 'packed']) {
+    QdrantEdgeClient.debugUseJsonUpsert = arm == 'json';
+    final times = <double>[];
+    for (var r = 0; r < cfg.repeats; r++) {
+      final dir = Directory.systemTemp.createTempSync('qdrant_upsert_bench_');
+      final client = await QdrantEdgeClient.open(path: dir.path, dim: cfg.dim);
+      try {
+        final sw = Stopwatch()..start();
+        for (final batch in batches) {
+          await client.upsertBatch(batch);
+        }
+        sw.stop();
+        times.add(sw.elapsedMicroseconds / 1000);
+        final n = await client.count();
+        if (n != cfg.points) {
+          stderr.writeln('[bench] MISMATCH $arm stored $n of ${cfg.points}');
+          failed = true;
+        }
+        if (r == 0) {
+          final ids = <List<String>>[];
+          for (final q in queries) {
+            final hits = await client.search(queryVector: q, topK: 10);
+            ids.add([for (final hit in hits) hit.id]);
+          }
+          answers[arm] = ids;
+        }
+      } finally {
+        await client.close();
+        dir.deleteSync(recursive: true);
+      }
+    }
+    times.sort();
+    medians[arm] = times[times.length ~/ 2];
+  }
+  QdrantEdgeClient.debugUseJsonUpsert = false;
+  if (jsonEncode(answers['json']) != jsonEncode(answers['packed'])) {
+    stderr.writeln('[bench] MISMATCH search results differ between arms');
+    failed = true;
+  }
+
+  stdout.writeln('# qdrant-edge upsertBatch — packed vs JSON');
+  stdout.writeln();
+  stdout.writeln('- Date (UTC): ${DateTime.now().toUtc().toIso8601String()}');
+  stdout.writeln(
+    '- Platform: ${Platform.operatingSystem} '
+    '${Platform.operatingSystemVersion}',
+  );
+  stdout.writeln(
+    '- Points: ${cfg.points} | dimension: ${cfg.dim} | batch: ${cfg.batch} | '
+    'seed: ${cfg.seed} | repeats: ${cfg.repeats}',
+  );
+  stdout.writeln();
+  stdout.writeln('| path | ingest ms | points/s | JSON MB |');
+  stdout.writeln('|:-----|----------:|---------:|--------:|');
+  for (final arm in ['json', 'packed']) {
+    final ms = medians[arm]!;
+    stdout.writeln(
+      '| $arm | ${ms.toStringAsFixed(0)} '
+      '| ${(cfg.points / ms * 1000).toStringAsFixed(0)} '
+      '| ${arm == 'json' ? (jsonBytes / 1e6).toStringAsFixed(1) : '0'} |',
+    );
+  }
+  if (failed) exit(1);
+}
@@ -320,7 +320,7 @@ class FilterToVec0 {
         // pushes neither `NOT BETWEEN` nor the `< a OR > b` rewrite, because
         // OR across bounds is not a single comparison. It therefore keeps the
         // old post-filter behaviour — for this shape alone, instead of for
-        // every mustNot. Fixing it needs over-fetching at the store level.
+        // every mustNot; the stores' allowlist pass keeps it exact.
         if (gte != null && lte != null) {
           binds.add(gte);
           binds.add(lte);
@@ -637,36 +637,6 @@ class FilterToVec0 {
     }
   }
 
-  /// How far over-fetching may grow, as a multiple of the requested topK.
-  /// Bounded on purpose: without a cap an unpushable filter turns every search
-  /// into an O(n) scan, and the cost is invisible until the collection is big.
-  static const int maxOverFetchFactor = 16;
-
-  /// Whether to ask vec0 for more candidates, given how many rows the LAST
-  /// query returned.
-  ///
-  /// [rowsReturned] must be the count SQLite handed back — already filtered,
-  /// but BEFORE any similarity-threshold rejection. Those two are not the same
-  /// limit and must not share a counter: rows arrive ordered by distance, so
-  /// once one falls below the threshold every later one does too, and
-  /// over-fetching for a threshold shortfall can never help. An earlier version
-  /// counted post-threshold rows and so scanned to 16x on a fully-pushed filter
-  /// that simply matched nothing, then blamed the filter in its log.
-  ///
-  /// Shared by the native and web stores. They are one dialect with two call
-  /// sites, and the web arm shipped without this loop at all — the same filter
-  /// answered `[d4]` on native and `[]` on web.
-  static bool shouldOverFetch({
-    required int rowsReturned,
-    required int topK,
-    required int fetch,
-    required int totalRows,
-  }) {
-    if (rowsReturned >= topK) return false; // enough survived the filter
-    if (fetch >= totalRows) return false; // asked for the whole table already
-    return fetch < topK * maxOverFetchFactor;
-  }
-
   /// Sentinels written for a declared field a document does not carry.
   ///
   /// vec0 type-checks every declared metadata column and exempts nothing —
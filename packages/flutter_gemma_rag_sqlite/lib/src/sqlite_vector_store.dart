@@ -3,8 +3,8 @@ import 'dart:io';
 
 import 'dart:typed_data';
 
-import 'package:flutter_gemma/core/utils/gemma_log.dart';
 import 'package:flutter/foundation.dart' show visibleForTesting;
+import 'package:flutter_gemma/core/utils/gemma_log.dart';
 import 'package:flutter_gemma/flutter_gemma.dart';
 import 'package:sqlite3/sqlite3.dart';
 
@@ -19,28 +19,126 @@ import 'package:flutter_gemma_rag_sqlite/src/filter_to_vec0.dart';
 /// `+content`/`+metadata` columns and one typed column per declared
 /// [FilterField], so `searchSimilar` returns the document and its metadata in a
 /// single query and pushes [Filter] predicates down to the engine.
+///
+/// Pass a [collection] to keep several corpora in one database file: each
+/// collection store sees only its own documents, and its searches visit only
+/// its own chunks of the shared table (see [collection]).
 class SqliteVectorStore implements VectorStoreRepository {
+  /// Throws [ArgumentError] for an empty [collection] or one containing
+  /// U+001F, which separates the collection from the id in the stored key.
+  SqliteVectorStore({String? collection})
+    : _collection = collection,
+      _tableName = collection == null ? 'vec_documents' : 'vec_collections' {
+    if (collection != null &&
+        (collection.isEmpty || collection.contains(_keySeparator))) {
+      throw ArgumentError.value(
+        collection,
+        'collection',
+        'must be non-empty and must not contain U+001F',
+      );
+    }
+  }
+
   Database? _db;
   int? _detectedDimension;
   bool _isInitialized = false;
 
+  /// Prepared statements keyed by their SQL, so a search re-run with the same
+  /// filter shape (and every add/remove) binds new values into a statement
+  /// SQLite already compiled instead of re-parsing and re-planning it. Filter
+  /// VALUES are always binds, so the key space is the set of filter shapes the
+  /// app uses; [_maxCachedStatements] bounds it anyway, evicting the oldest.
+  final Map<String, PreparedStatement> _statements = {};
+  static const int _maxCachedStatements = 32;
+
+  /// Documents this store sees, counted once on first use and then kept up to
+  /// date by [addDocument]/[removeDocument]/[clear] from the rows each write
+  /// actually changed. Assumes this store is the only writer of its table (or
+  /// collection) while open; null until first counted.
+  int? _documentCount;
+
+  /// The query embedding's float32 BLOB, reused across searches of the same
+  /// dimension instead of allocated per call.
+  ByteData? _queryBlob;
+
+  /// Rows vec0 handed to the current KNN pass before SQLite applied whatever
+  /// filter it could not take, counted by the `_knn_candidate()` SQL function
+  /// registered in [initialize].
+  int _knnCandidates = 0;
+
+  /// How many searches paid for the allowlist pass in [searchSimilar].
+  @visibleForTesting
+  int debugAllowlistPasses = 0;
+
+  /// Namespace this store reads and writes, or null for the whole
+  /// `vec_documents` table.
+  ///
+  /// Collection stores share one `vec_collections` table whose `collection`
+  /// column is a vec0 partition key, so KNN binds it and only walks that
+  /// collection's chunks instead of filtering a global top-k afterwards. The
+  /// table's dimension and filter columns are fixed by whichever collection
+  /// creates it, so every collection in a database must agree on both.
+  /// Document ids only need to be unique within their collection.
+  String? get collection => _collection;
+  final String? _collection;
+
   /// vec0 virtual table holding `id TEXT PRIMARY KEY`, `embedding float[D]`,
   /// the auxiliary `+content`/`+metadata` columns, and one typed column per
-  /// declared filter field.
-  static const String _tableName = 'vec_documents';
+  /// declared filter field; `vec_collections` adds the `collection` partition
+  /// key in front.
+  final String _tableName;
+
+  /// Joins [collection] and the caller's id into the table's primary key,
+  /// which must be unique across every collection sharing the table.
+  static const String _keySeparator = '\u001f';
+
+  String _key(String id) =>
+      _collection == null ? id : '$_collection$_keySeparator$id';
+
+  String _idFromKey(String key) =>
+      _collection == null ? key : key.substring(_collection.length + 1);
+
+  /// ` AND collection = ?` plus its bind for collection stores; empty for the
+  /// default store.
+  String get _scopeSql => _collection == null ? '' : ' AND collection = ?';
+  List<Object?> get _scopeBinds => _collection == null ? [] : [_collection];
 
   /// Declared filterable-metadata schema (via [configure]). Empty by default,
   /// so callers that never declare a schema get a table with no filter columns
   /// and the historical "filters are a safe no-op" behaviour.
   FilterSchema _filterSchema = const FilterSchema();
 
+  /// Whether the next `vec0` table is created with `index=hnsw(...)` on the
+  /// embedding column (approximate KNN) instead of the default exact scan.
+  ///
+  /// Only read by [_createTable], so flipping it on an existing store takes
+  /// effect after [clear]. Filtered searches stay exact either way: vec0
+  /// falls back to a full scan whenever the query carries metadata
+  /// constraints.
+  ///
+  /// A hint, not a guarantee: the table keeps the exact scan when the loaded
+  /// sqlite-vec has no `index=hnsw` (see [_hnswAvailable]) and for collection
+  /// stores, whose partitioned KNN never walks a graph (vec0 refuses the
+  /// combination).
+  ///
+  /// Off by default, and meant for small corpora only. Every insert extends
+  /// the graph: 10000 x 384 rows take ~5.5 s in one transaction against
+  /// ~70 ms for the exact table, and longer as single-row autocommit writes,
+  /// for unfiltered queries only ~2x faster at recall 0.999.
+  bool _enableHnsw = false;
+
+  /// Whether the loaded sqlite-vec accepts `index=hnsw`, probed once per
+  /// process by [_useHnsw]. The prebuilts bundled so far are upstream
+  /// sqlite-vec, which rejects the option with "could not parse vector
+  /// column", so declaring it unconditionally would fail the first
+  /// [addDocument] on every platform.
+  static bool? _hnswAvailable;
+
   @override
-  @Deprecated('No-op since vector search moved into SQLite; removed in 2.0')
-  bool get enableHnsw => false;
+  bool get enableHnsw => _enableHnsw;
 
   @override
-  @Deprecated('No-op since vector search moved into SQLite; removed in 2.0')
-  set enableHnsw(bool value) {}
+  set enableHnsw(bool value) => _enableHnsw = value;
 
   @override
   bool get isInitialized => _isInitialized;
@@ -61,6 +159,13 @@ class SqliteVectorStore implements VectorStoreRepository {
     FilterField.validateSchema(schema);
     for (final field in schema.fields) {
       FilterToVec0.validateFieldName(field.name);
+      if (_collection != null && field.name == 'collection') {
+        throw ArgumentError.value(
+          field.name,
+          'FilterField.name',
+          'reserved: collection stores declare it as the vec0 partition key',
+        );
+      }
     }
     _filterSchema = schema;
   }
@@ -141,8 +246,20 @@ class SqliteVectorStore implements VectorStoreRepository {
       if (!parent.existsSync()) {
         parent.createSync(recursive: true);
       }
+      _closeStatements();
       _db?.close();
-      _db = sqlite3.open(databasePath);
+      _db = sqlite3.open(databasePath)
+        ..createFunction(
+          functionName: '_knn_candidate',
+          argumentCount: const AllowedArgumentCount(0),
+          // Non-deterministic, or SQLite may evaluate it once per statement.
+          deterministic: false,
+          function: (_) {
+            _knnCandidates++;
+            return 1;
+          },
+        );
+      _documentCount = null;
       _isInitialized = true;
       _detectDimensionFromExistingTable();
     } catch (e) {
@@ -151,8 +268,9 @@ class SqliteVectorStore implements VectorStoreRepository {
   }
 
   /// When re-opening a database that already holds a populated `vec_documents`
-  /// table, learn the dimension from a stored embedding so subsequent adds and
-  /// queries validate against it (no lazy re-create on the existing table).
+  /// (or, for a collection store, `vec_collections`) table, learn the
+  /// dimension from a stored embedding so subsequent adds and queries validate
+  /// against it (no lazy re-create on the existing table).
   void _detectDimensionFromExistingTable() {
     final exists = _db!.select(
       "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?",
@@ -171,11 +289,13 @@ class SqliteVectorStore implements VectorStoreRepository {
   /// `+content`/`+metadata` columns returned at SELECT but not filterable.
   void _createTable(int dimension) {
     final columns = <String>[
+      if (_collection != null) 'collection TEXT partition key',
       'id TEXT PRIMARY KEY',
       // distance_metric=cosine so KNN `distance` is cosine distance in [0,2]
       // (0 = identical) → similarity = 1 - distance, matching the contract.
       // Without it vec0 defaults to L2, breaking the 1 - distance convention.
-      'embedding float[$dimension] distance_metric=cosine',
+      'embedding float[$dimension] distance_metric=cosine'
+          '${_useHnsw() ? ' index=hnsw(m=16, ef_construction=200)' : ''}',
     ];
     for (final field in _filterSchema.fields) {
       // Deliberately bare, never quoted: sqlite-vec parses this DDL with its
@@ -196,6 +316,41 @@ class SqliteVectorStore implements VectorStoreRepository {
     );
   }
 
+  /// Whether [_createTable] should declare `index=hnsw`: [enableHnsw] is set,
+  /// this is not a collection store, and the loaded sqlite-vec supports it.
+  bool _useHnsw() {
+    if (!_enableHnsw) return false;
+    if (_collection != null) {
+      gemmaLog(
+        '[SqliteVectorStore] enableHnsw ignored for collection stores: '
+        'partitioned KNN always scans the collection exactly',
+      );
+      return false;
+    }
+    final available = _hnswAvailable ??= _probeHnsw(_db!);
+    if (!available) {
+      gemmaLog(
+        '[SqliteVectorStore] enableHnsw ignored: the loaded sqlite-vec has no '
+        'index=hnsw, using the exact scan',
+      );
+    }
+    return available;
+  }
+
+  /// Creates and drops a throwaway `index=hnsw` table in the temp schema.
+  static bool _probeHnsw(Database db) {
+    try {
+      db.execute(
+        'CREATE VIRTUAL TABLE temp._vec0_hnsw_probe '
+        'USING vec0(embedding float[1] index=hnsw)',
+      );
+    } on SqliteException {
+      return false;
+    }
+    db.execute('DROP TABLE temp._vec0_hnsw_probe');
+    return true;
+  }
+
   /// vec0 declared-column SQL type for a [FilterFieldType]. Booleans map to
   /// INTEGER because [FilterToVec0] binds bool predicates as `0`/`1`.
   static String _vec0ColumnType(FilterFieldType type) => switch (type) {
@@ -236,9 +391,15 @@ class SqliteVectorStore implements VectorStoreRepository {
       _filterSchema,
     );
 
+    final key = _key(id);
     final columnNames = <String>['id', 'embedding'];
     final placeholders = <String>['?', '?'];
-    final binds = <Object?>[id, blob];
+    final binds = <Object?>[key, blob];
+    if (_collection != null) {
+      columnNames.add('collection');
+      placeholders.add('?');
+      binds.add(_collection);
+    }
     for (final field in _filterSchema.fields) {
       // Quoted here (SQLite parses this statement) but NOT in the vec0 DDL
       // above — see FilterToVec0.quoteColumn.
@@ -256,12 +417,13 @@ class SqliteVectorStore implements VectorStoreRepository {
     // vec0 does NOT honor `INSERT OR REPLACE`/UPSERT conflict resolution on its
     // declared primary key — a duplicate id raises a UNIQUE violation instead
     // of replacing. Emulate upsert with delete-then-insert.
-    _db!.execute('DELETE FROM $_tableName WHERE id = ?', [id]);
-    _db!.execute(
+    _statement('DELETE FROM $_tableName WHERE id = ?').execute([key]);
+    final replaced = _db!.updatedRows;
+    _statement(
       'INSERT INTO $_tableName (${columnNames.join(', ')}) '
       'VALUES (${placeholders.join(', ')})',
-      binds,
-    );
+    ).execute(binds);
+    if (_documentCount != null) _documentCount = _documentCount! + 1 - replaced;
   }
 
   @override
@@ -270,7 +432,10 @@ class SqliteVectorStore implements VectorStoreRepository {
       throw StateError('VectorStore not initialized. Call initialize() first.');
     }
     if (_detectedDimension == null) return; // table not created yet → no-op
-    _db!.execute('DELETE FROM $_tableName WHERE id = ?', [id]);
+    _statement('DELETE FROM $_tableName WHERE id = ?').execute([_key(id)]);
+    if (_documentCount != null) {
+      _documentCount = _documentCount! - _db!.updatedRows;
+    }
   }
 
   @override
@@ -297,14 +462,19 @@ class SqliteVectorStore implements VectorStoreRepository {
 
     final translated = FilterToVec0.translate(filter, _filterSchema);
     // An unsatisfiable filter has one answer and it costs nothing to give:
-    // an empty result. Without this the over-fetch loop below would grow the
-    // candidate set to the 16x cap looking for rows that cannot exist, and
-    // then log that the result "may be truncated" — a warning about a
-    // shortfall that is the correct and complete answer.
+    // an empty result. Without this the allowlist retry below would scan the
+    // whole table for rows that cannot exist.
     if (translated.matchesNothing) return const [];
     final whereExtra = translated.whereSql.isEmpty
         ? ''
         : ' AND ${translated.whereSql}';
+    final blob = _queryEmbeddingToBlob(queryEmbedding);
+
+    ResultSet knn(String whereSql, List<Object?> binds) => _statement(
+      'SELECT id, content, metadata, distance FROM $_tableName '
+      'WHERE embedding MATCH ? AND k = ?$_scopeSql$whereSql '
+      'ORDER BY distance',
+    ).select([blob, topK, ..._scopeBinds, ...binds]);
 
     // vec0's KNN takes a conjunction of single-column comparisons and nothing
     // else. A filter it cannot accept — a cross-column OR, a CASE over a FLOAT
@@ -315,74 +485,49 @@ class SqliteVectorStore implements VectorStoreRepository {
     // nearest matching neither, returned zero rows while three documents
     // satisfied the filter.
     //
-    // So ask vec0 for more and keep doubling until k survive — bounded,
-    // because unbounded growth degenerates to a full scan. Past the cap we
-    // return what we have and say the result is short.
-    var fetch = topK;
-    int? totalRows;
-    final results = <RetrievalResult>[];
-    var rowsReturned = 0;
-
-    while (true) {
-      final rows = _db!.select(
-        'SELECT id, content, metadata, distance FROM $_tableName '
-        'WHERE embedding MATCH ? AND k = ?$whereExtra '
-        'ORDER BY distance',
-        [_embeddingToBlob(queryEmbedding), fetch, ...translated.binds],
+    // So a short answer to a filtered search is asked again, once, with the
+    // filter also handed to vec0 as an allowlist: `id IN (SELECT id …)` is
+    // materialized before the scan, and vec0 picks its k from the matching
+    // rows alone, so the post-filter has nothing left to discard and the
+    // result is exact. That costs one pass over the table, which is why the
+    // plain query goes first: a filter vec0 takes whole already returns k
+    // rows, and only a filter that really matches fewer than k pays twice.
+    // This replaces doubling k up to 16x, which rescanned every chunk on each
+    // retry and still came back short past the cap.
+    //
+    // A short answer alone does not mean truncation: a filter that matches
+    // three rows returns three either way. `_knn_candidate()` comes first
+    // among the terms vec0 leaves to SQLite, so it counts the rows vec0
+    // chose before any post-filter saw them. Fewer than k candidates means
+    // vec0 ran out of rows, not that it stopped at k, and the answer is
+    // already complete.
+    _knnCandidates = 0;
+    var rows = knn(' AND _knn_candidate()$whereExtra', translated.binds);
+    if (_knnCandidates >= topK && rows.length < topK) {
+      debugAllowlistPasses++;
+      rows = knn(
+        '$whereExtra AND id IN '
+        '(SELECT id FROM $_tableName WHERE 1$_scopeSql$whereExtra)',
+        [...translated.binds, ..._scopeBinds, ...translated.binds],
       );
-      rowsReturned = rows.length;
-
-      results.clear();
-      for (final row in rows) {
-        // vec0 returns cosine DISTANCE; similarity = 1 - distance.
-        final similarity = 1.0 - (row['distance'] as num).toDouble();
-        // Rows arrive ordered by distance, so this can only trim the tail —
-        // it is NOT a reason to fetch more (see FilterToVec0.shouldOverFetch).
-        if (similarity < threshold) break;
-        results.add(
-          RetrievalResult(
-            id: row['id'] as String,
-            content: row['content'] as String? ?? '',
-            similarity: similarity,
-            metadata: row['metadata'] as String?,
-          ),
-        );
-      }
-
-      if (translated.whereSql.isEmpty) break;
-      totalRows ??=
-          _db!.select('SELECT COUNT(*) AS c FROM $_tableName').first['c']
-              as int;
-      if (!FilterToVec0.shouldOverFetch(
-        rowsReturned: rowsReturned,
-        topK: topK,
-        fetch: fetch,
-        totalRows: totalRows,
-      )) {
-        break;
-      }
-      fetch *= 2;
     }
 
-    // Only a filter shortfall is worth reporting: a short result because the
-    // threshold trimmed the tail, or because the table simply holds fewer
-    // matches, is not something the caller can fix by narrowing the filter.
-    final hitTheCap =
-        totalRows != null &&
-        fetch < totalRows &&
-        fetch >= topK * FilterToVec0.maxOverFetchFactor;
-    if (rowsReturned < topK && hitTheCap) {
-      gemmaLog(
-        '[SqliteVectorStore] searchSimilar found $rowsReturned of the '
-        'requested $topK after over-fetching '
-        '${topK * FilterToVec0.maxOverFetchFactor} candidates. This filter '
-        'cannot be pushed into the KNN scan (a cross-column OR, a set over a '
-        'number column, or a negated two-sided range), so matches beyond that '
-        'window are unreachable. Narrow the filter or lower topK.',
+    final results = <RetrievalResult>[];
+    for (final row in rows) {
+      // vec0 returns cosine DISTANCE; similarity = 1 - distance.
+      final similarity = 1.0 - (row['distance'] as num).toDouble();
+      // Rows arrive ordered by distance, so this can only trim the tail.
+      if (similarity < threshold) break;
+      results.add(
+        RetrievalResult(
+          id: _idFromKey(row['id'] as String),
+          content: row['content'] as String? ?? '',
+          similarity: similarity,
+          metadata: row['metadata'] as String?,
+        ),
       );
     }
-
-    return results.length > topK ? results.sublist(0, topK) : results;
+    return results;
   }
 
   @override
@@ -390,38 +535,86 @@ class SqliteVectorStore implements VectorStoreRepository {
     if (!_isInitialized) {
       throw StateError('VectorStore not initialized. Call initialize() first.');
     }
-    final count = _detectedDimension == null
-        ? 0
-        : (_db!
-                  .select('SELECT COUNT(*) as count FROM $_tableName')
-                  .first['count']
-              as int);
+    final count = _detectedDimension == null ? 0 : _count();
     return VectorStoreStats(
       documentCount: count,
       vectorDimension: _detectedDimension ?? 0,
     );
   }
 
+  /// Number of documents this store sees: the whole table, or one collection.
+  /// Counted by SQLite once, then maintained by the writes (see
+  /// [_documentCount]).
+  int _count() => _documentCount ??=
+      _db!
+              .select(
+                'SELECT COUNT(*) AS c FROM $_tableName WHERE 1$_scopeSql',
+                _scopeBinds,
+              )
+              .first['c']
+          as int;
+
+  /// The cached statement for [sql], prepared on first use.
+  PreparedStatement _statement(String sql) {
+    final cached = _statements.remove(sql);
+    if (cached != null) {
+      // Re-inserted so the map's insertion order is least recently used first.
+      _statements[sql] = cached;
+      return cached;
+    }
+    if (_statements.length >= _maxCachedStatements) {
+      final oldest = _statements.keys.first;
+      _statements.remove(oldest)!.close();
+    }
+    return _statements[sql] = _db!.prepare(sql, persistent: true);
+  }
+
+  void _closeStatements() {
+    for (final statement in _statements.values) {
+      statement.close();
+    }
+    _statements.clear();
+  }
+
   @override
   Future<void> clear() async {
     if (!_isInitialized) {
       throw StateError('VectorStore not initialized. Call initialize() first.');
     }
+    if (_collection != null) {
+      // The table and its dimension belong to every collection in the
+      // database; only this collection's rows go.
+      if (_detectedDimension != null) {
+        _db!.execute(
+          'DELETE FROM $_tableName WHERE collection = ?',
+          _scopeBinds,
+        );
+      }
+      _documentCount = 0;
+      return;
+    }
+    // Cached statements name the table's columns; the recreated table may
+    // declare different ones.
+    _closeStatements();
     if (_detectedDimension != null) {
       // vec0 bakes the dimension into the DDL; drop the table so the next add
       // re-detects the dimension and recreates it (resets the schema cleanly).
       _db!.execute('DROP TABLE IF EXISTS $_tableName');
     }
     _detectedDimension = null;
+    _documentCount = 0;
   }
 
   @override
   Future<void> close() async {
     if (!_isInitialized) return;
+    _closeStatements();
     _db?.close();
     _db = null;
     _isInitialized = false;
     _detectedDimension = null;
+    _documentCount = null;
+    _queryBlob = null;
   }
 
   // === BLOB Encoding (float32 little-endian, same as Kotlin/Swift) ===
@@ -433,4 +626,17 @@ class SqliteVectorStore implements VectorStoreRepository {
     }
     return buffer.buffer.asUint8List();
   }
+
+  /// [_embeddingToBlob] into the reused [_queryBlob]. Safe to share across
+  /// searches: binding copies the bytes into SQLite.
+  Uint8List _queryEmbeddingToBlob(List<double> embedding) {
+    var buffer = _queryBlob;
+    if (buffer == null || buffer.lengthInBytes != embedding.length * 4) {
+      buffer = _queryBlob = ByteData(embedding.length * 4);
+    }
+    for (int i = 0; i < embedding.length; i++) {
+      buffer.setFloat32(i * 4, embedding[i].toDouble(), Endian.little);
+    }
+    return buffer.buffer.asUint8List();
+  }
 }
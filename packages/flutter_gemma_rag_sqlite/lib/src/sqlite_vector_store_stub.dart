@@ -3,6 +3,10 @@ import 'package:flutter_gemma/flutter_gemma.dart';
 /// Stub for SqliteVectorStore on web/WASM platforms.
 /// Web uses WebSqliteVectorStore (package:sqlite3/wasm + vec0) instead.
 class SqliteVectorStore implements VectorStoreRepository {
+  SqliteVectorStore({this.collection});
+
+  final String? collection;
+
   /// Present only so the stub keeps the same surface as the native class.
   ///
   /// A member added to the native arm and not here is an error `flutter test`
@@ -47,6 +47,11 @@ class WebSqliteVectorStore implements VectorStoreRepository {
   /// (filters are an ignored no-op).
   FilterSchema _filterSchema = const FilterSchema();
 
+  /// Rows vec0 handed to the current KNN pass before SQLite applied whatever
+  /// filter it could not take, counted by the `_knn_candidate()` SQL function
+  /// registered in [initialize]. Same as the native store.
+  int _knnCandidates = 0;
+
   /// No-op since vector search moved into SQLite (`vec0` does exact KNN in C).
   @override
   @Deprecated('No-op since vector search moved into SQLite; removed in 2.0')
@@ -85,7 +90,17 @@ class WebSqliteVectorStore implements VectorStoreRepository {
       _sqlite3 = await WasmSqlite3.loadFromUrl(Uri.parse(_wasmUrl));
       await _registerPersistentVfs(_sqlite3!, databasePath);
 
-      _db = _sqlite3!.open(_dbFile);
+      _db = _sqlite3!.open(_dbFile)
+        ..createFunction(
+          functionName: '_knn_candidate',
+          argumentCount: const AllowedArgumentCount(0),
+          // Non-deterministic, or SQLite may evaluate it once per statement.
+          deterministic: false,
+          function: (_) {
+            _knnCandidates++;
+            return 1;
+          },
+        );
 
       // Recover the dimension from an existing vec0 table (page reload).
       _detectExistingTable();
@@ -298,66 +313,50 @@ class WebSqliteVectorStore implements VectorStoreRepository {
     try {
       final translated = FilterToVec0.translate(filter, _filterSchema);
       // An unsatisfiable filter has one answer and it costs nothing to give:
-      // an empty result. Without this the over-fetch loop below would grow the
-      // candidate set to the 16x cap looking for rows that cannot exist, and
-      // then log that the result "may be truncated" — a warning about a
-      // shortfall that is the correct and complete answer.
+      // an empty result. Without this the allowlist pass below would scan the
+      // whole table for rows that cannot exist.
       if (translated.matchesNothing) return const [];
       final whereExtra = translated.whereSql.isEmpty
           ? ''
           : ' AND ${translated.whereSql}';
+      final blob = _embeddingToBlob(queryEmbedding);
 
-      // Over-fetch exactly as the native arm does. Both arms share
-      // FilterToVec0, so the SQL and binds are byte-identical — and this loop
-      // was missing here, which meant the same filter answered `[d4]` on
-      // native and `[]` on web. See the native store for why an unpushable
-      // filter needs it at all.
-      var fetch = topK;
-      int? totalRows;
-      final results = <RetrievalResult>[];
-      var rowsReturned = 0;
-
-      while (true) {
-        final rows = _db!.select(
-          'SELECT id, content, metadata, distance FROM $_tableName '
-          'WHERE embedding MATCH ? AND k = ?$whereExtra '
-          'ORDER BY distance',
-          [_embeddingToBlob(queryEmbedding), fetch, ...translated.binds],
+      ResultSet knn(String whereSql, List<Object?> binds) => _db!.select(
+        'SELECT id, content, metadata, distance FROM $_tableName '
+        'WHERE embedding MATCH ? AND k = ?$whereSql '
+        'ORDER BY distance',
+        [blob, topK, ...binds],
+      );
+
+      // The native store's two passes, in the same SQL: both arms share
+      // FilterToVec0, and a filter vec0 cannot take must answer the same on
+      // each. See the native store for why the second pass is exact and when
+      // it is needed.
+      _knnCandidates = 0;
+      var rows = knn(' AND _knn_candidate()$whereExtra', translated.binds);
+      if (_knnCandidates >= topK && rows.length < topK) {
+        rows = knn(
+          '$whereExtra AND id IN '
+          '(SELECT id FROM $_tableName WHERE 1$whereExtra)',
+          [...translated.binds, ...translated.binds],
         );
-        rowsReturned = rows.length;
-
-        results.clear();
-        for (final row in rows) {
-          final similarity = 1.0 - (row['distance'] as num).toDouble();
-          // Ordered by distance, so this only trims the tail — not a reason to
-          // fetch more (see FilterToVec0.shouldOverFetch).
-          if (similarity < threshold) break;
-          results.add(
-            RetrievalResult(
-              id: row['id'] as String,
-              content: row['content'] as String? ?? '',
-              similarity: similarity,
-              metadata: row['metadata'] as String?,
-            ),
-          );
-        }
-
-        if (translated.whereSql.isEmpty) break;
-        totalRows ??=
-            _db!.select('SELECT COUNT(*) AS c FROM $_tableName').first['c']
-                as int;
-        if (!FilterToVec0.shouldOverFetch(
-          rowsReturned: rowsReturned,
-          topK: topK,
-          fetch: fetch,
-          totalRows: totalRows,
-        )) {
-          break;
-        }
-        fetch *= 2;
       }
 
-      return results.length > topK ? results.sublist(0, topK) : results;
+      final results = <RetrievalResult>[];
+      for (final row in rows) {
+        final similarity = 1.0 - (row['distance'] as num).toDouble();
+        // Rows arrive ordered by distance, so this can only trim the tail.
+        if (similarity < threshold) break;
+        results.add(
+          RetrievalResult(
+            id: row['id'] as String,
+            content: row['content'] as String? ?? '',
+            similarity: similarity,
+            metadata: row['metadata'] as String?,
+          ),
+        );
+      }
+      return results;
     } catch (e) {
       throw VectorStoreException('Search failed', e);
     }
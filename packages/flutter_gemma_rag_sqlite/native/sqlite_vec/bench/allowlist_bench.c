@@ -0,0 +1,238 @@
+// Benchmark: vec0 KNN under a filter vec0 cannot push down, answered by
+// doubling k or by one `rowid IN (SELECT ...)` allowlist.
+//
+// `tag` and `grp` are metadata columns, and the filter is a cross-column OR
+// over them, which SQLite only applies after vec0 has picked its k rows. The
+// `doubling` strategy is what SqliteVectorStore used to do: rerun the KNN with
+// k doubled until k rows survive the filter, up to 16x the requested k. The
+// `allowlist` strategy runs it once more with `rowid IN (SELECT rowid ...)`
+// over the same filter, so vec0 picks its k from the matching rows only.
+// Every allowlist answer must equal a brute-force scan of the matching rows;
+// a mismatch exits non-zero. `found` is how many of the k rows each one
+// returns, summed over the queries.
+//
+// Build + run from native/sqlite_vec/:
+//   cc -O3 -DSQLITE_CORE -I src -o /tmp/allowlist_bench bench/allowlist_bench.c -lsqlite3 -lm -lpthread
+//   /tmp/allowlist_bench                  # 100000 rows, dimension 384
+//   /tmp/allowlist_bench 200000 768       # custom rows / dimension
+
+#include "sqlite-vec.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_K 10
+#define BENCH_QUERIES 20
+#define BENCH_MAX_FACTOR 16
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static u64 bench_state = 0x2545F4914F6CDD1Dull;
+
+static f32 bench_uniform(void) {
+  bench_state ^= bench_state << 13;
+  bench_state ^= bench_state >> 7;
+  bench_state ^= bench_state << 17;
+  return (f32)(bench_state >> 40) / (f32)(1 << 24) * 2.0f - 1.0f;
+}
+
+static int bench_exec(sqlite3 *db, const char *zSql) {
+  char *zErr = NULL;
+  int rc = sqlite3_exec(db, zSql, NULL, NULL, &zErr);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "%s: %s\n", zSql, zErr);
+    sqlite3_free(zErr);
+  }
+  return rc;
+}
+
+static int bench_load(sqlite3 *db, const f32 *vectors, int rows,
+                      int dimensions) {
+  char *zSql = sqlite3_mprintf("CREATE VIRTUAL TABLE t USING vec0(e float[%d], "
+                               "tag integer, grp integer);",
+                               dimensions);
+  int rc = bench_exec(db, zSql);
+  sqlite3_free(zSql);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  sqlite3_stmt *insert;
+  sqlite3_prepare_v2(db, "INSERT INTO t(rowid, e, tag, grp) VALUES (?, ?, ?, ?)",
+                     -1, &insert, NULL);
+  bench_exec(db, "BEGIN");
+  for (int i = 0; i < rows && rc == SQLITE_OK; i++) {
+    sqlite3_reset(insert);
+    sqlite3_bind_int64(insert, 1, i + 1);
+    sqlite3_bind_blob(insert, 2, vectors + (size_t)i * dimensions,
+                      dimensions * sizeof(f32), SQLITE_STATIC);
+    sqlite3_bind_int(insert, 3, i % 100);
+    sqlite3_bind_int(insert, 4, i % 997);
+    rc = sqlite3_step(insert) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+  }
+  bench_exec(db, "COMMIT");
+  sqlite3_finalize(insert);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "load failed: %s\n", sqlite3_errmsg(db));
+  }
+  return rc;
+}
+
+static int bench_matches(int i, int tag, int grp) {
+  return i % 100 == tag || i % 997 == grp;
+}
+
+// The k nearest rows matching the filter, by a plain scan over `vectors`.
+static void bench_brute(const f32 *vectors, int rows, int dimensions,
+                        const f32 *query, int tag, int grp, i64 *rowids) {
+  f32 best[BENCH_K];
+  for (int r = 0; r < BENCH_K; r++) {
+    best[r] = INFINITY;
+    rowids[r] = 0;
+  }
+  for (int i = 0; i < rows; i++) {
+    if (!bench_matches(i, tag, grp)) {
+      continue;
+    }
+    const f32 *v = vectors + (size_t)i * dimensions;
+    f32 d = 0;
+    for (int j = 0; j < dimensions; j++) {
+      d += (v[j] - query[j]) * (v[j] - query[j]);
+    }
+    if (d >= best[BENCH_K - 1]) {
+      continue;
+    }
+    int r = BENCH_K - 1;
+    while (r > 0 && best[r - 1] > d) {
+      best[r] = best[r - 1];
+      rowids[r] = rowids[r - 1];
+      r--;
+    }
+    best[r] = d;
+    rowids[r] = i + 1;
+  }
+}
+
+// Runs the queries with one strategy; returns ms per query and adds the rows
+// each query returned to *found.
+static double bench_query(sqlite3 *db, int allowlist, const f32 *queries,
+                          int dimensions, const int *tags, const int *grps,
+                          i64 *rowids, int *found) {
+  const char *filter = "(tag = ?3 OR grp = ?4)";
+  sqlite3_stmt *stmt;
+  char *zSql =
+      allowlist
+          ? sqlite3_mprintf("SELECT rowid FROM t WHERE e MATCH ?1 AND k = ?2 "
+                            "AND %s AND rowid IN (SELECT rowid FROM t WHERE "
+                            "%s)",
+                            filter, filter)
+          : sqlite3_mprintf("SELECT rowid FROM t WHERE e MATCH ?1 AND k = ?2 "
+                            "AND %s",
+                            filter);
+  sqlite3_prepare_v2(db, zSql, -1, &stmt, NULL);
+  sqlite3_free(zSql);
+  memset(rowids, 0, BENCH_QUERIES * BENCH_K * sizeof(i64));
+  *found = 0;
+  double t0 = now_ms();
+  for (int q = 0; q < BENCH_QUERIES; q++) {
+    int n = 0;
+    for (int fetch = BENCH_K;; fetch *= 2) {
+      sqlite3_reset(stmt);
+      sqlite3_bind_blob(stmt, 1, queries + (size_t)q * dimensions,
+                        dimensions * sizeof(f32), SQLITE_STATIC);
+      sqlite3_bind_int(stmt, 2, allowlist ? BENCH_K : fetch);
+      sqlite3_bind_int(stmt, 3, tags[q]);
+      sqlite3_bind_int(stmt, 4, grps[q]);
+      n = 0;
+      while (n < BENCH_K && sqlite3_step(stmt) == SQLITE_ROW) {
+        rowids[q * BENCH_K + n++] = sqlite3_column_int64(stmt, 0);
+      }
+      if (allowlist || n == BENCH_K ||
+          fetch >= BENCH_K * BENCH_MAX_FACTOR) {
+        break;
+      }
+    }
+    *found += n;
+  }
+  double ms = (now_ms() - t0) / BENCH_QUERIES;
+  sqlite3_finalize(stmt);
+  return ms;
+}
+
+int main(int argc, char **argv) {
+  int rows = argc > 1 ? atoi(argv[1]) : 100000;
+  int dimensions = argc > 2 ? atoi(argv[2]) : 384;
+  if (rows < 10000 || dimensions < 1 ||
+      dimensions > SQLITE_VEC_VEC0_MAX_DIMENSIONS) {
+    fprintf(stderr, "usage: allowlist_bench [rows >= 10000] [dimensions]\n");
+    return 2;
+  }
+
+  const char *path = "/tmp/allowlist_bench.db";
+  remove(path);
+  sqlite3 *db;
+  sqlite3_auto_extension((void (*)(void))sqlite3_vec_init);
+  if (sqlite3_open(path, &db) != SQLITE_OK) {
+    return 2;
+  }
+  bench_exec(db, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;");
+
+  f32 *vectors = malloc((size_t)rows * dimensions * sizeof(f32));
+  for (size_t i = 0; i < (size_t)rows * dimensions; i++) {
+    vectors[i] = bench_uniform();
+  }
+  if (bench_load(db, vectors, rows, dimensions) != SQLITE_OK) {
+    return 2;
+  }
+
+  f32 *queries = malloc((size_t)BENCH_QUERIES * dimensions * sizeof(f32));
+  for (int i = 0; i < BENCH_QUERIES * dimensions; i++) {
+    queries[i] = bench_uniform();
+  }
+  // ~1% of the rows match: one tag value (1 in 100) or one grp (1 in 997);
+  // tag -1 leaves only the grp arm, ~0.1%
+  int tags[2][BENCH_QUERIES], grps[2][BENCH_QUERIES];
+  for (int q = 0; q < BENCH_QUERIES; q++) {
+    tags[0][q] = q % 100;
+    tags[1][q] = -1;
+    grps[0][q] = grps[1][q] = (q * 53) % 997;
+  }
+  const char *labels[2] = {"`tag = ? OR grp = ?` (~1.1%)",
+                           "`grp = ?` arm only (~0.1%)"};
+
+  size_t n = BENCH_QUERIES * BENCH_K;
+  i64 *want = malloc(n * sizeof(i64));
+  i64 *got = malloc(n * sizeof(i64));
+  int failed = 0;
+  printf("rows=%d dimensions=%d k=%d\n\n", rows, dimensions, BENCH_K);
+  printf("| filter | doubling ms | found | allowlist ms | found |\n");
+  printf("|--------|------------:|------:|-------------:|------:|\n");
+  for (int f = 0; f < 2; f++) {
+    for (int q = 0; q < BENCH_QUERIES; q++) {
+      bench_brute(vectors, rows, dimensions, queries + (size_t)q * dimensions,
+                  tags[f][q], grps[f][q], want + q * BENCH_K);
+    }
+    int foundDoubling, foundAllowlist;
+    double doublingMs = bench_query(db, 0, queries, dimensions, tags[f],
+                                    grps[f], got, &foundDoubling);
+    double allowlistMs = bench_query(db, 1, queries, dimensions, tags[f],
+                                     grps[f], got, &foundAllowlist);
+    if (memcmp(want, got, n * sizeof(i64)) != 0) {
+      fprintf(stderr, "MISMATCH %s\n", labels[f]);
+      failed = 1;
+    }
+    printf("| %s | %.2f | %d | %.2f | %d |\n", labels[f], doublingMs,
+           foundDoubling, allowlistMs, foundAllowlist);
+  }
+
+  sqlite3_close(db);
+  remove(path);
+  free(vectors);
+  free(queries);
+  free(want);
+  free(got);
+  return failed;
+}
@@ -0,0 +1,274 @@
+// Benchmark: batch vec0 KNN (`queries = Q`) vs Q separate KNN queries.
+//
+// Two parts:
+//  1. Kernel level: every batch kernel the host supports must return
+//     bit-identical distances to the single-query kernel of the same level;
+//     the table shows ns per (stored vector x query) for both.
+//  2. End to end: a Q x D batch query against a float table must return
+//     exactly the rows and distances of running the Q queries one by one;
+//     the table shows ms for the whole set of queries.
+// Any mismatch exits non-zero.
+//
+// Build + run from native/sqlite_vec/:
+//   cc -O3 -DSQLITE_CORE -I src -o /tmp/batch_bench bench/batch_bench.c -lsqlite3 -lm -lpthread
+//   /tmp/batch_bench                  # 50000 rows, dimension 768, Q = 1..16
+//   /tmp/batch_bench 100000 1024      # custom rows / dimension
+
+#include "sqlite-vec.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_K 10
+#define BENCH_CORPUS 2048
+#define BENCH_RUNS 5
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static u64 bench_state = 0x2545F4914F6CDD1Dull;
+
+static f32 bench_uniform(void) {
+  bench_state ^= bench_state << 13;
+  bench_state ^= bench_state >> 7;
+  bench_state ^= bench_state << 17;
+  return (f32)(bench_state >> 40) / (f32)(1 << 24) * 2.0f - 1.0f;
+}
+
+struct bench_level {
+  const char *name;
+  int available;
+  vec_distance_fn l2;
+  vec_batch_fn l2Batch;
+  vec_distance_fn cosine;
+  vec_batch_fn cosineBatch;
+  vec_mag_fn mag;
+};
+
+// Checks one level's batch kernels against its single-query kernels and
+// prints both timings.
+static int bench_kernels(const struct bench_level *level, size_t dims,
+                         volatile f32 *sink) {
+  f32 *corpus = malloc(BENCH_CORPUS * dims * sizeof(f32));
+  f32 *queries = malloc(VEC_BATCH_WIDTH * dims * sizeof(f32));
+  for (size_t i = 0; i < BENCH_CORPUS * dims; i++) {
+    corpus[i] = bench_uniform();
+  }
+  for (size_t i = 0; i < VEC_BATCH_WIDTH * dims; i++) {
+    queries[i] = bench_uniform();
+  }
+  const void *qs[VEC_BATCH_WIDTH];
+  f32 mags[VEC_BATCH_WIDTH];
+  for (int j = 0; j < VEC_BATCH_WIDTH; j++) {
+    qs[j] = queries + j * dims;
+    mags[j] = level->mag(qs[j], &dims);
+  }
+
+  int failed = 0;
+  for (int metric = 0; metric < 2; metric++) {
+    vec_distance_fn single = metric ? level->cosine : level->l2;
+    vec_batch_fn batch = metric ? level->cosineBatch : level->l2Batch;
+    for (size_t i = 0; i < BENCH_CORPUS; i++) {
+      f32 out[VEC_BATCH_WIDTH];
+      batch(corpus + i * dims, qs, mags, &dims, out);
+      for (int j = 0; j < VEC_BATCH_WIDTH; j++) {
+        f32 want = single(corpus + i * dims, qs[j], &dims);
+        if (memcmp(&want, &out[j], sizeof(f32)) != 0) {
+          fprintf(stderr, "MISMATCH %s %s dims=%zu row=%zu q=%d: %g vs %g\n",
+                  level->name, metric ? "cosine" : "l2", dims, i, j, want,
+                  out[j]);
+          failed = 1;
+          i = BENCH_CORPUS;
+          break;
+        }
+      }
+    }
+
+    double best[2] = {1e30, 1e30};
+    for (int r = 0; r < BENCH_RUNS; r++) {
+      double t0 = now_ns();
+      f32 acc = 0;
+      for (size_t i = 0; i < BENCH_CORPUS; i++) {
+        for (int j = 0; j < VEC_BATCH_WIDTH; j++) {
+          acc += single(corpus + i * dims, qs[j], &dims);
+        }
+      }
+      double t1 = now_ns();
+      for (size_t i = 0; i < BENCH_CORPUS; i++) {
+        f32 out[VEC_BATCH_WIDTH];
+        batch(corpus + i * dims, qs, mags, &dims, out);
+        acc += out[0] + out[1] + out[2] + out[3];
+      }
+      double t2 = now_ns();
+      *sink += acc;
+      best[0] = fmin(best[0], (t1 - t0) / (BENCH_CORPUS * VEC_BATCH_WIDTH));
+      best[1] = fmin(best[1], (t2 - t1) / (BENCH_CORPUS * VEC_BATCH_WIDTH));
+    }
+    printf("| %zu | %s %s | %.1f | %.1f | %.2fx |\n", dims,
+           metric ? "cosine" : "l2", level->name, best[0], best[1],
+           best[0] / best[1]);
+  }
+  free(corpus);
+  free(queries);
+  return failed;
+}
+
+static int bench_exec(sqlite3 *db, const char *zSql) {
+  char *zErr = NULL;
+  int rc = sqlite3_exec(db, zSql, NULL, NULL, &zErr);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "%s: %s\n", zSql, zErr);
+    sqlite3_free(zErr);
+  }
+  return rc;
+}
+
+// Runs Q queries one at a time, then as one batch; returns 1 on mismatch.
+static int bench_table(sqlite3 *db, int dimensions, int numQueries) {
+  f32 *queries = malloc((size_t)numQueries * dimensions * sizeof(f32));
+  for (int i = 0; i < numQueries * dimensions; i++) {
+    queries[i] = bench_uniform();
+  }
+  size_t n = (size_t)numQueries * BENCH_K;
+  i64 *wantRowids = calloc(n, sizeof(i64));
+  f32 *wantDistances = calloc(n, sizeof(f32));
+  i64 *gotRowids = calloc(n, sizeof(i64));
+  f32 *gotDistances = calloc(n, sizeof(f32));
+  sqlite3_stmt *single, *batch;
+  sqlite3_prepare_v2(db,
+                     "SELECT rowid, distance FROM t WHERE e MATCH ? AND k = ?",
+                     -1, &single, NULL);
+  sqlite3_prepare_v2(db,
+                     "SELECT query_idx, rowid, distance FROM t "
+                     "WHERE e MATCH ? AND k = ? AND queries = ?",
+                     -1, &batch, NULL);
+
+  double t0 = now_ns();
+  for (int q = 0; q < numQueries; q++) {
+    sqlite3_reset(single);
+    sqlite3_bind_blob(single, 1, queries + (size_t)q * dimensions,
+                      dimensions * sizeof(f32), SQLITE_STATIC);
+    sqlite3_bind_int(single, 2, BENCH_K);
+    for (int r = 0; r < BENCH_K && sqlite3_step(single) == SQLITE_ROW; r++) {
+      wantRowids[q * BENCH_K + r] = sqlite3_column_int64(single, 0);
+      wantDistances[q * BENCH_K + r] = (f32)sqlite3_column_double(single, 1);
+    }
+  }
+  double t1 = now_ns();
+  sqlite3_bind_blob(batch, 1, queries,
+                    numQueries * dimensions * sizeof(f32), SQLITE_STATIC);
+  sqlite3_bind_int(batch, 2, BENCH_K);
+  sqlite3_bind_int(batch, 3, numQueries);
+  int seen[VEC0_MAX_BATCH_QUERIES] = {0};
+  while (sqlite3_step(batch) == SQLITE_ROW) {
+    int q = sqlite3_column_int(batch, 0);
+    if (q >= 0 && q < numQueries && seen[q] < BENCH_K) {
+      gotRowids[q * BENCH_K + seen[q]] = sqlite3_column_int64(batch, 1);
+      gotDistances[q * BENCH_K + seen[q]] =
+          (f32)sqlite3_column_double(batch, 2);
+      seen[q]++;
+    }
+  }
+  double t2 = now_ns();
+
+  int failed = memcmp(wantRowids, gotRowids, n * sizeof(i64)) != 0 ||
+               memcmp(wantDistances, gotDistances, n * sizeof(f32)) != 0;
+  if (failed) {
+    fprintf(stderr, "MISMATCH batch of %d vs single queries\n", numQueries);
+  }
+  printf("| %d | %.2f | %.2f | %.2fx |\n", numQueries, (t1 - t0) / 1e6,
+         (t2 - t1) / 1e6, (t1 - t0) / (t2 - t1));
+  sqlite3_finalize(single);
+  sqlite3_finalize(batch);
+  free(queries);
+  free(wantRowids);
+  free(wantDistances);
+  free(gotRowids);
+  free(gotDistances);
+  return failed;
+}
+
+int main(int argc, char **argv) {
+  int rows = argc > 1 ? atoi(argv[1]) : 50000;
+  int dimensions = argc > 2 ? atoi(argv[2]) : 768;
+  if (rows < BENCH_K || dimensions < 1 ||
+      dimensions > SQLITE_VEC_VEC0_MAX_DIMENSIONS) {
+    fprintf(stderr, "usage: batch_bench [rows >= %d] [dimensions]\n", BENCH_K);
+    return 2;
+  }
+  volatile f32 sink = 0;
+  int failed = 0;
+
+  vec_kernels_init();
+  struct bench_level levels[] = {
+      {"scalar", 1, l2_sqr_float, l2_sqr_float_batch, cosine_float,
+       cosine_float_batch, cosine_float_mag},
+#ifdef SQLITE_VEC_DISPATCH_X86
+      {"avx2", vec_cpu.avx2, l2_sqr_float_avx2, l2_sqr_float_batch_avx2,
+       cosine_float_avx2, cosine_float_batch_avx2, cosine_float_mag_avx2},
+      {"avx512", vec_cpu.avx512f, l2_sqr_float_avx512,
+       l2_sqr_float_batch_avx512, cosine_float_avx512,
+       cosine_float_batch_avx512, cosine_float_mag_avx512},
+#endif
+  };
+  printf("| dims | kernel | single ns | batch ns | speedup |\n");
+  printf("|-----:|--------|----------:|---------:|--------:|\n");
+  size_t kernelDims[] = {37, 384, (size_t)dimensions};
+  for (size_t l = 0; l < countof(levels); l++) {
+    if (!levels[l].available) {
+      continue;
+    }
+    for (size_t d = 0; d < countof(kernelDims); d++) {
+      failed |= bench_kernels(&levels[l], kernelDims[d], &sink);
+    }
+  }
+
+  sqlite3 *db;
+  sqlite3_auto_extension((void (*)(void))sqlite3_vec_init);
+  if (sqlite3_open(":memory:", &db) != SQLITE_OK) {
+    return 2;
+  }
+  char *zSql = sqlite3_mprintf(
+      "CREATE VIRTUAL TABLE t USING vec0(e float[%d] distance_metric=cosine);",
+      dimensions);
+  int rc = bench_exec(db, zSql);
+  sqlite3_free(zSql);
+  if (rc != SQLITE_OK) {
+    return 2;
+  }
+  f32 *vector = malloc(dimensions * sizeof(f32));
+  sqlite3_stmt *insert;
+  sqlite3_prepare_v2(db, "INSERT INTO t(rowid, e) VALUES (?, ?)", -1, &insert,
+                     NULL);
+  bench_exec(db, "BEGIN");
+  for (int i = 0; i < rows; i++) {
+    for (int d = 0; d < dimensions; d++) {
+      vector[d] = bench_uniform();
+    }
+    sqlite3_reset(insert);
+    sqlite3_bind_int64(insert, 1, i + 1);
+    sqlite3_bind_blob(insert, 2, vector, dimensions * sizeof(f32),
+                      SQLITE_STATIC);
+    if (sqlite3_step(insert) != SQLITE_DONE) {
+      fprintf(stderr, "insert failed: %s\n", sqlite3_errmsg(db));
+      return 2;
+    }
+  }
+  bench_exec(db, "COMMIT");
+  sqlite3_finalize(insert);
+  free(vector);
+
+  printf("\nrows=%d dimensions=%d distance_metric=cosine k=%d\n\n", rows,
+         dimensions, BENCH_K);
+  printf("| queries | separate ms | batch ms | speedup |\n");
+  printf("|--------:|------------:|---------:|--------:|\n");
+  int counts[] = {1, 2, 4, 8, 16};
+  for (size_t i = 0; i < countof(counts); i++) {
+    failed |= bench_table(db, dimensions, counts[i]);
+  }
+  sqlite3_close(db);
+  return failed;
+}
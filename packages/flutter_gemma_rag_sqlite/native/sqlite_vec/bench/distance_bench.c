@@ -0,0 +1,360 @@
+// Micro-benchmark: sqlite-vec distance kernels, scalar reference vs SIMD.
+// Covers cosine, L2 and L1 over float32/float16/bfloat16/int8, and hamming
+// over bit vectors (one bit per dimension, i.e. the width `quantizer=binary`
+// stores). The float16/bfloat16 corpora are the float32 one rounded.
+//
+// Compiles the vendored amalgamation straight in (SQLITE_CORE, linked against
+// the system libsqlite3) so it can call the static kernels directly, without
+// SQL or vtab overhead in the timing. Every SIMD kernel the host supports is
+// checked against the scalar reference before it is timed; a mismatch beyond
+// float tolerance exits non-zero.
+//
+// Build + run from native/sqlite_vec/:
+//   cc -O3 -DSQLITE_CORE -I src -o /tmp/distance_bench bench/distance_bench.c -lsqlite3 -lm
+//   /tmp/distance_bench                # default dims 384,768,1024,4096
+//   /tmp/distance_bench 256 1536       # custom dims
+//
+// Output is a markdown table: ns per distance call (median of 7 runs over a
+// 4096-vector corpus) and the speedup over the scalar reference (the byte
+// lookup table for hamming).
+
+#include "sqlite-vec.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_CORPUS 4096
+#define BENCH_RUNS 7
+
+typedef f32 (*bench_kernel)(const void *, const void *, const void *);
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static u64 rng_state = 0x9E3779B97F4A7C15ull;
+static u32 rng_next(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return (u32)rng_state;
+}
+
+// Median ns/call of `kernel` scoring `query` against every corpus vector.
+static double time_kernel(bench_kernel kernel, const u8 *corpus,
+                          size_t stride, const void *query, size_t dims,
+                          volatile f32 *sink) {
+  double runs[BENCH_RUNS];
+  for (int r = 0; r < BENCH_RUNS; r++) {
+    double t0 = now_ns();
+    f32 acc = 0;
+    for (size_t i = 0; i < BENCH_CORPUS; i++) {
+      acc += kernel(corpus + i * stride, query, &dims);
+    }
+    runs[r] = (now_ns() - t0) / BENCH_CORPUS;
+    *sink += acc;
+  }
+  qsort(runs, BENCH_RUNS, sizeof(double), cmp_double);
+  return runs[BENCH_RUNS / 2];
+}
+
+static int check_kernel(const char *name, bench_kernel kernel,
+                        bench_kernel reference, const u8 *corpus,
+                        size_t stride, const void *query, size_t dims) {
+  for (size_t i = 0; i < 64; i++) {
+    f32 want = reference(corpus + i * stride, query, &dims);
+    f32 got = kernel(corpus + i * stride, query, &dims);
+    if (fabsf(want - got) > 1e-4f * (1 + fabsf(want))) {
+      fprintf(stderr, "MISMATCH %s dims=%zu row=%zu: scalar=%g simd=%g\n",
+              name, dims, i, want, got);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Byte lookup table, the reference every hamming kernel is checked against.
+static f32 bench_hamming_table(const void *a, const void *b, const void *d) {
+  return hamming_u8(a, b, *(const size_t *)d / CHAR_BIT);
+}
+
+// L1 kernels return i32/double; time them through the common signature.
+#define BENCH_AS_F32(name, fn)                                                 \
+  static f32 name(const void *a, const void *b, const void *d) {               \
+    return (f32)fn(a, b, d);                                                   \
+  }
+BENCH_AS_F32(bench_l1_f32, l1_f32)
+BENCH_AS_F32(bench_l1_int8, l1_int8)
+#ifdef SQLITE_VEC_DISPATCH_X86
+BENCH_AS_F32(bench_l1_f32_avx2, l1_f32_avx2)
+BENCH_AS_F32(bench_l1_int8_avx2, l1_int8_avx2)
+#endif
+#ifdef SQLITE_VEC_DISPATCH_NEON
+BENCH_AS_F32(bench_l1_f32_neon, l1_f32_neon)
+BENCH_AS_F32(bench_l1_int8_neon, l1_int8_neon)
+#endif
+
+struct bench_case {
+  const char *name;
+  bench_kernel kernel;
+  int available;
+};
+
+// Checks each available case against cases[0], the scalar reference, then
+// prints its timing and speedup over that reference.
+static int run_cases(const struct bench_case *cases, size_t n, const u8 *corpus,
+                     size_t stride, const void *query, size_t dims,
+                     volatile f32 *sink) {
+  int failed = 0;
+  double base = 0;
+  for (size_t c = 0; c < n; c++) {
+    if (!cases[c].available) {
+      continue;
+    }
+    failed |= check_kernel(cases[c].name, cases[c].kernel, cases[0].kernel,
+                           corpus, stride, query, dims);
+    double ns = time_kernel(cases[c].kernel, corpus, stride, query, dims, sink);
+    if (c == 0) {
+      base = ns;
+    }
+    printf("| %zu | %s | %.1f | %.2fx |\n", dims, cases[c].name, ns, base / ns);
+  }
+  return failed;
+}
+
+static int bench_dims(size_t dims, volatile f32 *sink) {
+  int failed = 0;
+  f32 *fcorpus = malloc(BENCH_CORPUS * dims * sizeof(f32));
+  f32 *fquery = malloc(dims * sizeof(f32));
+  i8 *icorpus = malloc(BENCH_CORPUS * dims);
+  i8 *iquery = malloc(dims);
+  u16 *hcorpus = malloc(BENCH_CORPUS * dims * sizeof(u16));
+  u16 *hquery = malloc(dims * sizeof(u16));
+  u16 *bfcorpus = malloc(BENCH_CORPUS * dims * sizeof(u16));
+  u16 *bfquery = malloc(dims * sizeof(u16));
+  u8 *bcorpus = malloc(BENCH_CORPUS * (dims / CHAR_BIT));
+  u8 *bquery = malloc(dims / CHAR_BIT);
+  if (!fcorpus || !fquery || !icorpus || !iquery || !hcorpus || !hquery ||
+      !bfcorpus || !bfquery || !bcorpus || !bquery) {
+    fprintf(stderr, "out of memory\n");
+    exit(2);
+  }
+  for (size_t i = 0; i < BENCH_CORPUS * dims; i++) {
+    fcorpus[i] = (f32)((int)(rng_next() % 2001) - 1000) / 1000.0f;
+    icorpus[i] = (i8)(rng_next() % 256 - 128);
+  }
+  for (size_t i = 0; i < dims; i++) {
+    fquery[i] = (f32)((int)(rng_next() % 2001) - 1000) / 1000.0f;
+    iquery[i] = (i8)(rng_next() % 256 - 128);
+  }
+  vec_f32_to_half(fcorpus, hcorpus, BENCH_CORPUS * dims,
+                  SQLITE_VEC_ELEMENT_TYPE_FLOAT16);
+  vec_f32_to_half(fquery, hquery, dims, SQLITE_VEC_ELEMENT_TYPE_FLOAT16);
+  vec_f32_to_half(fcorpus, bfcorpus, BENCH_CORPUS * dims,
+                  SQLITE_VEC_ELEMENT_TYPE_BFLOAT16);
+  vec_f32_to_half(fquery, bfquery, dims, SQLITE_VEC_ELEMENT_TYPE_BFLOAT16);
+  for (size_t i = 0; i < BENCH_CORPUS * (dims / CHAR_BIT); i++) {
+    bcorpus[i] = (u8)rng_next();
+  }
+  for (size_t i = 0; i < dims / CHAR_BIT; i++) {
+    bquery[i] = (u8)rng_next();
+  }
+
+  struct bench_case cosf[] = {
+      {"cosine f32 scalar", cosine_float, 1},
+#ifdef SQLITE_VEC_DISPATCH_X86
+      {"cosine f32 avx2", cosine_float_avx2, vec_cpu.avx2},
+      {"cosine f32 avx512", cosine_float_avx512, vec_cpu.avx512f},
+#endif
+#ifdef SQLITE_VEC_DISPATCH_NEON
+      {"cosine f32 neon", cosine_float_neon, vec_cpu.neon},
+#endif
+  };
+  struct bench_case cosi[] = {
+      {"cosine i8 scalar", cosine_int8, 1},
+#ifdef SQLITE_VEC_DISPATCH_X86
+      {"cosine i8 avx2", cosine_int8_avx2, vec_cpu.avx2},
+      {"cosine i8 avx512", cosine_int8_avx512, vec_cpu.avx512bw},
+#endif
+#ifdef SQLITE_VEC_DISPATCH_NEON
+      {"cosine i8 neon", cosine_int8_neon, vec_cpu.neon},
+#endif
+  };
+  struct bench_case l2f[] = {
+      {"l2 f32 scalar", l2_sqr_float, 1},
+#ifdef SQLITE_VEC_DISPATCH_X86
+      {"l2 f32 avx2", l2_sqr_float_avx2, vec_cpu.avx2},
+      {"l2 f32 avx512", l2_sqr_float_avx512, vec_cpu.avx512f},
+#endif
+#ifdef SQLITE_VEC_DISPATCH_NEON
+      {"l2 f32 neon", l2_sqr_float_neon, vec_cpu.neon},
+#endif
+  };
+  struct bench_case l2i[] = {
+      {"l2 i8 scalar", l2_sqr_int8, 1},
+#ifdef SQLITE_VEC_DISPATCH_X86
+      {"l2 i8 avx2", l2_sqr_int8_avx2, vec_cpu.avx2},
+#endif
+#ifdef SQLITE_VEC_DISPATCH_NEON
+      {"l2 i8 neon", l2_sqr_int8_neon, vec_cpu.neon},
+#endif
+  };
+  struct bench_case l1f[] = {
+      {"l1 f32 scalar", bench_l1_f32, 1},
+#ifdef SQLITE_VEC_DISPATCH_X86
+      {"l1 f32 avx2", bench_l1_f32_avx2, vec_cpu.avx2},
+#endif
+#ifdef SQLITE_VEC_DISPATCH_NEON
+      {"l1 f32 neon", bench_l1_f32_neon, vec_cpu.neon},
+#endif
+  };
+  struct bench_case l1i[] = {
+      {"l1 i8 scalar", bench_l1_int8, 1},
+#ifdef SQLITE_VEC_DISPATCH_X86
+      {"l1 i8 avx2", bench_l1_int8_avx2, vec_cpu.avx2},
+#endif
+#ifdef SQLITE_VEC_DISPATCH_NEON
+      {"l1 i8 neon", bench_l1_int8_neon, vec_cpu.neon},
+#endif
+  };
+  struct bench_case cosineh[] = {
+      {"cosine f16 scalar", cosine_f16, 1},
+#ifdef SQLITE_VEC_DISPATCH_X86
+      {"cosine f16 avx2", cosine_f16_avx2, vec_cpu.avx2 && vec_cpu.f16c},
+      {"cosine f16 avx512", cosine_f16_avx512, vec_cpu.avx512bw},
+#endif
+#ifdef SQLITE_VEC_DISPATCH_NEON
+      {"cosine f16 neon", cosine_f16_neon, vec_cpu.neon},
+#endif
+  };
+  struct bench_case cosineb[] = {
+      {"cosine bf16 scalar", cosine_bf16, 1},
+#ifdef SQLITE_VEC_DISPATCH_X86
+      {"cosine bf16 avx2", cosine_bf16_avx2, vec_cpu.avx2 && vec_cpu.f16c},
+      {"cosine bf16 avx512", cosine_bf16_avx512, vec_cpu.avx512bw},
+#endif
+#ifdef SQLITE_VEC_DISPATCH_NEON
+      {"cosine bf16 neon", cosine_bf16_neon, vec_cpu.neon},
+#endif
+  };
+  struct bench_case l2h[] = {
+      {"l2 f16 scalar", l2_sqr_f16, 1},
+#ifdef SQLITE_VEC_DISPATCH_X86
+      {"l2 f16 avx2", l2_sqr_f16_avx2, vec_cpu.avx2 && vec_cpu.f16c},
+      {"l2 f16 avx512", l2_sqr_f16_avx512, vec_cpu.avx512bw},
+#endif
+#ifdef SQLITE_VEC_DISPATCH_NEON
+      {"l2 f16 neon", l2_sqr_f16_neon, vec_cpu.neon},
+#endif
+  };
+  struct bench_case l2b[] = {
+      {"l2 bf16 scalar", l2_sqr_bf16, 1},
+#ifdef SQLITE_VEC_DISPATCH_X86
+      {"l2 bf16 avx2", l2_sqr_bf16_avx2, vec_cpu.avx2 && vec_cpu.f16c},
+      {"l2 bf16 avx512", l2_sqr_bf16_avx512, vec_cpu.avx512bw},
+#endif
+#ifdef SQLITE_VEC_DISPATCH_NEON
+      {"l2 bf16 neon", l2_sqr_bf16_neon, vec_cpu.neon},
+#endif
+  };
+  struct bench_case l1h[] = {
+      {"l1 f16 scalar", l1_f16, 1},
+#ifdef SQLITE_VEC_DISPATCH_X86
+      {"l1 f16 avx2", l1_f16_avx2, vec_cpu.avx2 && vec_cpu.f16c},
+      {"l1 f16 avx512", l1_f16_avx512, vec_cpu.avx512bw},
+#endif
+#ifdef SQLITE_VEC_DISPATCH_NEON
+      {"l1 f16 neon", l1_f16_neon, vec_cpu.neon},
+#endif
+  };
+  struct bench_case l1b[] = {
+      {"l1 bf16 scalar", l1_bf16, 1},
+#ifdef SQLITE_VEC_DISPATCH_X86
+      {"l1 bf16 avx2", l1_bf16_avx2, vec_cpu.avx2 && vec_cpu.f16c},
+      {"l1 bf16 avx512", l1_bf16_avx512, vec_cpu.avx512bw},
+#endif
+#ifdef SQLITE_VEC_DISPATCH_NEON
+      {"l1 bf16 neon", l1_bf16_neon, vec_cpu.neon},
+#endif
+  };
+  struct bench_case ham[] = {
+      {"hamming bit table", bench_hamming_table, 1},
+      {"hamming bit u64", distance_hamming_u64, 1},
+#ifdef SQLITE_VEC_HAMMING_X86
+      {"hamming bit popcnt", distance_hamming_popcnt, vec_cpu.popcnt},
+      {"hamming bit avx2", distance_hamming_avx2, vec_cpu.avx2},
+      {"hamming bit avx512", distance_hamming_avx512, vec_cpu.avx512vpopcntdq},
+#endif
+#ifdef SQLITE_VEC_DISPATCH_NEON
+      {"hamming bit neon", distance_hamming_neon, vec_cpu.neon},
+#endif
+  };
+
+  size_t fstride = dims * sizeof(f32);
+  failed |= run_cases(cosf, countof(cosf), (u8 *)fcorpus, fstride, fquery,
+                      dims, sink);
+  failed |= run_cases(l2f, countof(l2f), (u8 *)fcorpus, fstride, fquery, dims,
+                      sink);
+  failed |= run_cases(l1f, countof(l1f), (u8 *)fcorpus, fstride, fquery, dims,
+                      sink);
+  size_t hstride = dims * sizeof(u16);
+  struct bench_case *halfCases[] = {cosineh, l2h, l1h, cosineb, l2b, l1b};
+  size_t halfCounts[] = {countof(cosineh), countof(l2h), countof(l1h),
+                         countof(cosineb), countof(l2b), countof(l1b)};
+  for (size_t c = 0; c < countof(halfCases); c++) {
+    int bf16 = c >= 3;
+    failed |= run_cases(halfCases[c], halfCounts[c],
+                        (u8 *)(bf16 ? bfcorpus : hcorpus), hstride,
+                        bf16 ? bfquery : hquery, dims, sink);
+  }
+  failed |=
+      run_cases(cosi, countof(cosi), (u8 *)icorpus, dims, iquery, dims, sink);
+  failed |=
+      run_cases(l2i, countof(l2i), (u8 *)icorpus, dims, iquery, dims, sink);
+  failed |=
+      run_cases(l1i, countof(l1i), (u8 *)icorpus, dims, iquery, dims, sink);
+  if (dims % CHAR_BIT == 0) {
+    // counts are integers, so the tolerance check is exact here
+    failed |= run_cases(ham, countof(ham), bcorpus, dims / CHAR_BIT, bquery,
+                        dims, sink);
+  }
+
+  free(fcorpus);
+  free(fquery);
+  free(icorpus);
+  free(iquery);
+  free(hcorpus);
+  free(hquery);
+  free(bfcorpus);
+  free(bfquery);
+  free(bcorpus);
+  free(bquery);
+  return failed;
+}
+
+int main(int argc, char **argv) {
+  size_t defaults[] = {384, 768, 1024, 4096};
+  volatile f32 sink = 0;
+  int failed = 0;
+
+  vec_kernels_init();
+  printf("| dims | kernel | ns/call | speedup |\n");
+  printf("|-----:|--------|--------:|--------:|\n");
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      failed |= bench_dims((size_t)strtoul(argv[i], NULL, 10), &sink);
+    }
+  } else {
+    for (size_t i = 0; i < countof(defaults); i++) {
+      failed |= bench_dims(defaults[i], &sink);
+    }
+  }
+  return failed;
+}
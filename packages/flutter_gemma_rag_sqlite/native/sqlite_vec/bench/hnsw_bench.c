@@ -0,0 +1,203 @@
+// Benchmark: vec0 KNN through an `index=hnsw` vector column vs the exact
+// chunk scan, on the same clustered float32 data.
+//
+// Two tables are filled with identical rows; every query runs against both
+// and recall@k is measured against the exact answer. Reported per ef_search:
+// recall, mean query latency for each path, and the speedup. Recall below
+// BENCH_MIN_RECALL at any ef_search >= the default exits non-zero.
+//
+// At the default 10000 x 384 on one x86-64 core, ef_search=64 gives recall@10
+// 0.999 at about 2.2x the flat scan's speed; ef_search=16 gives 3.4x at
+// recall 0.87. Building the graph is the cost: each table is filled in one
+// transaction, and the HNSW one takes ~5.5 s against ~70 ms for the flat
+// table, roughly 80x (it was ~26 s before the per-transaction node cache).
+//
+// Build + run from native/sqlite_vec/:
+//   cc -O3 -DSQLITE_CORE -I src -o /tmp/hnsw_bench bench/hnsw_bench.c -lsqlite3 -lm
+//   /tmp/hnsw_bench                    # 10000 rows, dimension 384
+//   /tmp/hnsw_bench 50000 128          # custom rows / dimension
+
+#include "sqlite-vec.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_K 10
+#define BENCH_QUERIES 200
+#define BENCH_CLUSTERS 32
+#define BENCH_MIN_RECALL 0.9
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static u64 bench_state = 0x2545F4914F6CDD1Dull;
+
+static f32 bench_uniform(void) {
+  bench_state ^= bench_state << 13;
+  bench_state ^= bench_state >> 7;
+  bench_state ^= bench_state << 17;
+  return (f32)(bench_state >> 40) / (f32)(1 << 24);
+}
+
+// Sample from one of BENCH_CLUSTERS centers plus uniform noise, so the data
+// has the neighbourhood structure real embeddings do.
+static void bench_vector(const f32 *centers, int dimensions, f32 *out) {
+  int c = (int)(bench_uniform() * BENCH_CLUSTERS) % BENCH_CLUSTERS;
+  for (int i = 0; i < dimensions; i++) {
+    out[i] = centers[c * dimensions + i] + (bench_uniform() - 0.5f) * 0.5f;
+  }
+}
+
+static int bench_exec(sqlite3 *db, const char *zSql) {
+  char *zErr = NULL;
+  int rc = sqlite3_exec(db, zSql, NULL, NULL, &zErr);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "%s: %s\n", zSql, zErr);
+    sqlite3_free(zErr);
+  }
+  return rc;
+}
+
+static int bench_knn(sqlite3_stmt *stmt, const f32 *query, int dimensions,
+                     int ef, i64 *out_rowids) {
+  int n = 0;
+  sqlite3_reset(stmt);
+  sqlite3_bind_blob(stmt, 1, query, dimensions * sizeof(f32), SQLITE_STATIC);
+  if (ef > 0) {
+    sqlite3_bind_int(stmt, 2, ef);
+  }
+  while (sqlite3_step(stmt) == SQLITE_ROW && n < BENCH_K) {
+    out_rowids[n++] = sqlite3_column_int64(stmt, 0);
+  }
+  return n;
+}
+
+int main(int argc, char **argv) {
+  int efs[] = {16, 32, 64, 128, 256};
+  int rows = argc > 1 ? atoi(argv[1]) : 10000;
+  int dimensions = argc > 2 ? atoi(argv[2]) : 384;
+  if (rows < BENCH_K || dimensions < 1 ||
+      dimensions > SQLITE_VEC_VEC0_MAX_DIMENSIONS) {
+    fprintf(stderr, "usage: hnsw_bench [rows >= %d] [dimensions]\n", BENCH_K);
+    return 2;
+  }
+
+  sqlite3 *db;
+  sqlite3_auto_extension((void (*)(void))sqlite3_vec_init);
+  if (sqlite3_open(":memory:", &db) != SQLITE_OK) {
+    return 2;
+  }
+  char *zSql = sqlite3_mprintf(
+      "CREATE VIRTUAL TABLE flat USING vec0(e float[%d]);"
+      "CREATE VIRTUAL TABLE hnsw USING vec0(e float[%d] index=hnsw);",
+      dimensions, dimensions);
+  int rc = bench_exec(db, zSql);
+  sqlite3_free(zSql);
+  if (rc != SQLITE_OK) {
+    return 2;
+  }
+
+  f32 *centers = malloc((size_t)BENCH_CLUSTERS * dimensions * sizeof(f32));
+  for (int i = 0; i < BENCH_CLUSTERS * dimensions; i++) {
+    centers[i] = bench_uniform() * 2.0f - 1.0f;
+  }
+
+  // Each table is filled in a transaction of its own, timed through its
+  // COMMIT: the HNSW graph's node cache is written out there.
+  f32 *data = malloc((size_t)rows * dimensions * sizeof(f32));
+  for (int i = 0; i < rows; i++) {
+    bench_vector(centers, dimensions, data + (size_t)i * dimensions);
+  }
+  const char *tables[] = {"flat", "hnsw"};
+  double builds[2];
+  for (int t = 0; t < 2; t++) {
+    sqlite3_stmt *insert;
+    zSql = sqlite3_mprintf("INSERT INTO %s(rowid, e) VALUES (?, ?)",
+                           tables[t]);
+    sqlite3_prepare_v2(db, zSql, -1, &insert, NULL);
+    sqlite3_free(zSql);
+    double t0 = now_ms();
+    bench_exec(db, "BEGIN");
+    for (int i = 0; i < rows; i++) {
+      sqlite3_reset(insert);
+      sqlite3_bind_int64(insert, 1, i + 1);
+      sqlite3_bind_blob(insert, 2, data + (size_t)i * dimensions,
+                        dimensions * sizeof(f32), SQLITE_STATIC);
+      if (sqlite3_step(insert) != SQLITE_DONE) {
+        fprintf(stderr, "insert failed: %s\n", sqlite3_errmsg(db));
+        return 2;
+      }
+    }
+    if (bench_exec(db, "COMMIT") != SQLITE_OK) {
+      return 2;
+    }
+    builds[t] = now_ms() - t0;
+    sqlite3_finalize(insert);
+  }
+  free(data);
+  double buildFlat = builds[0], buildHnsw = builds[1];
+  printf("rows=%d dimensions=%d build: flat %.0f ms, hnsw %.0f ms\n\n", rows,
+         dimensions, buildFlat, buildHnsw);
+
+  f32 *queries = malloc((size_t)BENCH_QUERIES * dimensions * sizeof(f32));
+  i64 *exact = malloc((size_t)BENCH_QUERIES * BENCH_K * sizeof(i64));
+  for (int q = 0; q < BENCH_QUERIES; q++) {
+    bench_vector(centers, dimensions, queries + (size_t)q * dimensions);
+  }
+
+  sqlite3_stmt *knnFlat, *knnHnsw;
+  sqlite3_prepare_v2(db,
+                     "SELECT rowid FROM flat WHERE e MATCH ? AND k = 10", -1,
+                     &knnFlat, NULL);
+  sqlite3_prepare_v2(
+      db, "SELECT rowid FROM hnsw WHERE e MATCH ? AND k = 10 AND ef_search = ?",
+      -1, &knnHnsw, NULL);
+
+  double t0 = now_ms();
+  for (int q = 0; q < BENCH_QUERIES; q++) {
+    bench_knn(knnFlat, queries + (size_t)q * dimensions, dimensions, 0,
+              exact + (size_t)q * BENCH_K);
+  }
+  double flatMs = (now_ms() - t0) / BENCH_QUERIES;
+
+  int failed = 0;
+  printf("| ef_search | recall@%d | flat ms/query | hnsw ms/query | speedup |\n",
+         BENCH_K);
+  printf("|----------:|---------:|--------------:|--------------:|--------:|\n");
+  for (size_t e = 0; e < countof(efs); e++) {
+    i64 got[BENCH_K];
+    int hits = 0;
+    t0 = now_ms();
+    for (int q = 0; q < BENCH_QUERIES; q++) {
+      int n = bench_knn(knnHnsw, queries + (size_t)q * dimensions, dimensions,
+                        efs[e], got);
+      for (int i = 0; i < n; i++) {
+        for (int j = 0; j < BENCH_K; j++) {
+          if (got[i] == exact[(size_t)q * BENCH_K + j]) {
+            hits++;
+            break;
+          }
+        }
+      }
+    }
+    double hnswMs = (now_ms() - t0) / BENCH_QUERIES;
+    double recall = (double)hits / (BENCH_QUERIES * BENCH_K);
+    if (efs[e] >= VEC0_HNSW_DEFAULT_EF_SEARCH && recall < BENCH_MIN_RECALL) {
+      fprintf(stderr, "LOW RECALL %.3f at ef_search=%d\n", recall, efs[e]);
+      failed = 1;
+    }
+    printf("| %d | %.3f | %.3f | %.3f | %.1fx |\n", efs[e], recall, flatMs,
+           hnswMs, flatMs / hnswMs);
+  }
+
+  sqlite3_finalize(knnFlat);
+  sqlite3_finalize(knnHnsw);
+  sqlite3_close(db);
+  free(centers);
+  free(queries);
+  free(exact);
+  return failed;
+}
@@ -0,0 +1,218 @@
+// Benchmark: vec0 ingest throughput in rows/sec.
+//
+// Three ways to load the same N vectors into a fresh table:
+//   rows        one prepared INSERT per row, all in one transaction
+//   autocommit  one INSERT per row, each its own transaction (first 2000 rows)
+//   npy         a single INSERT ... SELECT FROM vec_npy_each(?) over an
+//               in-memory .npy blob
+// Each load is checked with a KNN query against the `rows` table; a mismatch
+// exits non-zero.
+//
+// Build + run from native/sqlite_vec/:
+//   cc -O3 -DSQLITE_CORE -I src -o /tmp/insert_bench bench/insert_bench.c -lsqlite3 -lm -lpthread
+//   /tmp/insert_bench                  # 50000 rows, dimension 384
+//   /tmp/insert_bench 100000 768       # custom rows / dimension
+
+#include "sqlite-vec.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_AUTOCOMMIT_ROWS 2000
+#define BENCH_K 10
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static u64 bench_state = 0x2545F4914F6CDD1Dull;
+
+static f32 bench_uniform(void) {
+  bench_state ^= bench_state << 13;
+  bench_state ^= bench_state >> 7;
+  bench_state ^= bench_state << 17;
+  return (f32)(bench_state >> 40) / (f32)(1 << 24) * 2.0f - 1.0f;
+}
+
+static int bench_exec(sqlite3 *db, const char *zSql) {
+  char *zErr = NULL;
+  int rc = sqlite3_exec(db, zSql, NULL, NULL, &zErr);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "%s: %s\n", zSql, zErr);
+    sqlite3_free(zErr);
+  }
+  return rc;
+}
+
+static int bench_create(sqlite3 *db, const char *table, int dimensions) {
+  char *zSql = sqlite3_mprintf(
+      "CREATE VIRTUAL TABLE \"%w\" USING vec0(e float[%d], tag integer);",
+      table, dimensions);
+  int rc = bench_exec(db, zSql);
+  sqlite3_free(zSql);
+  return rc;
+}
+
+// Inserts rows [0, rows) one statement at a time; returns ms or -1.
+static double bench_rows(sqlite3 *db, const char *table, const f32 *vectors,
+                         int rows, int dimensions, int transaction) {
+  sqlite3_stmt *insert;
+  char *zSql = sqlite3_mprintf(
+      "INSERT INTO \"%w\"(rowid, e, tag) VALUES (?, ?, ?)", table);
+  sqlite3_prepare_v2(db, zSql, -1, &insert, NULL);
+  sqlite3_free(zSql);
+  double t0 = now_ms();
+  if (transaction) {
+    bench_exec(db, "BEGIN");
+  }
+  for (int i = 0; i < rows; i++) {
+    sqlite3_reset(insert);
+    sqlite3_bind_int64(insert, 1, i + 1);
+    sqlite3_bind_blob(insert, 2, vectors + (size_t)i * dimensions,
+                      dimensions * sizeof(f32), SQLITE_STATIC);
+    sqlite3_bind_int(insert, 3, i % 8);
+    if (sqlite3_step(insert) != SQLITE_DONE) {
+      fprintf(stderr, "insert failed: %s\n", sqlite3_errmsg(db));
+      sqlite3_finalize(insert);
+      return -1;
+    }
+  }
+  if (transaction) {
+    bench_exec(db, "COMMIT");
+  }
+  double ms = now_ms() - t0;
+  sqlite3_finalize(insert);
+  return ms;
+}
+
+// Loads every row with one INSERT ... SELECT over a .npy blob; returns ms or
+// -1.
+static double bench_npy(sqlite3 *db, const char *table, const f32 *vectors,
+                        int rows, int dimensions) {
+  char header[128];
+  int n = snprintf(header, sizeof(header),
+                   "{'descr': '<f4', 'fortran_order': False, "
+                   "'shape': (%d, %d), }",
+                   rows, dimensions);
+  // magic + version + u16 length + dict, padded with spaces to 64 bytes
+  int headerLength = ((10 + n + 1 + 63) / 64) * 64 - 10;
+  size_t size = 10 + headerLength + (size_t)rows * dimensions * sizeof(f32);
+  u8 *npy = malloc(size);
+  memcpy(npy, "\x93NUMPY\x01\x00", 8);
+  npy[8] = headerLength & 0xff;
+  npy[9] = headerLength >> 8;
+  memset(npy + 10, ' ', headerLength);
+  memcpy(npy + 10, header, n);
+  npy[10 + headerLength - 1] = '\n';
+  memcpy(npy + 10 + headerLength, vectors,
+         (size_t)rows * dimensions * sizeof(f32));
+
+  sqlite3_stmt *insert;
+  char *zSql = sqlite3_mprintf(
+      "INSERT INTO \"%w\"(rowid, e, tag) "
+      "SELECT rowid + 1, vector, rowid %% 8 FROM vec_npy_each(?)",
+      table);
+  sqlite3_prepare_v2(db, zSql, -1, &insert, NULL);
+  sqlite3_free(zSql);
+  double t0 = now_ms();
+  sqlite3_bind_blob(insert, 1, npy, size, SQLITE_STATIC);
+  int rc = sqlite3_step(insert);
+  double ms = now_ms() - t0;
+  if (rc != SQLITE_DONE) {
+    fprintf(stderr, "npy insert failed: %s\n", sqlite3_errmsg(db));
+    ms = -1;
+  }
+  sqlite3_finalize(insert);
+  free(npy);
+  return ms;
+}
+
+// Compares a filtered KNN query on `table` with the same query on `rows`.
+static int bench_check(sqlite3 *db, const char *table, int dimensions) {
+  f32 *query = malloc(dimensions * sizeof(f32));
+  for (int d = 0; d < dimensions; d++) {
+    query[d] = bench_uniform();
+  }
+  i64 want[BENCH_K], got[BENCH_K];
+  const char *tables[2] = {"rows", table};
+  i64 *out[2] = {want, got};
+  for (int t = 0; t < 2; t++) {
+    sqlite3_stmt *stmt;
+    char *zSql = sqlite3_mprintf("SELECT rowid FROM \"%w\" WHERE e MATCH ? "
+                                 "AND k = %d AND tag = 3",
+                                 tables[t], BENCH_K);
+    sqlite3_prepare_v2(db, zSql, -1, &stmt, NULL);
+    sqlite3_free(zSql);
+    sqlite3_bind_blob(stmt, 1, query, dimensions * sizeof(f32),
+                      SQLITE_STATIC);
+    for (int i = 0; i < BENCH_K; i++) {
+      out[t][i] =
+          sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : -1;
+    }
+    sqlite3_finalize(stmt);
+  }
+  free(query);
+  if (memcmp(want, got, sizeof(want)) != 0) {
+    fprintf(stderr, "MISMATCH %s vs rows\n", table);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int rows = argc > 1 ? atoi(argv[1]) : 50000;
+  int dimensions = argc > 2 ? atoi(argv[2]) : 384;
+  if (rows < BENCH_AUTOCOMMIT_ROWS || dimensions < 1 ||
+      dimensions > SQLITE_VEC_VEC0_MAX_DIMENSIONS) {
+    fprintf(stderr, "usage: insert_bench [rows >= %d] [dimensions]\n",
+            BENCH_AUTOCOMMIT_ROWS);
+    return 2;
+  }
+
+  // a file, not :memory:, so page writes and the journal are part of it
+  const char *path = "/tmp/insert_bench.db";
+  remove(path);
+  sqlite3 *db;
+  sqlite3_auto_extension((void (*)(void))sqlite3_vec_init);
+  sqlite3_auto_extension((void (*)(void))sqlite3_vec_numpy_init);
+  if (sqlite3_open(path, &db) != SQLITE_OK) {
+    return 2;
+  }
+  bench_exec(db, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;");
+
+  f32 *vectors = malloc((size_t)rows * dimensions * sizeof(f32));
+  for (size_t i = 0; i < (size_t)rows * dimensions; i++) {
+    vectors[i] = bench_uniform();
+  }
+
+  printf("rows=%d dimensions=%d\n\n", rows, dimensions);
+  printf("| load | rows | ms | rows/sec |\n");
+  printf("|------|-----:|---:|---------:|\n");
+  int failed = 0;
+  if (bench_create(db, "rows", dimensions) != SQLITE_OK ||
+      bench_create(db, "autocommit", dimensions) != SQLITE_OK ||
+      bench_create(db, "npy", dimensions) != SQLITE_OK) {
+    return 2;
+  }
+  double ms = bench_rows(db, "rows", vectors, rows, dimensions, 1);
+  failed |= ms < 0;
+  printf("| rows | %d | %.0f | %.0f |\n", rows, ms, rows / ms * 1e3);
+
+  ms = bench_rows(db, "autocommit", vectors, BENCH_AUTOCOMMIT_ROWS,
+                  dimensions, 0);
+  failed |= ms < 0;
+  printf("| autocommit | %d | %.0f | %.0f |\n", BENCH_AUTOCOMMIT_ROWS, ms,
+         BENCH_AUTOCOMMIT_ROWS / ms * 1e3);
+
+  ms = bench_npy(db, "npy", vectors, rows, dimensions);
+  failed |= ms < 0;
+  printf("| npy | %d | %.0f | %.0f |\n", rows, ms, rows / ms * 1e3);
+  failed |= bench_check(db, "npy", dimensions);
+
+  sqlite3_close(db);
+  remove(path);
+  free(vectors);
+  return failed;
+}
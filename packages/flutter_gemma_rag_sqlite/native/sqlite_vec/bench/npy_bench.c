@@ -0,0 +1,231 @@
+// Benchmark: reading .npy files through vec_npy_each(vec_npy_file(...)).
+//
+// Writes a rows x dimensions array as '<f4', '<f2' and '|i1' .npy files, then
+// per file times a plain scan of every row and a bulk load into a vec0 column
+// of the matching type. Peak RSS after the scans shows that rows come straight
+// out of the file mapping rather than through heap buffers. Each load must
+// store exactly the file's rows; a mismatch exits non-zero. Files stay in the
+// OS page cache, so this measures the per-row cost, not disk reads.
+//
+// Build + run from native/sqlite_vec/:
+//   cc -O3 -DSQLITE_CORE -I src -o /tmp/npy_bench bench/npy_bench.c -lsqlite3 -lm -lpthread
+//   /tmp/npy_bench                  # 100000 rows, dimension 384
+//   /tmp/npy_bench 200000 768       # custom rows / dimension
+
+#include "sqlite-vec.c"
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static u64 bench_state = 0x2545F4914F6CDD1Dull;
+
+static f32 bench_uniform(void) {
+  bench_state ^= bench_state << 13;
+  bench_state ^= bench_state >> 7;
+  bench_state ^= bench_state << 17;
+  return (f32)(bench_state >> 40) / (f32)(1 << 24) * 2.0f - 1.0f;
+}
+
+static int bench_exec(sqlite3 *db, const char *zSql) {
+  char *zErr = NULL;
+  int rc = sqlite3_exec(db, zSql, NULL, NULL, &zErr);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "%s: %s\n", zSql, zErr);
+    sqlite3_free(zErr);
+  }
+  return rc;
+}
+
+static long bench_peak_rss_mb(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024;
+}
+
+// Writes `data` as a version 1.0 .npy file with a 64-byte aligned header.
+static int bench_write_npy(const char *path, const char *descr, int rows,
+                           int dimensions, const void *data, size_t size) {
+  char header[128];
+  int n = snprintf(header, sizeof(header),
+                   "{'descr': '%s', 'fortran_order': False, 'shape': (%d, "
+                   "%d), }",
+                   descr, rows, dimensions);
+  while ((10 + n + 1) % 64) {
+    header[n++] = ' ';
+  }
+  header[n++] = '\n';
+  u16 headerLength = n;
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    return SQLITE_ERROR;
+  }
+  fwrite("\x93NUMPY\x01\x00", 1, 8, file);
+  fwrite(&headerLength, sizeof(headerLength), 1, file);
+  fwrite(header, 1, n, file);
+  size_t written = fwrite(data, 1, size, file);
+  fclose(file);
+  return written == size ? SQLITE_OK : SQLITE_ERROR;
+}
+
+static double bench_scan(sqlite3 *db, const char *path, i64 *bytes) {
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(db,
+                     "SELECT sum(length(vector)) FROM "
+                     "vec_npy_each(vec_npy_file(?))",
+                     -1, &stmt, NULL);
+  sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
+  double t0 = now_ms();
+  *bytes = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : -1;
+  double ms = now_ms() - t0;
+  sqlite3_finalize(stmt);
+  return ms;
+}
+
+// Loads the file into a new vec0 table; returns ms, or -1 if the stored
+// vectors differ from `data`.
+static double bench_load(sqlite3 *db, const char *table, const char *type,
+                         const char *path, int rows, int dimensions,
+                         const u8 *data, size_t vectorSize) {
+  char *zSql = sqlite3_mprintf(
+      "CREATE VIRTUAL TABLE \"%w\" USING vec0(e %s[%d]);", table, type,
+      dimensions);
+  int rc = bench_exec(db, zSql);
+  sqlite3_free(zSql);
+  if (rc != SQLITE_OK) {
+    return -1;
+  }
+  sqlite3_stmt *stmt;
+  zSql = sqlite3_mprintf("INSERT INTO \"%w\"(rowid, e) SELECT rowid + 1, "
+                         "vector FROM vec_npy_each(vec_npy_file(?))",
+                         table);
+  sqlite3_prepare_v2(db, zSql, -1, &stmt, NULL);
+  sqlite3_free(zSql);
+  sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
+  double t0 = now_ms();
+  bench_exec(db, "BEGIN");
+  rc = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+  bench_exec(db, "COMMIT");
+  double ms = now_ms() - t0;
+  sqlite3_finalize(stmt);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "load failed: %s\n", sqlite3_errmsg(db));
+    return -1;
+  }
+
+  zSql = sqlite3_mprintf("SELECT rowid, e FROM \"%w\"", table);
+  sqlite3_prepare_v2(db, zSql, -1, &stmt, NULL);
+  sqlite3_free(zSql);
+  int seen = 0;
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    i64 rowid = sqlite3_column_int64(stmt, 0);
+    if (rowid < 1 || rowid > rows ||
+        (size_t)sqlite3_column_bytes(stmt, 1) != vectorSize ||
+        memcmp(sqlite3_column_blob(stmt, 1),
+               data + (size_t)(rowid - 1) * vectorSize, vectorSize) != 0) {
+      break;
+    }
+    seen++;
+  }
+  sqlite3_finalize(stmt);
+  if (seen != rows) {
+    fprintf(stderr, "MISMATCH %s\n", table);
+    return -1;
+  }
+  return ms;
+}
+
+int main(int argc, char **argv) {
+  int rows = argc > 1 ? atoi(argv[1]) : 100000;
+  int dimensions = argc > 2 ? atoi(argv[2]) : 384;
+  if (rows < 1024 || dimensions < 1 ||
+      dimensions > SQLITE_VEC_VEC0_MAX_DIMENSIONS) {
+    fprintf(stderr, "usage: npy_bench [rows >= 1024] [dimensions]\n");
+    return 2;
+  }
+
+  const char *path = "/tmp/npy_bench.db";
+  remove(path);
+  sqlite3 *db;
+  sqlite3_auto_extension((void (*)(void))sqlite3_vec_init);
+  if (sqlite3_open(path, &db) != SQLITE_OK) {
+    return 2;
+  }
+  sqlite3_vec_numpy_init(db, NULL, NULL);
+  bench_exec(db, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;");
+
+  size_t n = (size_t)rows * dimensions;
+  f32 *floats = malloc(n * sizeof(f32));
+  u16 *halves = malloc(n * sizeof(u16));
+  i8 *bytes = malloc(n);
+  for (size_t i = 0; i < n; i++) {
+    floats[i] = bench_uniform();
+    bytes[i] = (i8)(floats[i] * 127.0f);
+  }
+  vec_f32_to_half(floats, halves, n, SQLITE_VEC_ELEMENT_TYPE_FLOAT16);
+
+  struct {
+    const char *descr;
+    const char *type;
+    const char *file;
+    const void *data;
+    size_t elementSize;
+  } cases[] = {
+      {"<f4", "float", "/tmp/npy_bench_f4.npy", floats, sizeof(f32)},
+      {"<f2", "float16", "/tmp/npy_bench_f2.npy", halves, sizeof(u16)},
+      {"|i1", "int8", "/tmp/npy_bench_i1.npy", bytes, sizeof(i8)},
+  };
+  int failed = 0;
+  for (size_t c = 0; c < countof(cases); c++) {
+    if (bench_write_npy(cases[c].file, cases[c].descr, rows, dimensions,
+                        cases[c].data, n * cases[c].elementSize) !=
+        SQLITE_OK) {
+      return 2;
+    }
+  }
+  long rssBefore = bench_peak_rss_mb();
+
+  printf("rows=%d dimensions=%d\n\n", rows, dimensions);
+  printf("| dtype | file MB | scan ms | load into vec0 ms |\n");
+  printf("|-------|--------:|--------:|------------------:|\n");
+  double scanMs[countof(cases)];
+  for (size_t c = 0; c < countof(cases); c++) {
+    i64 scanned;
+    scanMs[c] = bench_scan(db, cases[c].file, &scanned);
+    if (scanned != (i64)(n * cases[c].elementSize)) {
+      fprintf(stderr, "MISMATCH scan %s\n", cases[c].descr);
+      failed = 1;
+    }
+  }
+  long rssScan = bench_peak_rss_mb();
+  for (size_t c = 0; c < countof(cases); c++) {
+    char table[16];
+    snprintf(table, sizeof(table), "kb%d", (int)c);
+    double loadMs = bench_load(db, table, cases[c].type, cases[c].file, rows,
+                               dimensions, cases[c].data,
+                               dimensions * cases[c].elementSize);
+    if (loadMs < 0) {
+      failed = 1;
+    }
+    printf("| `%s` | %.0f | %.1f | %.0f |\n", cases[c].descr,
+           n * cases[c].elementSize / 1e6, scanMs[c], loadMs);
+  }
+  printf("\npeak RSS: %ld MB before the scans, %ld MB after\n", rssBefore,
+         rssScan);
+
+  sqlite3_close(db);
+  remove(path);
+  for (size_t c = 0; c < countof(cases); c++) {
+    remove(cases[c].file);
+  }
+  free(floats);
+  free(halves);
+  free(bytes);
+  return failed;
+}
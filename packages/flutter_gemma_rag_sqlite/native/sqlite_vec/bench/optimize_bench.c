@@ -0,0 +1,247 @@
+// Benchmark: vec0 KNN over chunks left sparse by deletes, before and after
+// `optimize`.
+//
+// The same rows are loaded into two tables and the same ~70% of them are
+// deleted, scattered over every chunk, so both keep all of their chunks. Then
+// `full` is compacted with one `optimize` and `steps` with repeated
+// `optimize=N` calls, each in its own transaction, until a call moves nothing.
+// Each query must return the same rows and distances before and after, on
+// both tables; a mismatch exits non-zero.
+//
+// Build + run from native/sqlite_vec/:
+//   cc -O3 -DSQLITE_CORE -I src -o /tmp/optimize_bench bench/optimize_bench.c -lsqlite3 -lm -lpthread
+//   /tmp/optimize_bench                  # 100000 rows, dimension 384
+//   /tmp/optimize_bench 200000 768       # custom rows / dimension
+
+#include "sqlite-vec.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_K 10
+#define BENCH_QUERIES 20
+#define BENCH_STEP_ROWS 5000
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static u64 bench_state = 0x2545F4914F6CDD1Dull;
+
+static u64 bench_next(void) {
+  bench_state ^= bench_state << 13;
+  bench_state ^= bench_state >> 7;
+  bench_state ^= bench_state << 17;
+  return bench_state;
+}
+
+static f32 bench_uniform(void) {
+  return (f32)(bench_next() >> 40) / (f32)(1 << 24) * 2.0f - 1.0f;
+}
+
+static int bench_exec(sqlite3 *db, const char *zSql) {
+  char *zErr = NULL;
+  int rc = sqlite3_exec(db, zSql, NULL, NULL, &zErr);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "%s: %s\n", zSql, zErr);
+    sqlite3_free(zErr);
+  }
+  return rc;
+}
+
+// Loads every row into `table`, then deletes the rows flagged in `deleted`.
+static int bench_load(sqlite3 *db, const char *table, const f32 *vectors,
+                      const u8 *deleted, int rows, int dimensions) {
+  char *zSql = sqlite3_mprintf(
+      "CREATE VIRTUAL TABLE \"%w\" USING vec0(e float[%d]);", table,
+      dimensions);
+  int rc = bench_exec(db, zSql);
+  sqlite3_free(zSql);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  sqlite3_stmt *insert, *delete;
+  zSql = sqlite3_mprintf("INSERT INTO \"%w\"(rowid, e) VALUES (?, ?)", table);
+  sqlite3_prepare_v2(db, zSql, -1, &insert, NULL);
+  sqlite3_free(zSql);
+  zSql = sqlite3_mprintf("DELETE FROM \"%w\" WHERE rowid = ?", table);
+  sqlite3_prepare_v2(db, zSql, -1, &delete, NULL);
+  sqlite3_free(zSql);
+  bench_exec(db, "BEGIN");
+  for (int i = 0; i < rows && rc == SQLITE_OK; i++) {
+    sqlite3_reset(insert);
+    sqlite3_bind_int64(insert, 1, i + 1);
+    sqlite3_bind_blob(insert, 2, vectors + (size_t)i * dimensions,
+                      dimensions * sizeof(f32), SQLITE_STATIC);
+    rc = sqlite3_step(insert) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+  }
+  for (int i = 0; i < rows && rc == SQLITE_OK; i++) {
+    if (!deleted[i]) {
+      continue;
+    }
+    sqlite3_reset(delete);
+    sqlite3_bind_int64(delete, 1, i + 1);
+    rc = sqlite3_step(delete) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+  }
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "load failed: %s\n", sqlite3_errmsg(db));
+  }
+  bench_exec(db, "COMMIT");
+  sqlite3_finalize(insert);
+  sqlite3_finalize(delete);
+  return rc;
+}
+
+static int bench_chunks(sqlite3 *db, const char *table) {
+  sqlite3_stmt *stmt;
+  char *zSql =
+      sqlite3_mprintf("SELECT count(*) FROM \"%w_chunks\"", table);
+  sqlite3_prepare_v2(db, zSql, -1, &stmt, NULL);
+  sqlite3_free(zSql);
+  int n = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : -1;
+  sqlite3_finalize(stmt);
+  return n;
+}
+
+// Runs BENCH_QUERIES queries on `table`, storing the results in
+// rowids/distances; returns ms per query.
+static double bench_query(sqlite3 *db, const char *table, const f32 *queries,
+                          int dimensions, i64 *rowids, f32 *distances) {
+  sqlite3_stmt *stmt;
+  char *zSql = sqlite3_mprintf("SELECT rowid, distance FROM \"%w\" "
+                               "WHERE e MATCH ? AND k = %d",
+                               table, BENCH_K);
+  sqlite3_prepare_v2(db, zSql, -1, &stmt, NULL);
+  sqlite3_free(zSql);
+  memset(rowids, 0, BENCH_QUERIES * BENCH_K * sizeof(i64));
+  memset(distances, 0, BENCH_QUERIES * BENCH_K * sizeof(f32));
+  double t0 = now_ms();
+  for (int q = 0; q < BENCH_QUERIES; q++) {
+    sqlite3_reset(stmt);
+    sqlite3_bind_blob(stmt, 1, queries + (size_t)q * dimensions,
+                      dimensions * sizeof(f32), SQLITE_STATIC);
+    for (int r = 0; r < BENCH_K && sqlite3_step(stmt) == SQLITE_ROW; r++) {
+      rowids[q * BENCH_K + r] = sqlite3_column_int64(stmt, 0);
+      distances[q * BENCH_K + r] = (f32)sqlite3_column_double(stmt, 1);
+    }
+  }
+  double ms = (now_ms() - t0) / BENCH_QUERIES;
+  sqlite3_finalize(stmt);
+  return ms;
+}
+
+// Runs `command` on `table` until a call moves no rows; returns ms or -1.
+static double bench_optimize(sqlite3 *db, const char *table,
+                             const char *command, int *steps) {
+  char *zSql = sqlite3_mprintf("INSERT INTO \"%w\"(\"%w\") VALUES (%Q)", table,
+                               table, command);
+  double t0 = now_ms();
+  *steps = 0;
+  for (;;) {
+    // the INSERT itself counts as one change
+    sqlite3_int64 before = sqlite3_total_changes64(db);
+    if (bench_exec(db, zSql) != SQLITE_OK) {
+      sqlite3_free(zSql);
+      return -1;
+    }
+    (*steps)++;
+    if (sqlite3_total_changes64(db) - before < 2) {
+      break;
+    }
+  }
+  sqlite3_free(zSql);
+  return now_ms() - t0;
+}
+
+int main(int argc, char **argv) {
+  int rows = argc > 1 ? atoi(argv[1]) : 100000;
+  int dimensions = argc > 2 ? atoi(argv[2]) : 384;
+  if (rows < 1024 || dimensions < 1 ||
+      dimensions > SQLITE_VEC_VEC0_MAX_DIMENSIONS) {
+    fprintf(stderr, "usage: optimize_bench [rows >= 1024] [dimensions]\n");
+    return 2;
+  }
+
+  const char *path = "/tmp/optimize_bench.db";
+  remove(path);
+  sqlite3 *db;
+  sqlite3_auto_extension((void (*)(void))sqlite3_vec_init);
+  if (sqlite3_open(path, &db) != SQLITE_OK) {
+    return 2;
+  }
+  bench_exec(db, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;");
+
+  f32 *vectors = malloc((size_t)rows * dimensions * sizeof(f32));
+  for (size_t i = 0; i < (size_t)rows * dimensions; i++) {
+    vectors[i] = bench_uniform();
+  }
+  u8 *deleted = malloc(rows);
+  int live = 0;
+  for (int i = 0; i < rows; i++) {
+    deleted[i] = bench_next() % 10 < 7;
+    live += !deleted[i];
+  }
+  if (bench_load(db, "full", vectors, deleted, rows, dimensions) !=
+          SQLITE_OK ||
+      bench_load(db, "steps", vectors, deleted, rows, dimensions) !=
+          SQLITE_OK) {
+    return 2;
+  }
+
+  f32 *queries = malloc((size_t)BENCH_QUERIES * dimensions * sizeof(f32));
+  for (int i = 0; i < BENCH_QUERIES * dimensions; i++) {
+    queries[i] = bench_uniform();
+  }
+  size_t n = BENCH_QUERIES * BENCH_K;
+  i64 *wantRowids = malloc(n * sizeof(i64));
+  f32 *wantDistances = malloc(n * sizeof(f32));
+  i64 *gotRowids = malloc(n * sizeof(i64));
+  f32 *gotDistances = malloc(n * sizeof(f32));
+  int failed = 0;
+
+  int chunksBefore = bench_chunks(db, "full");
+  double beforeMs =
+      bench_query(db, "full", queries, dimensions, wantRowids, wantDistances);
+  int fullSteps, stepSteps;
+  double fullMs = bench_optimize(db, "full", "optimize", &fullSteps);
+  char stepCommand[32];
+  snprintf(stepCommand, sizeof(stepCommand), "optimize=%d", BENCH_STEP_ROWS);
+  double stepMs = bench_optimize(db, "steps", stepCommand, &stepSteps);
+  if (fullMs < 0 || stepMs < 0) {
+    return 2;
+  }
+  const char *tables[2] = {"full", "steps"};
+  double afterMs[2];
+  for (int t = 0; t < 2; t++) {
+    afterMs[t] = bench_query(db, tables[t], queries, dimensions, gotRowids,
+                             gotDistances);
+    if (memcmp(wantRowids, gotRowids, n * sizeof(i64)) != 0 ||
+        memcmp(wantDistances, gotDistances, n * sizeof(f32)) != 0) {
+      fprintf(stderr, "MISMATCH %s\n", tables[t]);
+      failed = 1;
+    }
+  }
+
+  printf("rows=%d live=%d dimensions=%d k=%d\n\n", rows, live, dimensions,
+         BENCH_K);
+  printf("| table | chunks | optimize ms | calls | KNN ms |\n");
+  printf("|-------|-------:|------------:|------:|-------:|\n");
+  printf("| before | %d | - | - | %.2f |\n", chunksBefore, beforeMs);
+  printf("| `optimize` | %d | %.0f | %d | %.2f |\n", bench_chunks(db, "full"),
+         fullMs, fullSteps, afterMs[0]);
+  printf("| `%s` | %d | %.0f | %d | %.2f |\n", stepCommand,
+         bench_chunks(db, "steps"), stepMs, stepSteps, afterMs[1]);
+
+  sqlite3_close(db);
+  remove(path);
+  free(vectors);
+  free(deleted);
+  free(queries);
+  free(wantRowids);
+  free(wantDistances);
+  free(gotRowids);
+  free(gotDistances);
+  return failed;
+}
@@ -0,0 +1,200 @@
+// Benchmark: vec0 KNN scoped to one partition key value, with and without the
+// _chunks partition index.
+//
+// The same rows are loaded into two tables, spread over many `collection`
+// partitions. The `legacy` table then has its _chunks partition index dropped,
+// which is how partitioned tables created before the index look, so finding a
+// collection's chunks scans every _chunks row. Inserts are timed as well,
+// since each one also looks up the latest chunk of its partition. Each query
+// must return the same rows and distances on both tables; a mismatch exits
+// non-zero.
+//
+// At the defaults the index shows up in the load (about 17-19 s down to
+// 13-16 s), not in the KNN: a collection's ~200 rows fit in one chunk, and
+// scanning all 500 _chunks rows for it costs about as much as the index lookup,
+// so both tables answer in ~0.2 ms, within run-to-run noise of each other.
+//
+// Build + run from native/sqlite_vec/:
+//   cc -O3 -DSQLITE_CORE -I src -o /tmp/partition_bench bench/partition_bench.c -lsqlite3 -lm -lpthread
+//   /tmp/partition_bench                  # 100000 rows, dimension 384
+//   /tmp/partition_bench 200000 768       # custom rows / dimension
+
+#include "sqlite-vec.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_K 10
+#define BENCH_QUERIES 500
+#define BENCH_COLLECTIONS 500
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static u64 bench_state = 0x2545F4914F6CDD1Dull;
+
+static f32 bench_uniform(void) {
+  bench_state ^= bench_state << 13;
+  bench_state ^= bench_state >> 7;
+  bench_state ^= bench_state << 17;
+  return (f32)(bench_state >> 40) / (f32)(1 << 24) * 2.0f - 1.0f;
+}
+
+static int bench_exec(sqlite3 *db, const char *zSql) {
+  char *zErr = NULL;
+  int rc = sqlite3_exec(db, zSql, NULL, NULL, &zErr);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "%s: %s\n", zSql, zErr);
+    sqlite3_free(zErr);
+  }
+  return rc;
+}
+
+// Creates `table`, drops its partition index when `legacy` is set, then loads
+// every row; returns the load ms or -1.
+static double bench_load(sqlite3 *db, const char *table, int legacy,
+                         const f32 *vectors, int rows, int dimensions) {
+  char *zSql = sqlite3_mprintf(
+      "CREATE VIRTUAL TABLE \"%w\" USING vec0(collection text partition key, "
+      "e float[%d]);",
+      table, dimensions);
+  int rc = bench_exec(db, zSql);
+  sqlite3_free(zSql);
+  if (rc == SQLITE_OK && legacy) {
+    zSql = sqlite3_mprintf("DROP INDEX \"%w_chunks_partition\"", table);
+    rc = bench_exec(db, zSql);
+    sqlite3_free(zSql);
+  }
+  if (rc != SQLITE_OK) {
+    return -1;
+  }
+  sqlite3_stmt *insert;
+  zSql = sqlite3_mprintf(
+      "INSERT INTO \"%w\"(rowid, collection, e) VALUES (?, ?, ?)", table);
+  sqlite3_prepare_v2(db, zSql, -1, &insert, NULL);
+  sqlite3_free(zSql);
+  double t0 = now_ms();
+  bench_exec(db, "BEGIN");
+  for (int i = 0; i < rows && rc == SQLITE_OK; i++) {
+    char collection[32];
+    snprintf(collection, sizeof(collection), "kb-%04d",
+             i % BENCH_COLLECTIONS);
+    sqlite3_reset(insert);
+    sqlite3_bind_int64(insert, 1, i + 1);
+    sqlite3_bind_text(insert, 2, collection, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_blob(insert, 3, vectors + (size_t)i * dimensions,
+                      dimensions * sizeof(f32), SQLITE_STATIC);
+    rc = sqlite3_step(insert) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+  }
+  bench_exec(db, "COMMIT");
+  double ms = now_ms() - t0;
+  sqlite3_finalize(insert);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "load failed: %s\n", sqlite3_errmsg(db));
+    return -1;
+  }
+  return ms;
+}
+
+// Runs BENCH_QUERIES queries on `table`, each scoped to one collection,
+// storing the results in rowids/distances; returns ms per query.
+static double bench_query(sqlite3 *db, const char *table, const f32 *queries,
+                          int dimensions, i64 *rowids, f32 *distances) {
+  sqlite3_stmt *stmt;
+  char *zSql = sqlite3_mprintf("SELECT rowid, distance FROM \"%w\" "
+                               "WHERE e MATCH ? AND k = %d AND collection = ?",
+                               table, BENCH_K);
+  sqlite3_prepare_v2(db, zSql, -1, &stmt, NULL);
+  sqlite3_free(zSql);
+  memset(rowids, 0, BENCH_QUERIES * BENCH_K * sizeof(i64));
+  memset(distances, 0, BENCH_QUERIES * BENCH_K * sizeof(f32));
+  double t0 = now_ms();
+  for (int q = 0; q < BENCH_QUERIES; q++) {
+    char collection[32];
+    snprintf(collection, sizeof(collection), "kb-%04d",
+             q * 37 % BENCH_COLLECTIONS);
+    sqlite3_reset(stmt);
+    sqlite3_bind_blob(stmt, 1, queries + (size_t)q * dimensions,
+                      dimensions * sizeof(f32), SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, collection, -1, SQLITE_TRANSIENT);
+    for (int r = 0; r < BENCH_K && sqlite3_step(stmt) == SQLITE_ROW; r++) {
+      rowids[q * BENCH_K + r] = sqlite3_column_int64(stmt, 0);
+      distances[q * BENCH_K + r] = (f32)sqlite3_column_double(stmt, 1);
+    }
+  }
+  double ms = (now_ms() - t0) / BENCH_QUERIES;
+  sqlite3_finalize(stmt);
+  return ms;
+}
+
+int main(int argc, char **argv) {
+  int rows = argc > 1 ? atoi(argv[1]) : 100000;
+  int dimensions = argc > 2 ? atoi(argv[2]) : 384;
+  if (rows < BENCH_COLLECTIONS * BENCH_K || dimensions < 1 ||
+      dimensions > SQLITE_VEC_VEC0_MAX_DIMENSIONS) {
+    fprintf(stderr, "usage: partition_bench [rows >= %d] [dimensions]\n",
+            BENCH_COLLECTIONS * BENCH_K);
+    return 2;
+  }
+
+  const char *path = "/tmp/partition_bench.db";
+  remove(path);
+  sqlite3 *db;
+  sqlite3_auto_extension((void (*)(void))sqlite3_vec_init);
+  if (sqlite3_open(path, &db) != SQLITE_OK) {
+    return 2;
+  }
+  bench_exec(db, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;");
+
+  f32 *vectors = malloc((size_t)rows * dimensions * sizeof(f32));
+  for (size_t i = 0; i < (size_t)rows * dimensions; i++) {
+    vectors[i] = bench_uniform();
+  }
+  double loadMs[2];
+  loadMs[0] = bench_load(db, "legacy", 1, vectors, rows, dimensions);
+  loadMs[1] = bench_load(db, "indexed", 0, vectors, rows, dimensions);
+  if (loadMs[0] < 0 || loadMs[1] < 0) {
+    return 2;
+  }
+
+  f32 *queries = malloc((size_t)BENCH_QUERIES * dimensions * sizeof(f32));
+  for (int i = 0; i < BENCH_QUERIES * dimensions; i++) {
+    queries[i] = bench_uniform();
+  }
+  size_t n = BENCH_QUERIES * BENCH_K;
+  i64 *wantRowids = malloc(n * sizeof(i64));
+  f32 *wantDistances = malloc(n * sizeof(f32));
+  i64 *gotRowids = malloc(n * sizeof(i64));
+  f32 *gotDistances = malloc(n * sizeof(f32));
+  int failed = 0;
+
+  double legacyMs = bench_query(db, "legacy", queries, dimensions, wantRowids,
+                                wantDistances);
+  double indexedMs = bench_query(db, "indexed", queries, dimensions, gotRowids,
+                                 gotDistances);
+  if (memcmp(wantRowids, gotRowids, n * sizeof(i64)) != 0 ||
+      memcmp(wantDistances, gotDistances, n * sizeof(f32)) != 0) {
+    fprintf(stderr, "MISMATCH\n");
+    failed = 1;
+  }
+
+  printf("rows=%d collections=%d dimensions=%d k=%d\n\n", rows,
+         BENCH_COLLECTIONS, dimensions, BENCH_K);
+  printf("| table | load ms | KNN ms |\n");
+  printf("|-------|--------:|-------:|\n");
+  printf("| no partition index | %.0f | %.2f |\n", loadMs[0], legacyMs);
+  printf("| partition index | %.0f | %.2f |\n", loadMs[1], indexedMs);
+
+  sqlite3_close(db);
+  remove(path);
+  free(vectors);
+  free(queries);
+  free(wantRowids);
+  free(wantDistances);
+  free(gotRowids);
+  free(gotDistances);
+  return failed;
+}
@@ -0,0 +1,315 @@
+// Benchmark: `quantizer=pq` vec0 columns vs full float32 vectors.
+//
+// Two parts:
+//  1. Kernel level: every 4-bit fast scan kernel (pq4_scan) the host supports
+//     must return exactly the sums of the scalar one; the table shows ns per
+//     block of VEC_PQ4_BLOCK rows at a few subquantizer counts.
+//  2. End to end: the same clustered corpus loaded into a float table and
+//     into PQ tables (nbits 8 and 4, and 4 with a float32 rerank column). The
+//     table shows bytes stored per vector, ms per KNN query and recall@k
+//     against the float table. The rerank table must return the float
+//     table's distance for every row it returns.
+// Any mismatch exits non-zero.
+//
+// Build + run from native/sqlite_vec/:
+//   cc -O3 -DSQLITE_CORE -I src -o /tmp/pq_bench bench/pq_bench.c -lsqlite3 -lm -lpthread
+//   /tmp/pq_bench                  # 50000 rows, dimension 384
+//   /tmp/pq_bench 100000 768       # custom rows / dimension
+
+#include "sqlite-vec.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_K 10
+#define BENCH_QUERIES 20
+#define BENCH_CLUSTERS 256
+#define BENCH_BLOCKS 4096
+#define BENCH_RUNS 5
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static u64 bench_state = 0x2545F4914F6CDD1Dull;
+
+static f32 bench_uniform(void) {
+  bench_state ^= bench_state << 13;
+  bench_state ^= bench_state >> 7;
+  bench_state ^= bench_state << 17;
+  return (f32)(bench_state >> 40) / (f32)(1 << 24) * 2.0f - 1.0f;
+}
+
+struct bench_level {
+  const char *name;
+  int available;
+  vec_pq4_fn scan;
+};
+
+// Checks one level's kernel against the scalar one and prints its timing.
+static int bench_kernel(const struct bench_level *level, size_t m,
+                        volatile u32 *sink) {
+  size_t blockBytes = m * VEC_PQ4_BLOCK / 2;
+  u8 *codes = malloc(BENCH_BLOCKS * blockBytes);
+  u8 *lut = malloc(m * 16);
+  for (size_t i = 0; i < BENCH_BLOCKS * blockBytes; i++) {
+    codes[i] = (u8)(bench_uniform() * 128 + 128);
+  }
+  for (size_t i = 0; i < m * 16; i++) {
+    lut[i] = (u8)(bench_uniform() * 127 + 128);
+  }
+  // saturated tables check the u16 sums can't wrap
+  memset(lut, 255, 16);
+
+  int failed = 0;
+  for (size_t b = 0; b < BENCH_BLOCKS && !failed; b++) {
+    u16 want[VEC_PQ4_BLOCK], got[VEC_PQ4_BLOCK];
+    pq4_scan(codes + b * blockBytes, lut, m, want);
+    level->scan(codes + b * blockBytes, lut, m, got);
+    if (memcmp(want, got, sizeof(want)) != 0) {
+      fprintf(stderr, "MISMATCH pq4_scan %s m=%zu block=%zu\n", level->name,
+              m, b);
+      failed = 1;
+    }
+  }
+
+  double best = 1e30;
+  for (int r = 0; r < BENCH_RUNS; r++) {
+    u32 acc = 0;
+    double t0 = now_ns();
+    for (size_t b = 0; b < BENCH_BLOCKS; b++) {
+      u16 out[VEC_PQ4_BLOCK];
+      level->scan(codes + b * blockBytes, lut, m, out);
+      acc += out[0] + out[VEC_PQ4_BLOCK - 1];
+    }
+    best = fmin(best, (now_ns() - t0) / BENCH_BLOCKS);
+    *sink += acc;
+  }
+  printf("| %zu | %s | %.1f | %.2f |\n", m, level->name, best,
+         best / VEC_PQ4_BLOCK);
+  free(codes);
+  free(lut);
+  return failed;
+}
+
+static int bench_exec(sqlite3 *db, const char *zSql) {
+  char *zErr = NULL;
+  int rc = sqlite3_exec(db, zSql, NULL, NULL, &zErr);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "%s: %s\n", zSql, zErr);
+    sqlite3_free(zErr);
+  }
+  return rc;
+}
+
+// Creates `table` with vector column options `options` and loads vectors;
+// the rerank column, if any, is `full`.
+static int bench_load(sqlite3 *db, const char *table, const char *options,
+                      int rerank, const f32 *vectors, int rows,
+                      int dimensions) {
+  char *zSql = sqlite3_mprintf(
+      "CREATE VIRTUAL TABLE \"%w\" USING vec0(e float[%d] %s%s);", table,
+      dimensions, options, rerank ? ", +full blob" : "");
+  int rc = bench_exec(db, zSql);
+  sqlite3_free(zSql);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  sqlite3_stmt *insert;
+  zSql = sqlite3_mprintf(rerank ? "INSERT INTO \"%w\"(rowid, e, full) "
+                                  "VALUES (?1, ?2, ?2)"
+                                : "INSERT INTO \"%w\"(rowid, e) VALUES (?1, ?2)",
+                         table);
+  sqlite3_prepare_v2(db, zSql, -1, &insert, NULL);
+  sqlite3_free(zSql);
+  bench_exec(db, "BEGIN");
+  for (int i = 0; i < rows; i++) {
+    sqlite3_reset(insert);
+    sqlite3_bind_int64(insert, 1, i + 1);
+    sqlite3_bind_blob(insert, 2, vectors + (size_t)i * dimensions,
+                      dimensions * sizeof(f32), SQLITE_STATIC);
+    if (sqlite3_step(insert) != SQLITE_DONE) {
+      fprintf(stderr, "insert failed: %s\n", sqlite3_errmsg(db));
+      sqlite3_finalize(insert);
+      return SQLITE_ERROR;
+    }
+  }
+  bench_exec(db, "COMMIT");
+  sqlite3_finalize(insert);
+  return SQLITE_OK;
+}
+
+// Bytes of `table`'s vector chunks per row.
+static double bench_bytes(sqlite3 *db, const char *table, int rows) {
+  sqlite3_stmt *stmt;
+  char *zSql = sqlite3_mprintf(
+      "SELECT sum(length(vectors)) FROM \"%w_vector_chunks00\"", table);
+  sqlite3_prepare_v2(db, zSql, -1, &stmt, NULL);
+  sqlite3_free(zSql);
+  double bytes = sqlite3_step(stmt) == SQLITE_ROW
+                     ? sqlite3_column_double(stmt, 0) / rows
+                     : 0;
+  sqlite3_finalize(stmt);
+  return bytes;
+}
+
+// Runs the queries on `table`; fills rowids/distances, returns ms per query.
+static double bench_queries(sqlite3 *db, const char *table, const f32 *queries,
+                            int dimensions, i64 *rowids, f32 *distances) {
+  sqlite3_stmt *stmt;
+  char *zSql = sqlite3_mprintf(
+      "SELECT rowid, distance FROM \"%w\" WHERE e MATCH ? AND k = %d", table,
+      BENCH_K);
+  sqlite3_prepare_v2(db, zSql, -1, &stmt, NULL);
+  sqlite3_free(zSql);
+  double t0 = now_ns();
+  for (int q = 0; q < BENCH_QUERIES; q++) {
+    sqlite3_reset(stmt);
+    sqlite3_bind_blob(stmt, 1, queries + (size_t)q * dimensions,
+                      dimensions * sizeof(f32), SQLITE_STATIC);
+    for (int r = 0; r < BENCH_K; r++) {
+      int row = sqlite3_step(stmt) == SQLITE_ROW;
+      rowids[q * BENCH_K + r] = row ? sqlite3_column_int64(stmt, 0) : -1;
+      distances[q * BENCH_K + r] =
+          row ? (f32)sqlite3_column_double(stmt, 1) : -1;
+    }
+  }
+  double ms = (now_ns() - t0) / 1e6 / BENCH_QUERIES;
+  sqlite3_finalize(stmt);
+  return ms;
+}
+
+int main(int argc, char **argv) {
+  int rows = argc > 1 ? atoi(argv[1]) : 50000;
+  int dimensions = argc > 2 ? atoi(argv[2]) : 384;
+  if (rows < 4096 || dimensions < 4 || dimensions % 4 != 0 ||
+      dimensions / 4 > VEC0_PQ_MAX_M ||
+      dimensions > SQLITE_VEC_VEC0_MAX_DIMENSIONS) {
+    fprintf(stderr,
+            "usage: pq_bench [rows >= 4096] [dimensions: multiple of 4, "
+            "<= %d]\n",
+            4 * VEC0_PQ_MAX_M);
+    return 2;
+  }
+  volatile u32 sink = 0;
+  int failed = 0;
+
+  vec_kernels_init();
+  struct bench_level levels[] = {
+      {"scalar", 1, pq4_scan},
+#ifdef SQLITE_VEC_DISPATCH_X86
+      {"avx2", vec_cpu.avx2, pq4_scan_avx2},
+#endif
+#ifdef SQLITE_VEC_DISPATCH_NEON
+      {"neon", vec_cpu.neon, pq4_scan_neon},
+#endif
+  };
+  printf("| m | kernel | ns/block | ns/row |\n");
+  printf("|--:|--------|---------:|-------:|\n");
+  size_t ms[] = {8, 33, 96, 192};
+  for (size_t l = 0; l < countof(levels); l++) {
+    if (!levels[l].available) {
+      continue;
+    }
+    for (size_t i = 0; i < countof(ms); i++) {
+      failed |= bench_kernel(&levels[l], ms[i], &sink);
+    }
+  }
+
+  // clustered, like embeddings, so the codebooks have structure to learn
+  f32 *centers = malloc((size_t)BENCH_CLUSTERS * dimensions * sizeof(f32));
+  f32 *vectors = malloc((size_t)rows * dimensions * sizeof(f32));
+  f32 *queries = malloc((size_t)BENCH_QUERIES * dimensions * sizeof(f32));
+  for (size_t i = 0; i < (size_t)BENCH_CLUSTERS * dimensions; i++) {
+    centers[i] = bench_uniform();
+  }
+  for (int i = 0; i < rows; i++) {
+    const f32 *center = centers + (size_t)(i % BENCH_CLUSTERS) * dimensions;
+    for (int d = 0; d < dimensions; d++) {
+      vectors[(size_t)i * dimensions + d] = center[d] + 0.3f * bench_uniform();
+    }
+  }
+  for (int q = 0; q < BENCH_QUERIES; q++) {
+    const f32 *center = centers + (size_t)(q * 7 % BENCH_CLUSTERS) * dimensions;
+    for (int d = 0; d < dimensions; d++) {
+      queries[(size_t)q * dimensions + d] = center[d] + 0.3f * bench_uniform();
+    }
+  }
+
+  sqlite3 *db;
+  sqlite3_auto_extension((void (*)(void))sqlite3_vec_init);
+  if (sqlite3_open(":memory:", &db) != SQLITE_OK) {
+    return 2;
+  }
+  struct {
+    const char *table;
+    const char *options;
+    int rerank;
+  } tables[] = {
+      {"f32", "", 0},
+      {"pq8", "quantizer=pq(nbits=8)", 0},
+      {"pq4", "quantizer=pq(nbits=4)", 0},
+      {"pq4_rerank", "quantizer=pq(nbits=4) rerank=full", 1},
+  };
+  size_t n = (size_t)BENCH_QUERIES * BENCH_K;
+  i64 *wantRowids = malloc(n * sizeof(i64));
+  f32 *wantDistances = malloc(n * sizeof(f32));
+  i64 *gotRowids = malloc(n * sizeof(i64));
+  f32 *gotDistances = malloc(n * sizeof(f32));
+
+  printf("\nrows=%d dimensions=%d k=%d\n\n", rows, dimensions, BENCH_K);
+  printf("| table | bytes/vector | load ms | query ms | recall@%d |\n",
+         BENCH_K);
+  printf("|-------|-------------:|--------:|---------:|----------:|\n");
+  for (size_t t = 0; t < countof(tables); t++) {
+    double t0 = now_ns();
+    if (bench_load(db, tables[t].table, tables[t].options, tables[t].rerank,
+                   vectors, rows, dimensions) != SQLITE_OK) {
+      return 2;
+    }
+    double loadMs = (now_ns() - t0) / 1e6;
+    double queryMs;
+    int hits = 0;
+    if (t == 0) {
+      queryMs = bench_queries(db, tables[t].table, queries, dimensions,
+                              wantRowids, wantDistances);
+      hits = (int)n;
+    } else {
+      queryMs = bench_queries(db, tables[t].table, queries, dimensions,
+                              gotRowids, gotDistances);
+      for (int q = 0; q < BENCH_QUERIES; q++) {
+        for (int i = 0; i < BENCH_K; i++) {
+          i64 rowid = gotRowids[q * BENCH_K + i];
+          for (int j = 0; j < BENCH_K; j++) {
+            if (wantRowids[q * BENCH_K + j] != rowid) {
+              continue;
+            }
+            hits++;
+            if (tables[t].rerank && memcmp(&wantDistances[q * BENCH_K + j],
+                                           &gotDistances[q * BENCH_K + i],
+                                           sizeof(f32)) != 0) {
+              fprintf(stderr, "MISMATCH %s distance of rowid %lld\n",
+                      tables[t].table, rowid);
+              failed = 1;
+            }
+          }
+        }
+      }
+    }
+    printf("| %s | %.1f | %.0f | %.2f | %.3f |\n", tables[t].table,
+           bench_bytes(db, tables[t].table, rows), loadMs, queryMs,
+           (double)hits / n);
+  }
+
+  sqlite3_close(db);
+  free(centers);
+  free(vectors);
+  free(queries);
+  free(wantRowids);
+  free(wantDistances);
+  free(gotRowids);
+  free(gotDistances);
+  return failed;
+}
@@ -0,0 +1,182 @@
+// Benchmark: vec0 KNN exact chunk scan with `scan_threads` = 1, 2, 4, ... N.
+//
+// One reference table (scan_threads=1) is filled once; each thread count gets
+// a copy of it built with INSERT ... SELECT, is queried, and is dropped again,
+// so at most two copies are resident. Every query's rowids and distances must
+// match the single-threaded scan exactly; a mismatch exits non-zero.
+//
+// Build + run from native/sqlite_vec/:
+//   cc -O3 -DSQLITE_CORE -I src -o /tmp/scan_bench bench/scan_bench.c -lsqlite3 -lm -lpthread
+//   /tmp/scan_bench                    # 50000 rows, dimension 384, N = #cpus
+//   /tmp/scan_bench 200000 768 8       # custom rows / dimension / max threads
+
+#include "sqlite-vec.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_K 10
+#define BENCH_QUERIES 50
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static u64 bench_state = 0x2545F4914F6CDD1Dull;
+
+static f32 bench_uniform(void) {
+  bench_state ^= bench_state << 13;
+  bench_state ^= bench_state >> 7;
+  bench_state ^= bench_state << 17;
+  return (f32)(bench_state >> 40) / (f32)(1 << 24);
+}
+
+static int bench_exec(sqlite3 *db, const char *zSql) {
+  char *zErr = NULL;
+  int rc = sqlite3_exec(db, zSql, NULL, NULL, &zErr);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "%s: %s\n", zSql, zErr);
+    sqlite3_free(zErr);
+  }
+  return rc;
+}
+
+// Runs every query against `table`; returns mean ms/query and fills
+// out_rowids / out_distances (BENCH_QUERIES * BENCH_K each).
+static double bench_queries(sqlite3 *db, const char *table, const f32 *queries,
+                            int dimensions, i64 *out_rowids,
+                            f32 *out_distances) {
+  sqlite3_stmt *stmt;
+  char *zSql = sqlite3_mprintf(
+      "SELECT rowid, distance FROM \"%w\" WHERE e MATCH ? AND k = %d", table,
+      BENCH_K);
+  sqlite3_prepare_v2(db, zSql, -1, &stmt, NULL);
+  sqlite3_free(zSql);
+  double t0 = now_ms();
+  for (int q = 0; q < BENCH_QUERIES; q++) {
+    sqlite3_reset(stmt);
+    sqlite3_bind_blob(stmt, 1, queries + (size_t)q * dimensions,
+                      dimensions * sizeof(f32), SQLITE_STATIC);
+    for (int n = 0; n < BENCH_K; n++) {
+      size_t at = (size_t)q * BENCH_K + n;
+      out_rowids[at] = -1;
+      out_distances[at] = 0;
+      if (sqlite3_step(stmt) == SQLITE_ROW) {
+        out_rowids[at] = sqlite3_column_int64(stmt, 0);
+        out_distances[at] = (f32)sqlite3_column_double(stmt, 1);
+      }
+    }
+  }
+  double ms = (now_ms() - t0) / BENCH_QUERIES;
+  sqlite3_finalize(stmt);
+  return ms;
+}
+
+int main(int argc, char **argv) {
+  int rows = argc > 1 ? atoi(argv[1]) : 50000;
+  int dimensions = argc > 2 ? atoi(argv[2]) : 384;
+  int maxThreads = argc > 3 ? atoi(argv[3]) : vec_cpu_count();
+  if (rows < BENCH_K || dimensions < 1 ||
+      dimensions > SQLITE_VEC_VEC0_MAX_DIMENSIONS || maxThreads < 1 ||
+      maxThreads > VEC0_MAX_SCAN_THREADS) {
+    fprintf(stderr, "usage: scan_bench [rows >= %d] [dimensions] [threads]\n",
+            BENCH_K);
+    return 2;
+  }
+
+  sqlite3 *db;
+  sqlite3_auto_extension((void (*)(void))sqlite3_vec_init);
+  if (sqlite3_open(":memory:", &db) != SQLITE_OK) {
+    return 2;
+  }
+  char *zSql = sqlite3_mprintf(
+      "CREATE VIRTUAL TABLE base USING vec0(e float[%d]);", dimensions);
+  int rc = bench_exec(db, zSql);
+  sqlite3_free(zSql);
+  if (rc != SQLITE_OK) {
+    return 2;
+  }
+
+  f32 *vector = malloc(dimensions * sizeof(f32));
+  sqlite3_stmt *insert;
+  sqlite3_prepare_v2(db, "INSERT INTO base(rowid, e) VALUES (?, ?)", -1,
+                     &insert, NULL);
+  bench_exec(db, "BEGIN");
+  for (int i = 0; i < rows; i++) {
+    for (int d = 0; d < dimensions; d++) {
+      vector[d] = bench_uniform() * 2.0f - 1.0f;
+    }
+    sqlite3_reset(insert);
+    sqlite3_bind_int64(insert, 1, i + 1);
+    sqlite3_bind_blob(insert, 2, vector, dimensions * sizeof(f32),
+                      SQLITE_STATIC);
+    if (sqlite3_step(insert) != SQLITE_DONE) {
+      fprintf(stderr, "insert failed: %s\n", sqlite3_errmsg(db));
+      return 2;
+    }
+  }
+  bench_exec(db, "COMMIT");
+  sqlite3_finalize(insert);
+
+  f32 *queries = malloc((size_t)BENCH_QUERIES * dimensions * sizeof(f32));
+  for (int i = 0; i < BENCH_QUERIES * dimensions; i++) {
+    queries[i] = bench_uniform() * 2.0f - 1.0f;
+  }
+  size_t n = (size_t)BENCH_QUERIES * BENCH_K;
+  i64 *refRowids = malloc(n * sizeof(i64));
+  f32 *refDistances = malloc(n * sizeof(f32));
+  i64 *gotRowids = malloc(n * sizeof(i64));
+  f32 *gotDistances = malloc(n * sizeof(f32));
+
+  double baseMs = bench_queries(db, "base", queries, dimensions, refRowids,
+                                refDistances);
+  printf("rows=%d dimensions=%d chunks=%d\n\n", rows, dimensions,
+         (rows + 1023) / 1024);
+  printf("| scan_threads | ms/query | speedup |\n");
+  printf("|-------------:|---------:|--------:|\n");
+  printf("| 1 | %.2f | 1.00x |\n", baseMs);
+
+  // 2, 4, 8, ... and finally maxThreads itself
+  int counts[VEC0_MAX_SCAN_THREADS];
+  int numCounts = 0;
+  for (int t = 2; t < maxThreads; t *= 2) {
+    counts[numCounts++] = t;
+  }
+  if (maxThreads > 1) {
+    counts[numCounts++] = maxThreads;
+  }
+
+  int failed = 0;
+  for (int c = 0; c < numCounts; c++) {
+    int threads = counts[c];
+    zSql = sqlite3_mprintf(
+        "CREATE VIRTUAL TABLE scan USING vec0(e float[%d], scan_threads=%d);"
+        "INSERT INTO scan(rowid, e) SELECT rowid, e FROM base;",
+        dimensions, threads);
+    rc = bench_exec(db, zSql);
+    sqlite3_free(zSql);
+    if (rc != SQLITE_OK) {
+      return 2;
+    }
+    double ms = bench_queries(db, "scan", queries, dimensions, gotRowids,
+                              gotDistances);
+    if (memcmp(gotRowids, refRowids, n * sizeof(i64)) != 0 ||
+        memcmp(gotDistances, refDistances, n * sizeof(f32)) != 0) {
+      fprintf(stderr, "MISMATCH scan_threads=%d vs 1\n", threads);
+      failed = 1;
+    }
+    printf("| %d | %.2f | %.2fx |\n", threads, ms, baseMs / ms);
+    bench_exec(db, "DROP TABLE scan");
+  }
+
+  sqlite3_close(db);
+  free(vector);
+  free(queries);
+  free(refRowids);
+  free(refDistances);
+  free(gotRowids);
+  free(gotDistances);
+  return failed;
+}
@@ -0,0 +1,228 @@
+// Benchmark: startup of a read-only knowledge base, opened as a vec0 table or
+// as a vec0_snapshot() file mapped through vec_static_blob_from_file().
+//
+// Rows are loaded into a vec0 table once and written to a snapshot file. Each
+// round then opens a new connection and times until the first KNN query has
+// returned: for `vec0` that is sqlite3_open() + the query, for `snapshot` it
+// is sqlite3_open() + vec_static_blob_from_file() + creating the
+// vec_static_blob_entries table + the query. Later queries are timed
+// separately. Both must return the same rows and distances; a mismatch exits
+// non-zero. Files stay in the OS page cache between rounds, so this measures
+// the warm-start cost of each format, not disk reads.
+//
+// Build + run from native/sqlite_vec/:
+//   cc -O3 -DSQLITE_CORE -I src -o /tmp/snapshot_bench bench/snapshot_bench.c -lsqlite3 -lm -lpthread
+//   /tmp/snapshot_bench                  # 100000 rows, dimension 384
+//   /tmp/snapshot_bench 200000 768       # custom rows / dimension
+
+#include "sqlite-vec.c"
+
+#include <stdio.h>
+#include <time.h>
+
+// also spelled out in the queries in bench_open()
+#define BENCH_K 10
+#define BENCH_QUERIES 20
+#define BENCH_ROUNDS 5
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static u64 bench_state = 0x2545F4914F6CDD1Dull;
+
+static f32 bench_uniform(void) {
+  bench_state ^= bench_state << 13;
+  bench_state ^= bench_state >> 7;
+  bench_state ^= bench_state << 17;
+  return (f32)(bench_state >> 40) / (f32)(1 << 24) * 2.0f - 1.0f;
+}
+
+static int bench_exec(sqlite3 *db, const char *zSql) {
+  char *zErr = NULL;
+  int rc = sqlite3_exec(db, zSql, NULL, NULL, &zErr);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "%s: %s\n", zSql, zErr);
+    sqlite3_free(zErr);
+  }
+  return rc;
+}
+
+static int bench_load(sqlite3 *db, const f32 *vectors, int rows,
+                      int dimensions, const char *snapshot) {
+  char *zSql = sqlite3_mprintf(
+      "CREATE VIRTUAL TABLE kb USING vec0(e float[%d]);", dimensions);
+  int rc = bench_exec(db, zSql);
+  sqlite3_free(zSql);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  sqlite3_stmt *insert;
+  sqlite3_prepare_v2(db, "INSERT INTO kb(rowid, e) VALUES (?, ?)", -1, &insert,
+                     NULL);
+  bench_exec(db, "BEGIN");
+  for (int i = 0; i < rows && rc == SQLITE_OK; i++) {
+    sqlite3_reset(insert);
+    sqlite3_bind_int64(insert, 1, i + 1);
+    sqlite3_bind_blob(insert, 2, vectors + (size_t)i * dimensions,
+                      dimensions * sizeof(f32), SQLITE_STATIC);
+    rc = sqlite3_step(insert) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+  }
+  bench_exec(db, "COMMIT");
+  sqlite3_finalize(insert);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "load failed: %s\n", sqlite3_errmsg(db));
+    return rc;
+  }
+  zSql = sqlite3_mprintf("SELECT vec0_snapshot('kb', %Q)", snapshot);
+  rc = bench_exec(db, zSql);
+  sqlite3_free(zSql);
+  return rc;
+}
+
+// Runs queries [from, to) on an open statement, storing the results in
+// rowids/distances.
+static void bench_query(sqlite3_stmt *stmt, const f32 *queries, int dimensions,
+                        int from, int to, i64 *rowids, f32 *distances) {
+  for (int q = from; q < to; q++) {
+    sqlite3_reset(stmt);
+    sqlite3_bind_blob(stmt, 1, queries + (size_t)q * dimensions,
+                      dimensions * sizeof(f32), SQLITE_STATIC);
+    for (int r = 0; r < BENCH_K && sqlite3_step(stmt) == SQLITE_ROW; r++) {
+      rowids[q * BENCH_K + r] = sqlite3_column_int64(stmt, 0);
+      distances[q * BENCH_K + r] = (f32)sqlite3_column_double(stmt, 1);
+    }
+  }
+}
+
+// One new connection: returns ms until the first query returned, and the
+// ms per query of the rest in *queryMs; -1 on error.
+static double bench_open(const char *path, const char *snapshot,
+                         const f32 *queries, int dimensions, i64 *rowids,
+                         f32 *distances, double *queryMs) {
+  sqlite3 *db;
+  sqlite3_stmt *stmt = NULL;
+  memset(rowids, 0, BENCH_QUERIES * BENCH_K * sizeof(i64));
+  memset(distances, 0, BENCH_QUERIES * BENCH_K * sizeof(f32));
+  double t0 = now_ms();
+  if (sqlite3_open(path, &db) != SQLITE_OK) {
+    return -1;
+  }
+  if (snapshot) {
+    sqlite3_vec_static_blobs_init(db, NULL, NULL);
+    char *zSql = sqlite3_mprintf(
+        "INSERT INTO vec_static_blobs(name, data) "
+        "VALUES ('kb', vec_static_blob_from_file(%Q));"
+        "CREATE VIRTUAL TABLE temp.kb_snapshot "
+        "USING vec_static_blob_entries(kb);",
+        snapshot);
+    int rc = bench_exec(db, zSql);
+    sqlite3_free(zSql);
+    if (rc != SQLITE_OK) {
+      sqlite3_close(db);
+      return -1;
+    }
+    sqlite3_prepare_v2(db,
+                       "SELECT rowid, distance FROM kb_snapshot WHERE vector "
+                       "MATCH ? AND k = 10 ORDER BY distance",
+                       -1, &stmt, NULL);
+  } else {
+    sqlite3_prepare_v2(db,
+                       "SELECT rowid, distance FROM kb WHERE e MATCH ? "
+                       "AND k = 10",
+                       -1, &stmt, NULL);
+  }
+  if (!stmt) {
+    fprintf(stderr, "prepare failed: %s\n", sqlite3_errmsg(db));
+    sqlite3_close(db);
+    return -1;
+  }
+  bench_query(stmt, queries, dimensions, 0, 1, rowids, distances);
+  double firstMs = now_ms() - t0;
+  t0 = now_ms();
+  bench_query(stmt, queries, dimensions, 1, BENCH_QUERIES, rowids, distances);
+  *queryMs = (now_ms() - t0) / (BENCH_QUERIES - 1);
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+  return firstMs;
+}
+
+int main(int argc, char **argv) {
+  int rows = argc > 1 ? atoi(argv[1]) : 100000;
+  int dimensions = argc > 2 ? atoi(argv[2]) : 384;
+  if (rows < 1024 || dimensions < 1 ||
+      dimensions > SQLITE_VEC_VEC0_MAX_DIMENSIONS) {
+    fprintf(stderr, "usage: snapshot_bench [rows >= 1024] [dimensions]\n");
+    return 2;
+  }
+
+  const char *path = "/tmp/snapshot_bench.db";
+  const char *snapshot = "/tmp/snapshot_bench.vec0";
+  remove(path);
+  remove(snapshot);
+  sqlite3 *db;
+  sqlite3_auto_extension((void (*)(void))sqlite3_vec_init);
+  if (sqlite3_open(path, &db) != SQLITE_OK) {
+    return 2;
+  }
+  bench_exec(db, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;");
+  f32 *vectors = malloc((size_t)rows * dimensions * sizeof(f32));
+  for (size_t i = 0; i < (size_t)rows * dimensions; i++) {
+    vectors[i] = bench_uniform();
+  }
+  if (bench_load(db, vectors, rows, dimensions, snapshot) != SQLITE_OK) {
+    return 2;
+  }
+  sqlite3_close(db);
+
+  f32 *queries = malloc((size_t)BENCH_QUERIES * dimensions * sizeof(f32));
+  for (int i = 0; i < BENCH_QUERIES * dimensions; i++) {
+    queries[i] = bench_uniform();
+  }
+  size_t n = BENCH_QUERIES * BENCH_K;
+  i64 *wantRowids = malloc(n * sizeof(i64));
+  f32 *wantDistances = malloc(n * sizeof(f32));
+  i64 *gotRowids = malloc(n * sizeof(i64));
+  f32 *gotDistances = malloc(n * sizeof(f32));
+  int failed = 0;
+
+  // best of BENCH_ROUNDS, alternating so both see the same cache state
+  double firstMs[2] = {1e300, 1e300}, queryMs[2] = {1e300, 1e300};
+  for (int round = 0; round < BENCH_ROUNDS; round++) {
+    double q[2];
+    double f0 = bench_open(path, NULL, queries, dimensions, wantRowids,
+                           wantDistances, &q[0]);
+    double f1 = bench_open(path, snapshot, queries, dimensions, gotRowids,
+                           gotDistances, &q[1]);
+    if (f0 < 0 || f1 < 0) {
+      return 2;
+    }
+    if (memcmp(wantRowids, gotRowids, n * sizeof(i64)) != 0 ||
+        memcmp(wantDistances, gotDistances, n * sizeof(f32)) != 0) {
+      fprintf(stderr, "MISMATCH round %d\n", round);
+      failed = 1;
+    }
+    firstMs[0] = f0 < firstMs[0] ? f0 : firstMs[0];
+    firstMs[1] = f1 < firstMs[1] ? f1 : firstMs[1];
+    queryMs[0] = q[0] < queryMs[0] ? q[0] : queryMs[0];
+    queryMs[1] = q[1] < queryMs[1] ? q[1] : queryMs[1];
+  }
+
+  printf("rows=%d dimensions=%d k=%d\n\n", rows, dimensions, BENCH_K);
+  printf("| source | open + first KNN ms | KNN ms |\n");
+  printf("|--------|-------------------:|-------:|\n");
+  printf("| vec0 table | %.2f | %.2f |\n", firstMs[0], queryMs[0]);
+  printf("| snapshot file | %.2f | %.2f |\n", firstMs[1], queryMs[1]);
+
+  remove(path);
+  remove(snapshot);
+  free(vectors);
+  free(queries);
+  free(wantRowids);
+  free(wantDistances);
+  free(gotRowids);
+  free(gotDistances);
+  return failed;
+}
@@ -0,0 +1,174 @@
+// Micro-benchmark: vec0 KNN top-k selection, per-chunk min_idx() + merge vs
+// the running Vec0TopK heap used by vec0Filter_knn_chunks_iter.
+//
+// Only the selection step is timed: distances are precomputed for
+// BENCH_CHUNKS chunks of BENCH_CHUNK_SIZE rows, so the numbers isolate the
+// O(k*n) per-chunk scan the heap replaces. Both paths must return the same
+// distances; a mismatch exits non-zero.
+//
+// Build + run from native/sqlite_vec/:
+//   cc -O3 -DSQLITE_CORE -I src -o /tmp/topk_bench bench/topk_bench.c -lsqlite3 -lm
+//   /tmp/topk_bench                    # k = 1,10,100,1000
+//   /tmp/topk_bench 5 50               # custom k values (<= 1024)
+
+#include "sqlite-vec.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_CHUNK_SIZE 1024
+#define BENCH_CHUNKS 128
+#define BENCH_RUNS 5
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// The pre-heap reconciliation step, kept verbatim as the baseline.
+static void baseline_merge(f32 *a, i64 *a_rowids, i64 a_length, f32 *b,
+                           i64 *b_rowids, i32 *b_top_idxs, i64 b_length,
+                           f32 *out, i64 *out_rowids, i64 out_length,
+                           i64 *out_used) {
+  i64 ptrA = 0;
+  i64 ptrB = 0;
+  for (int i = 0; i < out_length; i++) {
+    if ((ptrA >= a_length) && (ptrB >= b_length)) {
+      *out_used = i;
+      return;
+    }
+    if (ptrA >= a_length) {
+      out[i] = b[b_top_idxs[ptrB]];
+      out_rowids[i] = b_rowids[b_top_idxs[ptrB]];
+      ptrB++;
+    } else if (ptrB >= b_length) {
+      out[i] = a[ptrA];
+      out_rowids[i] = a_rowids[ptrA];
+      ptrA++;
+    } else if (a[ptrA] <= b[b_top_idxs[ptrB]]) {
+      out[i] = a[ptrA];
+      out_rowids[i] = a_rowids[ptrA];
+      ptrA++;
+    } else {
+      out[i] = b[b_top_idxs[ptrB]];
+      out_rowids[i] = b_rowids[b_top_idxs[ptrB]];
+      ptrB++;
+    }
+  }
+  *out_used = out_length;
+}
+
+static void run_baseline(const f32 *distances, const i64 *rowids, u8 *validity,
+                         i64 k, f32 *out_d, i64 *out_r, i64 *out_used) {
+  f32 *tmp_d = malloc(k * sizeof(f32));
+  i64 *tmp_r = malloc(k * sizeof(i64));
+  i32 *idxs = malloc(k * sizeof(i32));
+  u8 *taken = bitmap_new(BENCH_CHUNK_SIZE);
+  i64 used = 0;
+  for (int c = 0; c < BENCH_CHUNKS; c++) {
+    const f32 *cd = distances + (size_t)c * BENCH_CHUNK_SIZE;
+    const i64 *cr = rowids + (size_t)c * BENCH_CHUNK_SIZE;
+    i32 used1;
+    min_idx(cd, BENCH_CHUNK_SIZE, validity, idxs, (i32)k, taken, &used1);
+    i64 merged;
+    baseline_merge(out_d, out_r, used, (f32 *)cd, (i64 *)cr, idxs, used1,
+                   tmp_d, tmp_r, k, &merged);
+    memcpy(out_d, tmp_d, merged * sizeof(f32));
+    memcpy(out_r, tmp_r, merged * sizeof(i64));
+    used = merged;
+  }
+  *out_used = used;
+  free(tmp_d);
+  free(tmp_r);
+  free(idxs);
+  sqlite3_free(taken);
+}
+
+static void run_heap(const f32 *distances, const i64 *rowids, u8 *validity,
+                     i64 k, f32 *out_d, i64 *out_r, i64 *out_used) {
+  struct Vec0TopK topk;
+  vec0_topk_init(&topk, k);
+  for (int c = 0; c < BENCH_CHUNKS; c++) {
+    const f32 *cd = distances + (size_t)c * BENCH_CHUNK_SIZE;
+    const i64 *cr = rowids + (size_t)c * BENCH_CHUNK_SIZE;
+    for (int i = 0; i < BENCH_CHUNK_SIZE; i++) {
+      if (bitmap_get(validity, i) && vec0_topk_would_accept(&topk, cd[i])) {
+        vec0_topk_push(&topk, cd[i], cr[i]);
+      }
+    }
+  }
+  vec0_topk_finish(&topk, out_r, out_d, out_used);
+  vec0_topk_clear(&topk);
+}
+
+typedef void (*select_fn)(const f32 *, const i64 *, u8 *, i64, f32 *, i64 *,
+                          i64 *);
+
+static double time_select(select_fn fn, const f32 *distances,
+                          const i64 *rowids, u8 *validity, i64 k, f32 *out_d,
+                          i64 *out_r, i64 *out_used) {
+  double runs[BENCH_RUNS];
+  for (int r = 0; r < BENCH_RUNS; r++) {
+    double t0 = now_ms();
+    fn(distances, rowids, validity, k, out_d, out_r, out_used);
+    runs[r] = now_ms() - t0;
+  }
+  qsort(runs, BENCH_RUNS, sizeof(double), cmp_double);
+  return runs[BENCH_RUNS / 2];
+}
+
+int main(int argc, char **argv) {
+  i64 defaults[] = {1, 10, 100, 1000};
+  size_t n = (size_t)BENCH_CHUNKS * BENCH_CHUNK_SIZE;
+  f32 *distances = malloc(n * sizeof(f32));
+  i64 *rowids = malloc(n * sizeof(i64));
+  u8 *validity = bitmap_new(BENCH_CHUNK_SIZE);
+  u64 state = 0x2545F4914F6CDD1Dull;
+  for (size_t i = 0; i < n; i++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    distances[i] = (f32)(state >> 40) / (f32)(1 << 24);
+    rowids[i] = (i64)i + 1;
+  }
+  bitmap_fill(validity, BENCH_CHUNK_SIZE);
+
+  int failed = 0;
+  printf("| k | rows | min_idx+merge ms | heap ms | speedup |\n");
+  printf("|--:|-----:|-----------------:|--------:|--------:|\n");
+  int nk = argc > 1 ? argc - 1 : (int)countof(defaults);
+  for (int ik = 0; ik < nk; ik++) {
+    i64 k = argc > 1 ? strtoll(argv[ik + 1], NULL, 10) : defaults[ik];
+    if (k < 1 || k > BENCH_CHUNK_SIZE) {
+      fprintf(stderr, "k must be in [1, %d]\n", BENCH_CHUNK_SIZE);
+      return 2;
+    }
+    f32 *bd = malloc(k * sizeof(f32)), *hd = malloc(k * sizeof(f32));
+    i64 *br = malloc(k * sizeof(i64)), *hr = malloc(k * sizeof(i64));
+    i64 bused, hused;
+    double tb = time_select(run_baseline, distances, rowids, validity, k, bd,
+                            br, &bused);
+    double th =
+        time_select(run_heap, distances, rowids, validity, k, hd, hr, &hused);
+    if (bused != hused || memcmp(bd, hd, k * sizeof(f32)) != 0) {
+      fprintf(stderr, "MISMATCH at k=%lld\n", (long long)k);
+      failed = 1;
+    }
+    printf("| %lld | %zu | %.2f | %.2f | %.1fx |\n", (long long)k, n, tb, th,
+           tb / th);
+    free(bd);
+    free(hd);
+    free(br);
+    free(hr);
+  }
+  free(distances);
+  free(rowids);
+  sqlite3_free(validity);
+  return failed;
+}
@@ -0,0 +1,206 @@
+// Benchmark: metadata-filtered vec0 KNN with and without chunk zone maps.
+//
+// The same rows are loaded into two tables. `created_at` grows with the
+// rowid, `doc_id` changes every 64 rows and `lang` cycles over a few values,
+// so selective filters on the first two only match a handful of chunks. The
+// `legacy` table then has its _metadatazonesNN shadow tables dropped, which is
+// how tables created before zone maps look, and scans every chunk. Each filter
+// must return the same rows and distances on both tables; a mismatch exits
+// non-zero.
+//
+// Build + run from native/sqlite_vec/:
+//   cc -O3 -DSQLITE_CORE -I src -o /tmp/zonemap_bench bench/zonemap_bench.c -lsqlite3 -lm -lpthread
+//   /tmp/zonemap_bench                  # 100000 rows, dimension 384
+//   /tmp/zonemap_bench 200000 768       # custom rows / dimension
+
+#include "sqlite-vec.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_K 10
+#define BENCH_QUERIES 20
+#define BENCH_DOC_ROWS 64
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static u64 bench_state = 0x2545F4914F6CDD1Dull;
+
+static f32 bench_uniform(void) {
+  bench_state ^= bench_state << 13;
+  bench_state ^= bench_state >> 7;
+  bench_state ^= bench_state << 17;
+  return (f32)(bench_state >> 40) / (f32)(1 << 24) * 2.0f - 1.0f;
+}
+
+static int bench_exec(sqlite3 *db, const char *zSql) {
+  char *zErr = NULL;
+  int rc = sqlite3_exec(db, zSql, NULL, NULL, &zErr);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "%s: %s\n", zSql, zErr);
+    sqlite3_free(zErr);
+  }
+  return rc;
+}
+
+static int bench_load(sqlite3 *db, const char *table, const f32 *vectors,
+                      int rows, int dimensions) {
+  static const char *langs[] = {"en", "de", "fr", "ja", "pt"};
+  char *zSql = sqlite3_mprintf(
+      "CREATE VIRTUAL TABLE \"%w\" USING vec0(e float[%d], "
+      "created_at integer, doc_id text, lang text);",
+      table, dimensions);
+  int rc = bench_exec(db, zSql);
+  sqlite3_free(zSql);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  sqlite3_stmt *insert;
+  zSql = sqlite3_mprintf("INSERT INTO \"%w\"(rowid, e, created_at, doc_id, "
+                         "lang) VALUES (?, ?, ?, ?, ?)",
+                         table);
+  sqlite3_prepare_v2(db, zSql, -1, &insert, NULL);
+  sqlite3_free(zSql);
+  bench_exec(db, "BEGIN");
+  for (int i = 0; i < rows; i++) {
+    char docId[32];
+    snprintf(docId, sizeof(docId), "doc-%06d", i / BENCH_DOC_ROWS);
+    sqlite3_reset(insert);
+    sqlite3_bind_int64(insert, 1, i + 1);
+    sqlite3_bind_blob(insert, 2, vectors + (size_t)i * dimensions,
+                      dimensions * sizeof(f32), SQLITE_STATIC);
+    sqlite3_bind_int64(insert, 3, 1700000000 + (i64)i * 60);
+    sqlite3_bind_text(insert, 4, docId, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(insert, 5, langs[i % countof(langs)], -1,
+                      SQLITE_STATIC);
+    if (sqlite3_step(insert) != SQLITE_DONE) {
+      fprintf(stderr, "insert failed: %s\n", sqlite3_errmsg(db));
+      sqlite3_finalize(insert);
+      return SQLITE_ERROR;
+    }
+  }
+  bench_exec(db, "COMMIT");
+  sqlite3_finalize(insert);
+  return SQLITE_OK;
+}
+
+// Runs BENCH_QUERIES queries with `filter` on `table`, storing the results in
+// rowids/distances; returns ms per query.
+static double bench_query(sqlite3 *db, const char *table, const char *filter,
+                          const f32 *queries, int dimensions, i64 *rowids,
+                          f32 *distances) {
+  sqlite3_stmt *stmt;
+  char *zSql = sqlite3_mprintf("SELECT rowid, distance FROM \"%w\" "
+                               "WHERE e MATCH ? AND k = %d AND %s",
+                               table, BENCH_K, filter);
+  sqlite3_prepare_v2(db, zSql, -1, &stmt, NULL);
+  sqlite3_free(zSql);
+  memset(rowids, 0, BENCH_QUERIES * BENCH_K * sizeof(i64));
+  memset(distances, 0, BENCH_QUERIES * BENCH_K * sizeof(f32));
+  double t0 = now_ms();
+  for (int q = 0; q < BENCH_QUERIES; q++) {
+    sqlite3_reset(stmt);
+    sqlite3_bind_blob(stmt, 1, queries + (size_t)q * dimensions,
+                      dimensions * sizeof(f32), SQLITE_STATIC);
+    for (int r = 0; r < BENCH_K && sqlite3_step(stmt) == SQLITE_ROW; r++) {
+      rowids[q * BENCH_K + r] = sqlite3_column_int64(stmt, 0);
+      distances[q * BENCH_K + r] = (f32)sqlite3_column_double(stmt, 1);
+    }
+  }
+  double ms = (now_ms() - t0) / BENCH_QUERIES;
+  sqlite3_finalize(stmt);
+  return ms;
+}
+
+int main(int argc, char **argv) {
+  int rows = argc > 1 ? atoi(argv[1]) : 100000;
+  int dimensions = argc > 2 ? atoi(argv[2]) : 384;
+  if (rows < 1024 || dimensions < 1 ||
+      dimensions > SQLITE_VEC_VEC0_MAX_DIMENSIONS) {
+    fprintf(stderr, "usage: zonemap_bench [rows >= 1024] [dimensions]\n");
+    return 2;
+  }
+
+  const char *path = "/tmp/zonemap_bench.db";
+  remove(path);
+  sqlite3 *db;
+  sqlite3_auto_extension((void (*)(void))sqlite3_vec_init);
+  if (sqlite3_open(path, &db) != SQLITE_OK) {
+    return 2;
+  }
+  bench_exec(db, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;");
+
+  f32 *vectors = malloc((size_t)rows * dimensions * sizeof(f32));
+  for (size_t i = 0; i < (size_t)rows * dimensions; i++) {
+    vectors[i] = bench_uniform();
+  }
+  if (bench_load(db, "zoned", vectors, rows, dimensions) != SQLITE_OK ||
+      bench_load(db, "legacy", vectors, rows, dimensions) != SQLITE_OK) {
+    return 2;
+  }
+  for (int i = 0; i < 3; i++) {
+    char *zSql =
+        sqlite3_mprintf("DROP TABLE \"legacy_metadatazones%02d\"", i);
+    int rc = bench_exec(db, zSql);
+    sqlite3_free(zSql);
+    if (rc != SQLITE_OK) {
+      return 2;
+    }
+  }
+  // reconnect, so that `legacy` is opened without zone maps
+  sqlite3_close(db);
+  if (sqlite3_open(path, &db) != SQLITE_OK) {
+    return 2;
+  }
+
+  f32 *queries = malloc((size_t)BENCH_QUERIES * dimensions * sizeof(f32));
+  for (int i = 0; i < BENCH_QUERIES * dimensions; i++) {
+    queries[i] = bench_uniform();
+  }
+  i64 last = 1700000000 + (i64)(rows - 1) * 60;
+  char filters[4][128];
+  snprintf(filters[0], sizeof(filters[0]), "created_at > %lld",
+           (long long)(last - 500 * 60));
+  snprintf(filters[1], sizeof(filters[1]), "doc_id = 'doc-%06d'",
+           rows / BENCH_DOC_ROWS / 2);
+  snprintf(filters[2], sizeof(filters[2]),
+           "doc_id IN ('doc-000003', 'doc-%06d')", rows / BENCH_DOC_ROWS - 1);
+  snprintf(filters[3], sizeof(filters[3]), "lang = 'ja'");
+
+  size_t n = BENCH_QUERIES * BENCH_K;
+  i64 *wantRowids = malloc(n * sizeof(i64));
+  f32 *wantDistances = malloc(n * sizeof(f32));
+  i64 *gotRowids = malloc(n * sizeof(i64));
+  f32 *gotDistances = malloc(n * sizeof(f32));
+  int failed = 0;
+  printf("rows=%d dimensions=%d k=%d\n\n", rows, dimensions, BENCH_K);
+  printf("| filter | no zone maps ms | zone maps ms | speedup |\n");
+  printf("|--------|----------------:|-------------:|--------:|\n");
+  for (size_t f = 0; f < countof(filters); f++) {
+    double legacyMs = bench_query(db, "legacy", filters[f], queries,
+                                  dimensions, wantRowids, wantDistances);
+    double zonedMs = bench_query(db, "zoned", filters[f], queries, dimensions,
+                                 gotRowids, gotDistances);
+    if (memcmp(wantRowids, gotRowids, n * sizeof(i64)) != 0 ||
+        memcmp(wantDistances, gotDistances, n * sizeof(f32)) != 0) {
+      fprintf(stderr, "MISMATCH %s\n", filters[f]);
+      failed = 1;
+    }
+    printf("| `%s` | %.2f | %.2f | %.1fx |\n", filters[f], legacyMs, zonedMs,
+           legacyMs / zonedMs);
+  }
+
+  sqlite3_close(db);
+  remove(path);
+  free(vectors);
+  free(queries);
+  free(wantRowids);
+  free(wantDistances);
+  free(gotRowids);
+  free(gotDistances);
+  return failed;
+}
@@ -7,11 +7,14 @@
 # asg017 android loadable ships with 4 KB ELF LOAD-segment alignment, which
 # Android 15 (16 KB pages) and Google Play targetSdk 35+ reject at dlopen. We
 # REBUILD android from the sqlite-vec amalgamation with
-# `-Wl,-z,max-page-size=16384` (the same fix qdrant applies, #319). The other
-# platforms have no alignment constraint, so we just repackage asg017's upstream
-# loadable under our naming.
+# `-Wl,-z,max-page-size=16384` (the same fix qdrant applies, #319). linux x86_64
+# is rebuilt too: upstream's loadable is compiled without SIMD, while the
+# vendored amalgamation picks AVX2/AVX-512 kernels at load time (see
+# `vec_debug()`), so one portable binary runs the widest kernel the host has.
+# The remaining platforms just repackage asg017's upstream loadable.
 #
-# Inputs : SQLITE_VEC_VERSION env (default "0.1.9"); ANDROID_NDK_HOME for android.
+# Inputs : SQLITE_VEC_VERSION env (default "0.1.9"); ANDROID_NDK_HOME for android;
+#          CC (default cc) on a linux x86_64 host for linux.
 # Outputs: dist/sqlite-vec-<platform>.tar.gz  (each a flat tar of one vec0 lib)
 #          dist/checksums_sqlite_vec_local.txt
 #
@@ -24,7 +27,7 @@
 #   macos_arm64     → repackage asg017 macos-aarch64           → libvec0.dylib
 #   ios_arm64       → repackage asg017 ios-aarch64             → libvec0.dylib
 #   ios_sim_arm64   → repackage asg017 iossimulator-aarch64    → libvec0.dylib
-#   linux_x86_64    → repackage asg017 linux-x86_64            → libvec0.so
+#   linux_x86_64    → REBUILT from amalgamation, runtime SIMD   → libvec0.so
 #   linux_arm64     → repackage asg017 linux-aarch64           → libvec0.so
 #   windows_x86_64  → repackage asg017 windows-x86_64          → vec0.dll
 set -euo pipefail
@@ -64,16 +67,9 @@ repackage() {
   pack "$dirName" "$ext/$bundledName"
 }
 
-# Rebuild android arm64 from the amalgamation with 16 KB LOAD-segment alignment.
-build_android_arm64() {
-  echo "==> android_arm64 (rebuild from amalgamation, 16 KB aligned)"
-  [ -n "${ANDROID_NDK_HOME:-}" ] || { echo "ERROR: ANDROID_NDK_HOME unset (need NDK r26+)" >&2; exit 1; }
-  local cc
-  cc="$(ls "$ANDROID_NDK_HOME"/toolchains/llvm/prebuilt/*/bin/aarch64-linux-android${ANDROID_API_LEVEL}-clang 2>/dev/null | head -1)"
-  [ -x "$cc" ] || cc="$(ls "$ANDROID_NDK_HOME"/toolchains/llvm/prebuilt/*/bin/aarch64-linux-android*-clang 2>/dev/null | sort -V | tail -1)"
-  [ -x "$cc" ] || { echo "ERROR: android clang not found in NDK" >&2; exit 1; }
-
-  # Fetch the matching sqlite amalgamation headers (sqlite3.h + sqlite3ext.h)
+# Fetch sqlite3.h + sqlite3ext.h and print the directory holding them.
+fetch_sqlite_headers() {
+  # The matching sqlite amalgamation headers (sqlite3.h + sqlite3ext.h)
   # the extension compiles against. Loadable extensions resolve sqlite symbols
   # at runtime via sqlite3_api_routines, so no link against sqlite is needed.
   # sqlite.org buckets amalgamations by release year; try recent years until one
@@ -85,9 +81,21 @@ build_android_arm64() {
     fi
   done
   [ -n "$got" ] || { echo "ERROR: could not fetch sqlite-amalgamation-$SQLITE_VERSION" >&2; exit 1; }
-  echo "    fetched sqlite headers (sqlite.org/$got)"
-  unzip -oq "$WORK/sqlite-amalg.zip" -d "$WORK"
-  local hdr; hdr="$(dirname "$(find "$WORK" -name sqlite3ext.h | head -1)")"
+  echo "    fetched sqlite headers (sqlite.org/$got)" >&2
+  unzip -oq "$zip" -d "$WORK" >&2
+  dirname "$(find "$WORK" -name sqlite3ext.h | head -1)"
+}
+
+# Rebuild android arm64 from the amalgamation with 16 KB LOAD-segment alignment.
+build_android_arm64() {
+  echo "==> android_arm64 (rebuild from amalgamation, 16 KB aligned)"
+  [ -n "${ANDROID_NDK_HOME:-}" ] || { echo "ERROR: ANDROID_NDK_HOME unset (need NDK r26+)" >&2; exit 1; }
+  local cc
+  cc="$(ls "$ANDROID_NDK_HOME"/toolchains/llvm/prebuilt/*/bin/aarch64-linux-android${ANDROID_API_LEVEL}-clang 2>/dev/null | head -1)"
+  [ -x "$cc" ] || cc="$(ls "$ANDROID_NDK_HOME"/toolchains/llvm/prebuilt/*/bin/aarch64-linux-android*-clang 2>/dev/null | sort -V | tail -1)"
+  [ -x "$cc" ] || { echo "ERROR: android clang not found in NDK" >&2; exit 1; }
+
+  local hdr; hdr="$(fetch_sqlite_headers)"
 
   # Loadable-extension mode: SQLITE_CORE must be UNDEFINED (not =0). The
   # amalgamation gates `SQLITE_EXTENSION_INIT1` on `#ifndef SQLITE_CORE`, which
@@ -128,13 +136,28 @@ PY
   pack "android_arm64" "$out/libvec0.so"
 }
 
+# Rebuild linux x86_64 from the amalgamation. No -m flags: the SIMD kernels
+# carry their own target attributes and are picked at load time, so the
+# binary still runs on a baseline x86-64 CPU.
+build_linux_x86_64() {
+  echo "==> linux_x86_64 (rebuild from amalgamation, runtime SIMD dispatch)"
+  [ "$(uname -s)-$(uname -m)" = "Linux-x86_64" ] || { echo "ERROR: linux_x86_64 must be built on a linux x86_64 host" >&2; exit 1; }
+  local hdr; hdr="$(fetch_sqlite_headers)"
+  local out="$WORK/linux_x86_64"; mkdir -p "$out"
+  # SQLITE_CORE left undefined for the same reason as the android build.
+  "${CC:-cc}" -O3 -fPIC -shared -pthread \
+    -I "$SRC_DIR" -I "$hdr" \
+    -o "$out/libvec0.so" "$SRC_DIR/sqlite-vec.c" -lm
+  pack "linux_x86_64" "$out/libvec0.so"
+}
+
 build_target() {
   case "$1" in
     android|android_arm64) build_android_arm64 ;;
     macos|macos_arm64)     repackage macos_arm64    macos-aarch64        vec0.dylib libvec0.dylib ;;
     ios|ios_arm64)         repackage ios_arm64      ios-aarch64          vec0.dylib libvec0.dylib ;;
     ios_sim|ios_sim_arm64) repackage ios_sim_arm64  iossimulator-aarch64 vec0.dylib libvec0.dylib ;;
-    linux|linux_x86_64)    repackage linux_x86_64   linux-x86_64         vec0.so    libvec0.so ;;
+    linux|linux_x86_64)    build_linux_x86_64 ;;
     linux_arm64)           repackage linux_arm64    linux-aarch64        vec0.so    libvec0.so ;;
     windows|windows_x86_64) repackage windows_x86_64 windows-x86_64      vec0.dll   vec0.dll ;;
     all)
@@ -142,7 +165,7 @@ build_target() {
       repackage macos_arm64    macos-aarch64        vec0.dylib libvec0.dylib
       repackage ios_arm64      ios-aarch64          vec0.dylib libvec0.dylib
       repackage ios_sim_arm64  iossimulator-aarch64 vec0.dylib libvec0.dylib
-      repackage linux_x86_64   linux-x86_64         vec0.so    libvec0.so
+      build_linux_x86_64
       repackage linux_arm64    linux-aarch64        vec0.so    libvec0.so
       repackage windows_x86_64 windows-x86_64       vec0.dll   vec0.dll
       ;;
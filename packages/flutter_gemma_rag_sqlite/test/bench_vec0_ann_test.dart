@@ -0,0 +1,45 @@
+// Runner harness for tool/bench_vec0_ann.dart — see
+// test/bench_vector_stores_test.dart for why a test wraps a tool.
+//
+// Needs a vec0 built from native/sqlite_vec/src (the committed prebuilts may
+// predate `index=ivf`; an unknown index type skips that arm):
+//   VEC0_DYLIB=/path/to/vec0.so flutter test test/bench_vec0_ann_test.dart
+//
+// Override via $BENCH_ARGS (same flags as the tool's main), e.g.:
+//   BENCH_ARGS="--sizes=20000 --nprobes=2,8,32" \
+//     flutter test test/bench_vec0_ann_test.dart
+//
+// The test FAILS if recall at the default nprobe / ef_search is below the
+// gate, matching the tool's non-zero exit codes.
+import 'dart:io';
+
+import 'package:flutter_test/flutter_test.dart';
+
+import '../tool/bench_vec0_ann.dart';
+
+void main() {
+  final canRun = (Platform.environment['VEC0_DYLIB'] ?? '').isNotEmpty;
+
+  test(
+    'vec0 ANN recall@k vs latency benchmark (markdown table on stdout)',
+    () {
+      final raw = Platform.environment['BENCH_ARGS'];
+      final args = (raw == null || raw.trim().isEmpty)
+          ? const <String>[]
+          : raw.trim().split(RegExp(r'\s+'));
+      final code = runAnnBench(AnnBenchConfig.parse(args), stdout);
+      expect(
+        code,
+        0,
+        reason: code == 70
+            ? 'vec0 unavailable — set \$VEC0_DYLIB.'
+            : 'Recall gate failed at the default nprobe / ef_search.',
+      );
+    },
+    skip: canRun
+        ? false
+        : 'Benchmark tool — set \$VEC0_DYLIB (and optionally \$BENCH_ARGS) '
+              'to run it.',
+    timeout: const Timeout(Duration(minutes: 20)),
+  );
+}
@@ -158,10 +158,10 @@ void main() {
       // a cross-column OR is not pushable into vec0's KNN, so SQLite evaluates
       // it AFTER vec0 has picked k rows. At k=2 the two nearest (n1, n2) match
       // neither condition and the answer is empty — correct SQL, unreachable
-      // rows. Reaching past them is the STORE's job (SqliteVectorStore
-      // over-fetches up to 16x for exactly this shape); this file tests the
-      // translator, so it asks for a window wide enough that the post-filter
-      // can see the matches.
+      // rows. Reaching past them is the STORE's job (SqliteVectorStore retries
+      // a short answer with the filter as an `id IN (…)` allowlist); this file
+      // tests the translator, so it asks for a window wide enough that the
+      // post-filter can see the matches.
       final got = search(
         const Filter(
           should: [
@@ -220,6 +220,61 @@ void main() {
       expect(stats2.vectorDimension, 6);
     });
 
+    test('the document count follows replaces and removes once counted', () async {
+      await repo.initialize(dbPath);
+      await repo.addDocument(
+        id: 'doc1',
+        content: 'Hello',
+        embedding: [1.0, 0.0, 0.0, 0.0],
+      );
+      // First getStats counts in SQLite; the writes after it keep the count.
+      expect((await repo.getStats()).documentCount, 1);
+      await repo.addDocument(
+        id: 'doc2',
+        content: 'World',
+        embedding: [0.0, 1.0, 0.0, 0.0],
+      );
+      await repo.addDocument(
+        id: 'doc1',
+        content: 'Hello again',
+        embedding: [0.0, 0.0, 1.0, 0.0],
+      );
+      expect((await repo.getStats()).documentCount, 2);
+      await repo.removeDocument(id: 'missing');
+      await repo.removeDocument(id: 'doc2');
+      expect((await repo.getStats()).documentCount, 1);
+    });
+
+    test('searches after clear see the recreated table', () async {
+      // Statements and the query buffer are cached per store; a new table of
+      // another dimension must not be served through the old ones.
+      await repo.initialize(dbPath);
+      await repo.addDocument(
+        id: 'doc1',
+        content: 'Four',
+        embedding: [1.0, 0.0, 0.0, 0.0],
+      );
+      expect(
+        (await repo.searchSimilar(
+          queryEmbedding: [1.0, 0.0, 0.0, 0.0],
+          topK: 1,
+        )).single.id,
+        'doc1',
+      );
+      await repo.clear();
+      await repo.addDocument(
+        id: 'doc2',
+        content: 'Six',
+        embedding: [0.0, 0.0, 0.0, 0.0, 0.0, 1.0],
+      );
+      final results = await repo.searchSimilar(
+        queryEmbedding: [0.0, 0.0, 0.0, 0.0, 0.0, 1.0],
+        topK: 1,
+      );
+      expect(results.single.id, 'doc2');
+      expect(results.single.similarity, closeTo(1.0, 1e-6));
+    });
+
     test('close then reinitialize — data persists on disk', () async {
       await repo.initialize(dbPath);
       await repo.addDocument(
@@ -251,6 +306,31 @@ void main() {
       expect(() => fresh.removeDocument(id: 'x'), throwsStateError);
     });
 
+    test('enableHnsw works whether or not vec0 has index=hnsw', () async {
+      // The bundled prebuilts reject index=hnsw; the store must fall back to
+      // the exact scan there instead of failing the table's CREATE.
+      repo.enableHnsw = true;
+      expect(repo.enableHnsw, isTrue);
+      await repo.initialize(dbPath);
+      for (var i = 0; i < 20; i++) {
+        await repo.addDocument(
+          id: 'd$i',
+          content: 'doc $i',
+          embedding: [1.0, i * 0.1, 0.0, 0.0],
+        );
+      }
+      final results = await repo.searchSimilar(
+        queryEmbedding: [1.0, 0.0, 0.0, 0.0],
+        topK: 3,
+      );
+      expect(results.map((r) => r.id), ['d0', 'd1', 'd2']);
+
+      // still honored (or skipped) after clear() recreates the table
+      await repo.clear();
+      await repo.addDocument(id: 'x', content: 'x', embedding: [1.0, 0.0]);
+      expect((await repo.getStats()).vectorDimension, 2);
+    });
+
     group('declared-column Filter', () {
       final schema = FilterSchema(
         fields: [
@@ -265,12 +345,12 @@ void main() {
       });
 
       test(
-        'over-fetches past the top-k when the filter is not pushable',
+        'reaches past the top-k when the filter is not pushable',
         () async {
           // A cross-column OR cannot be pushed into vec0's KNN, so SQLite applies
-          // it AFTER vec0 has already chosen k rows. Without over-fetching this
-          // returns nothing: the nearest rows match neither condition, and a
-          // post-filter cannot reach past them.
+          // it AFTER vec0 has already chosen k rows. Without the allowlist retry
+          // this returns nothing: the nearest rows match neither condition, and
+          // a post-filter cannot reach past them.
           //
           // Seed so the two nearest are non-matching and the matches sit behind
           // them — the exact shape that used to come back empty.
@@ -311,12 +391,94 @@ void main() {
             got.map((r) => r.id),
             unorderedEquals(['far-fr', 'far-2020']),
             reason:
-                'without over-fetch the post-filter sees only the 2 nearest, '
+                'without the allowlist the post-filter sees only the 2 nearest, '
                 'which match neither condition, and returns nothing',
           );
         },
       );
 
+      test(
+        'an unpushable filter is exact however far the matches sit',
+        () async {
+          // 40 nearer non-matching rows put the match past the 16x window the
+          // store used to over-fetch up to (topK 1 → 16 candidates), where it
+          // came back empty.
+          await repo.initialize(dbPath);
+          for (var i = 0; i < 40; i++) {
+            await repo.addDocument(
+              id: 'near$i',
+              content: 'near $i',
+              embedding: [1.0 - i * 0.001, i * 0.001, 0.0, 0.0],
+              metadata: '{"lang":"de","year":1990,"archived":false}',
+            );
+          }
+          await repo.addDocument(
+            id: 'far',
+            content: 'far',
+            embedding: [0.1, 1.0, 0.0, 0.0],
+            metadata: '{"lang":"fr","year":1990,"archived":false}',
+          );
+          await repo.addDocument(
+            id: 'farther',
+            content: 'farther',
+            embedding: [0.0, 0.0, 1.0, 0.0],
+            metadata: '{"lang":"de","year":2020,"archived":false}',
+          );
+
+          final got = await repo.searchSimilar(
+            queryEmbedding: [1.0, 0.0, 0.0, 0.0],
+            topK: 1,
+            filter: const Filter(
+              should: [
+                FieldEquals(key: 'lang', value: 'fr'),
+                FieldEquals(key: 'year', value: 2020),
+              ],
+            ),
+          );
+          expect(got.map((r) => r.id), ['far']);
+        },
+      );
+
+      test('fewer matches than topK are answered in one pass', () async {
+        // A short answer is only worth the allowlist pass when vec0 stopped
+        // at k and the post-filter then dropped some of those k.
+        await repo.initialize(dbPath);
+        for (var i = 0; i < 6; i++) {
+          await repo.addDocument(
+            id: 'd$i',
+            content: 'doc $i',
+            embedding: [1.0 - i * 0.01, i * 0.01, 0.0, 0.0],
+            metadata: '{"lang":"${i == 3 ? 'fr' : 'de'}","year":${1990 + i},'
+                '"archived":false}',
+          );
+        }
+        const unpushable = Filter(
+          should: [
+            FieldEquals(key: 'lang', value: 'fr'),
+            FieldEquals(key: 'year', value: 1995),
+          ],
+        );
+        Future<List<String>> ids(int topK, Filter filter) async => [
+          for (final r in await repo.searchSimilar(
+            queryEmbedding: [1.0, 0.0, 0.0, 0.0],
+            topK: topK,
+            filter: filter,
+          ))
+            r.id,
+        ];
+
+        // pushed whole: vec0 returns the one match and nothing is dropped
+        const fr = Filter(must: [FieldEquals(key: 'lang', value: 'fr')]);
+        expect(await ids(5, fr), ['d3']);
+        // post-filtered, but vec0 ran out of rows before reaching k
+        expect(await ids(10, unpushable), ['d3', 'd5']);
+        expect(repo.debugAllowlistPasses, 0);
+
+        // k = 2 stops vec0 at d0, d1; both are dropped, so ask again
+        expect(await ids(2, unpushable), ['d3', 'd5']);
+        expect(repo.debugAllowlistPasses, 1);
+      });
+
       Future<void> seed() async {
         await repo.addDocument(
           id: 'en2020',
@@ -518,5 +680,169 @@ void main() {
       );
       expect(negated.map((r) => r.id), ['b']);
     });
+
+    group('collection', () {
+      late SqliteVectorStore docs;
+      late SqliteVectorStore notes;
+
+      setUp(() async {
+        docs = SqliteVectorStore(collection: 'docs');
+        notes = SqliteVectorStore(collection: 'notes');
+        await docs.initialize(dbPath);
+        await notes.initialize(dbPath);
+      });
+
+      tearDown(() async {
+        await docs.close();
+        await notes.close();
+      });
+
+      test('rejects an empty name or one containing U+001F', () {
+        expect(() => SqliteVectorStore(collection: ''), throwsArgumentError);
+        expect(
+          () => SqliteVectorStore(collection: 'a\u001fb'),
+          throwsArgumentError,
+        );
+      });
+
+      test('the same id lives independently in two collections', () async {
+        await docs.addDocument(
+          id: 'x',
+          content: 'from docs',
+          embedding: [1.0, 0.0, 0.0],
+        );
+        await notes.addDocument(
+          id: 'x',
+          content: 'from notes',
+          embedding: [1.0, 0.0, 0.0],
+        );
+        // replacing in one collection leaves the other alone
+        await notes.addDocument(
+          id: 'x',
+          content: 'from notes, v2',
+          embedding: [0.0, 1.0, 0.0],
+        );
+
+        final fromDocs = await docs.searchSimilar(
+          queryEmbedding: [1.0, 0.0, 0.0],
+          topK: 5,
+        );
+        expect(fromDocs.map((r) => (r.id, r.content)), [('x', 'from docs')]);
+        final fromNotes = await notes.searchSimilar(
+          queryEmbedding: [1.0, 0.0, 0.0],
+          topK: 5,
+        );
+        expect(fromNotes.map((r) => (r.id, r.content)), [
+          ('x', 'from notes, v2'),
+        ]);
+      });
+
+      test('search never returns another collection\'s nearer rows', () async {
+        for (var i = 0; i < 5; i++) {
+          await docs.addDocument(
+            id: 'd$i',
+            content: 'doc $i',
+            embedding: [1.0, i * 0.01, 0.0],
+          );
+        }
+        await notes.addDocument(
+          id: 'n0',
+          content: 'far note',
+          embedding: [0.0, 0.0, 1.0],
+        );
+
+        final results = await notes.searchSimilar(
+          queryEmbedding: [1.0, 0.0, 0.0],
+          topK: 3,
+        );
+        expect(results.map((r) => r.id), ['n0']);
+      });
+
+      test('stats, remove and clear stay within the collection', () async {
+        await docs.addDocument(id: 'a', content: 'a', embedding: [1.0, 0.0]);
+        await docs.addDocument(id: 'b', content: 'b', embedding: [0.0, 1.0]);
+        await notes.addDocument(id: 'a', content: 'a', embedding: [1.0, 0.0]);
+
+        expect((await docs.getStats()).documentCount, 2);
+        expect((await notes.getStats()).documentCount, 1);
+
+        await notes.removeDocument(id: 'a');
+        expect((await docs.getStats()).documentCount, 2);
+        expect((await notes.getStats()).documentCount, 0);
+
+        await notes.addDocument(id: 'c', content: 'c', embedding: [1.0, 0.0]);
+        await docs.clear();
+        expect((await docs.getStats()).documentCount, 0);
+        expect((await notes.getStats()).documentCount, 1);
+        // the shared table keeps its dimension after one collection clears
+        expect((await docs.getStats()).vectorDimension, 2);
+      });
+
+      test('does not touch the default store\'s table', () async {
+        await repo.initialize(dbPath);
+        await repo.addDocument(id: 'a', content: 'a', embedding: [1.0, 0.0]);
+        await docs.addDocument(id: 'a', content: 'a', embedding: [1.0, 0.0]);
+        await docs.clear();
+        expect((await repo.getStats()).documentCount, 1);
+      });
+
+      test('a filter combines with the collection scope', () async {
+        final schema = FilterSchema(
+          fields: [FilterField(name: 'lang', type: FilterFieldType.string)],
+        );
+        docs.configure(schema);
+        notes.configure(schema);
+        await docs.addDocument(
+          id: 'en',
+          content: 'en',
+          embedding: [1.0, 0.0],
+          metadata: '{"lang":"en"}',
+        );
+        await notes.addDocument(
+          id: 'en',
+          content: 'en note',
+          embedding: [1.0, 0.0],
+          metadata: '{"lang":"en"}',
+        );
+        await notes.addDocument(
+          id: 'de',
+          content: 'de note',
+          embedding: [0.9, 0.1],
+          metadata: '{"lang":"de"}',
+        );
+
+        final results = await notes.searchSimilar(
+          queryEmbedding: [1.0, 0.0],
+          topK: 5,
+          filter: const Filter(must: [FieldEquals(key: 'lang', value: 'en')]),
+        );
+        expect(results.map((r) => r.content), ['en note']);
+      });
+
+      test('enableHnsw is ignored for collection stores', () async {
+        // vec0 refuses index=hnsw on a partitioned table
+        docs.enableHnsw = true;
+        await docs.addDocument(id: 'a', content: 'a', embedding: [1.0, 0.0]);
+        await docs.addDocument(id: 'b', content: 'b', embedding: [0.0, 1.0]);
+        final results = await docs.searchSimilar(
+          queryEmbedding: [1.0, 0.0],
+          topK: 1,
+        );
+        expect(results.map((r) => r.id), ['a']);
+      });
+
+      test('reserves the collection field name', () {
+        expect(
+          () => docs.configure(
+            FilterSchema(
+              fields: [
+                FilterField(name: 'collection', type: FilterFieldType.string),
+              ],
+            ),
+          ),
+          throwsArgumentError,
+        );
+      });
+    });
   }, skip: skip);
 }
@@ -0,0 +1,389 @@
+// Benchmark: vec0 approximate KNN (`index=hnsw`, `index=ivf`) vs the exact
+// chunk scan — recall@K against latency.
+//
+// Pure-Dart host-VM harness driving vec0 through raw SQL (not the store API),
+// because the knobs being swept — `ef_search`, `nprobe` — are vec0 hidden
+// columns the store does not expose. ONE deterministic clustered corpus
+// (fixed seed, fixed dim) is loaded into a flat, an HNSW and an IVF table; each
+// query runs against all three, and recall@K is measured against the flat
+// table's exact answer. Prints a parseable markdown table, like
+// tool/bench_vector_stores.dart.
+//
+// Prereqs: $VEC0_DYLIB → a vec0 loadable extension built from
+// native/sqlite_vec/src (build_local.sh). An index type the extension does not
+// know (an older prebuilt) is reported and its arm skipped.
+//
+// Run from the package dir:
+//   VEC0_DYLIB=/path/to/vec0.so dart run tool/bench_vec0_ann.dart
+//
+// Flags:
+//   --sizes=10000        corpus sizes (default 10k).
+//   --topk=10            K for KNN and recall@K. Default 10.
+//   --queries=100        distinct query vectors per measurement. Default 100.
+//   --repeats=3          timed passes over the query set; median reported.
+//   --dim=384            embedding dimension. Default 384.
+//   --clusters=64        centers the corpus is drawn around. Default 64.
+//   --seed=1234567       PRNG seed for the deterministic corpus.
+//   --nlist=64           IVF lists. Default 64.
+//   --nprobes=1,4,8,16   IVF nprobe sweep.
+//   --efs=16,64,128      HNSW ef_search sweep.
+//   --min-recall=0.9     gate: the default nprobe / ef_search must reach this.
+
+import 'dart:ffi';
+import 'dart:io';
+import 'dart:math';
+import 'dart:typed_data';
+
+import 'package:sqlite3/sqlite3.dart';
+
+class AnnBenchConfig {
+  AnnBenchConfig({
+    required this.sizes,
+    required this.topK,
+    required this.queries,
+    required this.repeats,
+    required this.dim,
+    required this.clusters,
+    required this.seed,
+    required this.nlist,
+    required this.nprobes,
+    required this.efs,
+    required this.minRecall,
+  });
+
+  final List<int> sizes;
+  final int topK;
+  final int queries;
+  final int repeats;
+  final int dim;
+  final int clusters;
+  final int seed;
+  final int nlist;
+  final List<int> nprobes;
+  final List<int> efs;
+  final double minRecall;
+
+  /// vec0's defaults, which the recall gate applies to.
+  static const defaultNprobe = 8;
+  static const defaultEfSearch = 64;
+
+  static AnnBenchConfig parse(List<String> args) {
+    var sizes = <int>[10000];
+    var topK = 10;
+    var queries = 100;
+    var repeats = 3;
+    var dim = 384;
+    var clusters = 64;
+    var seed = 1234567;
+    var nlist = 64;
+    var nprobes = <int>[1, 4, 8, 16];
+    var efs = <int>[16, 64, 128];
+    var minRecall = 0.9;
+
+    for (final arg in args) {
+      if (arg.startsWith('--sizes=')) {
+        sizes = _ints(arg.substring('--sizes='.length));
+      } else if (arg.startsWith('--topk=')) {
+        topK = int.parse(arg.substring('--topk='.length));
+      } else if (arg.startsWith('--queries=')) {
+        queries = int.parse(arg.substring('--queries='.length));
+      } else if (arg.startsWith('--repeats=')) {
+        repeats = int.parse(arg.substring('--repeats='.length));
+      } else if (arg.startsWith('--dim=')) {
+        dim = int.parse(arg.substring('--dim='.length));
+      } else if (arg.startsWith('--clusters=')) {
+        clusters = int.parse(arg.substring('--clusters='.length));
+      } else if (arg.startsWith('--seed=')) {
+        seed = int.parse(arg.substring('--seed='.length));
+      } else if (arg.startsWith('--nlist=')) {
+        nlist = int.parse(arg.substring('--nlist='.length));
+      } else if (arg.startsWith('--nprobes=')) {
+        nprobes = _ints(arg.substring('--nprobes='.length));
+      } else if (arg.startsWith('--efs=')) {
+        efs = _ints(arg.substring('--efs='.length));
+      } else if (arg.startsWith('--min-recall=')) {
+        minRecall = double.parse(arg.substring('--min-recall='.length));
+      } else {
+        // FormatException (not exit()) so the test harness can surface a bad
+        // flag instead of killing the process. main() maps it to exit 64.
+        throw FormatException('Unknown flag: $arg');
+      }
+    }
+
+    return AnnBenchConfig(
+      sizes: sizes,
+      topK: topK,
+      queries: queries,
+      repeats: repeats,
+      dim: dim,
+      clusters: clusters,
+      seed: seed,
+      nlist: nlist,
+      nprobes: nprobes,
+      efs: efs,
+      minRecall: minRecall,
+    );
+  }
+
+  static List<int> _ints(String csv) => csv
+      .split(',')
+      .map((s) => s.trim())
+      .where((s) => s.isNotEmpty)
+      .map(int.parse)
+      .toList();
+}
+
+/// One row of the results table: an index at one setting of its knob.
+class _Row {
+  _Row(this.arm, this.setting, this.recall, this.medianUs, this.p90Us);
+
+  final String arm;
+  final String setting;
+  final double recall;
+  final double medianUs;
+  final double p90Us;
+}
+
+/// Clustered corpus: each vector is one of [AnnBenchConfig.clusters] centers
+/// plus Gaussian noise. Uniform random vectors have no neighbourhood structure,
+/// which makes every ANN index look worse than it is on real embeddings.
+class _Corpus {
+  _Corpus(this.cfg) : _rng = Random(cfg.seed) {
+    centers = [
+      for (var c = 0; c < cfg.clusters; c++)
+        [for (var d = 0; d < cfg.dim; d++) _gauss()],
+    ];
+  }
+
+  final AnnBenchConfig cfg;
+  final Random _rng;
+  late final List<List<double>> centers;
+
+  double _gauss() {
+    final u1 = _rng.nextDouble().clamp(1e-12, 1.0);
+    final u2 = _rng.nextDouble();
+    return sqrt(-2.0 * log(u1)) * cos(2 * pi * u2);
+  }
+
+  Uint8List next() {
+    final center = centers[_rng.nextInt(centers.length)];
+    final v = Float32List(cfg.dim);
+    for (var d = 0; d < cfg.dim; d++) {
+      v[d] = center[d] + 0.5 * _gauss();
+    }
+    return v.buffer.asUint8List();
+  }
+}
+
+Future<void> main(List<String> args) async {
+  final AnnBenchConfig cfg;
+  try {
+    cfg = AnnBenchConfig.parse(args);
+  } on FormatException catch (e) {
+    stderr.writeln(e.message);
+    exit(64); // EX_USAGE
+  }
+  final code = runAnnBench(cfg, stdout);
+  if (code != 0) exit(code);
+}
+
+/// Runs the benchmark with [cfg], writing the markdown report to [out] and
+/// diagnostics to stderr. Returns a process exit code (0 = ok, 1 = recall gate
+/// failed, 70 = vec0 unavailable). Extracted from [main] for
+/// test/bench_vec0_ann_test.dart, for the same reason as `runBench` in
+/// tool/bench_vector_stores.dart.
+int runAnnBench(AnnBenchConfig cfg, IOSink out) {
+  final vec0Path = Platform.environment['VEC0_DYLIB'];
+  if (vec0Path == null || vec0Path.isEmpty || !File(vec0Path).existsSync()) {
+    stderr.writeln(
+      '[bench] \$VEC0_DYLIB not set or file missing '
+      '(${vec0Path ?? '<unset>'}). Build vec0 from native/sqlite_vec/src and '
+      'point \$VEC0_DYLIB at it.',
+    );
+    return 70; // EX_SOFTWARE
+  }
+  sqlite3.ensureExtensionLoaded(
+    SqliteExtension.inLibrary(DynamicLibrary.open(vec0Path), 'sqlite3_vec_init'),
+  );
+
+  out.writeln('# vec0 ANN benchmark — recall@${cfg.topK} vs latency');
+  out.writeln();
+  out.writeln('- Date (UTC): ${DateTime.now().toUtc().toIso8601String()}');
+  out.writeln(
+    '- Platform: ${Platform.operatingSystem} '
+    '${Platform.operatingSystemVersion}',
+  );
+  out.writeln('- vec0: $vec0Path');
+  out.writeln(
+    '- Dimension: ${cfg.dim} (L2, ${cfg.clusters} clusters) | seed: '
+    '${cfg.seed} | queries: ${cfg.queries} | repeats: ${cfg.repeats}',
+  );
+  out.writeln('- IVF nlist: ${cfg.nlist}');
+  out.writeln();
+
+  var failed = false;
+  for (final size in cfg.sizes) {
+    final rows = _benchSize(cfg, size, out);
+    if (rows == null) continue;
+
+    out.writeln('## $size rows');
+    out.writeln();
+    out.writeln(
+      '| index | setting | recall@${cfg.topK} | median µs | p90 µs '
+      '| speedup vs flat |',
+    );
+    out.writeln(
+      '|:------|:--------|-----------:|----------:|-------:|----------------:|',
+    );
+    final flatUs = rows.first.medianUs;
+    for (final r in rows) {
+      out.writeln(
+        '| ${r.arm} | ${r.setting} | ${r.recall.toStringAsFixed(3)} '
+        '| ${r.medianUs.toStringAsFixed(1)} | ${r.p90Us.toStringAsFixed(1)} '
+        '| ${(flatUs / r.medianUs).toStringAsFixed(2)}× |',
+      );
+      final gated =
+          r.setting == 'nprobe=${AnnBenchConfig.defaultNprobe}' ||
+          r.setting == 'ef_search=${AnnBenchConfig.defaultEfSearch}';
+      if (gated && r.recall < cfg.minRecall) {
+        stderr.writeln(
+          '[bench] RECALL GATE FAILED — ${r.arm} ${r.setting} at $size rows: '
+          '${r.recall.toStringAsFixed(3)} < ${cfg.minRecall}',
+        );
+        failed = true;
+      }
+    }
+    out.writeln();
+  }
+  return failed ? 1 : 0;
+}
+
+/// Loads [size] rows into each table and measures every setting. Null if the
+/// flat table itself could not be built.
+List<_Row>? _benchSize(AnnBenchConfig cfg, int size, IOSink out) {
+  final db = sqlite3.openInMemory();
+  try {
+    final tables = <String, String>{
+      'flat': '',
+      'hnsw': ' index=hnsw',
+      'ivf': ' index=ivf(nlist=${cfg.nlist})',
+    };
+    final available = <String>[];
+    for (final entry in tables.entries) {
+      try {
+        db.execute(
+          'CREATE VIRTUAL TABLE ${entry.key} USING '
+          'vec0(e float[${cfg.dim}]${entry.value})',
+        );
+        available.add(entry.key);
+      } on SqliteException catch (e) {
+        stderr.writeln('[bench] ${entry.key} arm SKIPPED: ${e.message}');
+      }
+    }
+    if (!available.contains('flat')) return null;
+
+    final corpus = _Corpus(cfg);
+    final buildMs = <String, int>{};
+    final vectors = [for (var i = 0; i < size; i++) corpus.next()];
+    for (final table in available) {
+      final insert = db.prepare('INSERT INTO $table(rowid, e) VALUES (?, ?)');
+      final sw = Stopwatch()..start();
+      db.execute('BEGIN');
+      for (var i = 0; i < size; i++) {
+        insert.execute([i + 1, vectors[i]]);
+      }
+      db.execute('COMMIT');
+      sw.stop();
+      insert.close();
+      buildMs[table] = sw.elapsedMilliseconds;
+    }
+    out.writeln(
+      '- $size rows build: '
+      '${[for (final t in available) '$t ${buildMs[t]} ms'].join(', ')}',
+    );
+    out.writeln();
+
+    final queries = [for (var q = 0; q < cfg.queries; q++) corpus.next()];
+    final flat = _measure(db, cfg, 'flat', '', null, queries);
+    final exact = flat.ids;
+    final rows = <_Row>[
+      _Row('flat', 'exact', 1.0, flat.medianUs, flat.p90Us),
+    ];
+    if (available.contains('hnsw')) {
+      for (final ef in cfg.efs) {
+        final m = _measure(db, cfg, 'hnsw', 'ef_search', ef, queries);
+        rows.add(
+          _Row('hnsw', 'ef_search=$ef', _recall(m.ids, exact), m.medianUs,
+              m.p90Us),
+        );
+      }
+    }
+    if (available.contains('ivf')) {
+      for (final nprobe in cfg.nprobes) {
+        final m = _measure(db, cfg, 'ivf', 'nprobe', nprobe, queries);
+        rows.add(
+          _Row('ivf', 'nprobe=$nprobe', _recall(m.ids, exact), m.medianUs,
+              m.p90Us),
+        );
+      }
+    }
+    return rows;
+  } finally {
+    db.close();
+  }
+}
+
+/// Times every query against [table], with hidden column [knob] set to
+/// [value] when given. Returns the per-query ids of the first pass.
+({double medianUs, double p90Us, List<List<int>> ids}) _measure(
+  Database db,
+  AnnBenchConfig cfg,
+  String table,
+  String knob,
+  int? value,
+  List<Uint8List> queries,
+) {
+  final stmt = db.prepare(
+    'SELECT rowid FROM $table WHERE e MATCH ? AND k = ${cfg.topK}'
+    '${value == null ? '' : ' AND $knob = $value'}',
+  );
+  try {
+    // warm-up: one pass, not timed
+    for (final q in queries) {
+      stmt.select([q]);
+    }
+    final latencies = <double>[];
+    List<List<int>>? ids;
+    for (var r = 0; r < cfg.repeats; r++) {
+      final pass = <List<int>>[];
+      for (final q in queries) {
+        final sw = Stopwatch()..start();
+        final result = stmt.select([q]);
+        sw.stop();
+        latencies.add(sw.elapsedMicroseconds.toDouble());
+        pass.add([for (final row in result) row.columnAt(0) as int]);
+      }
+      ids ??= pass;
+    }
+    latencies.sort();
+    return (
+      medianUs: latencies[latencies.length ~/ 2],
+      p90Us: latencies[((latencies.length - 1) * 0.9).round()],
+      ids: ids!,
+    );
+  } finally {
+    stmt.close();
+  }
+}
+
+/// Fraction of the exact top-K ids that [got] found, over all queries.
+double _recall(List<List<int>> got, List<List<int>> exact) {
+  var hits = 0;
+  var total = 0;
+  for (var q = 0; q < exact.length; q++) {
+    final truth = exact[q].toSet();
+    hits += got[q].where(truth.contains).length;
+    total += truth.length;
+  }
+  return total == 0 ? 1.0 : hits / total;
+}